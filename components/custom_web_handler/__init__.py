@@ -1,13 +1,23 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.const import CONF_ID
+from esphome.const import CONF_ID, CONF_PORT
 from esphome.core import CORE
+from esphome.helpers import cpp_string_escape
+from esphome.components.esp32 import add_idf_sdkconfig_option
+import gzip
+import hashlib
 
 DEPENDENCIES = ["web_server_base"]
 CODEOWNERS = ["@custom"]
 
 custom_web_handler_ns = cg.esphome_ns.namespace("custom_web_handler")
 CustomWebHandler = custom_web_handler_ns.class_("CustomWebHandler", cg.Component)
+ContentEncoding = custom_web_handler_ns.enum("ContentEncoding")
+PoolStateFormat = custom_web_handler_ns.enum("PoolStateFormat")
+
+# Declared here rather than imported so the handler builds without pentair_if_ic
+pentair_if_ic_ns = cg.esphome_ns.namespace("pentair_if_ic")
+PentairIfIcComponent = pentair_if_ic_ns.class_("PentairIfIcComponent", cg.PollingComponent)
 
 CONF_ENDPOINTS = "endpoints"
 CONF_PATH = "path"
@@ -16,53 +26,275 @@ CONF_RESPONSE = "response"
 CONF_TEXT = "text"
 CONF_FILE = "file"
 CONF_URL = "url"
+CONF_POOL_STATE = "pool_state"
+CONF_POOL_EVENTS = "pool_events"
+CONF_POOL_COMMANDS = "pool_commands"
+CONF_POOL_SOCKET = "pool_socket"
+CONF_METRICS = "metrics"
+CONF_COALESCE = "coalesce"
+CONF_MAX_CLIENTS = "max_clients"
+CONF_FORMAT = "format"
+CONF_COMPRESSION = "compression"
+CONF_KEEP_UNCOMPRESSED = "keep_uncompressed"
+CONF_CACHE_CONTROL = "cache_control"
+CONF_MAX_CONCURRENT_DOWNLOADS = "max_concurrent_downloads"
+CONF_PROXY_TIMEOUT = "proxy_timeout"
+CONF_MAX_CONCURRENT_PROXIES = "max_concurrent_proxies"
+CONF_PROXY_CACHE_SIZE = "proxy_cache_size"
+CONF_CACHE_TTL = "cache_ttl"
+CONF_STALE_WHILE_REVALIDATE = "stale_while_revalidate"
+
+POOL_STATE_FORMATS = {
+    "json": (PoolStateFormat.POOL_STATE_JSON, "application/json"),
+    "cbor": (PoolStateFormat.POOL_STATE_CBOR, "application/cbor"),
+}
+
+COMPRESSION_GZIP = "gzip"
+COMPRESSION_BROTLI = "br"
+ENCODINGS = {
+    COMPRESSION_BROTLI: ContentEncoding.ENCODING_BROTLI,
+    COMPRESSION_GZIP: ContentEncoding.ENCODING_GZIP,
+}
+
+
+def validate_compression(value):
+    value = cv.ensure_list(cv.one_of(COMPRESSION_GZIP, COMPRESSION_BROTLI, lower=True))(value)
+    if COMPRESSION_BROTLI in value:
+        try:
+            import brotli  # noqa: F401
+        except ImportError as err:
+            raise cv.Invalid("br compression needs the 'brotli' Python package (pip install brotli)") from err
+    return value
+
+
+# Endpoint kinds each option applies to
+ENDPOINT_OPTIONS = {
+    # Events, commands, socket and metrics endpoints set their own
+    CONF_CONTENT_TYPE: (CONF_TEXT, CONF_FILE, CONF_URL, CONF_POOL_STATE),
+    CONF_COMPRESSION: (CONF_FILE,),
+    CONF_KEEP_UNCOMPRESSED: (CONF_FILE,),
+    CONF_CACHE_CONTROL: (CONF_FILE,),
+    CONF_CACHE_TTL: (CONF_URL,),
+    CONF_STALE_WHILE_REVALIDATE: (CONF_URL,),
+    CONF_COALESCE: (CONF_POOL_EVENTS, CONF_POOL_SOCKET),
+    CONF_MAX_CLIENTS: (CONF_POOL_EVENTS, CONF_POOL_SOCKET),
+    CONF_PORT: (CONF_POOL_SOCKET,),
+    CONF_FORMAT: (CONF_POOL_STATE,),
+}
+
+
+def validate_endpoint_options(endpoint):
+    for key, kinds in ENDPOINT_OPTIONS.items():
+        if key in endpoint and not any(kind in endpoint for kind in kinds):
+            names = ", ".join(kinds[:-1]) + " and " + kinds[-1] if len(kinds) > 1 else kinds[0]
+            raise cv.Invalid(f"'{key}' only applies to {names} endpoints")
+    if CONF_STALE_WHILE_REVALIDATE in endpoint and CONF_CACHE_TTL not in endpoint:
+        raise cv.Invalid(f"'{CONF_STALE_WHILE_REVALIDATE}' requires '{CONF_CACHE_TTL}'")
+    return endpoint
 
 ENDPOINT_SCHEMA = cv.Schema(
     {
         cv.Required(CONF_PATH): cv.string,
-        cv.Optional(CONF_CONTENT_TYPE, default="text/html"): cv.string,
+        cv.Optional(CONF_CONTENT_TYPE): cv.string,
         cv.Optional(CONF_TEXT): cv.string,
         cv.Optional(CONF_FILE): cv.file_,
         cv.Optional(CONF_URL): cv.url,
+        cv.Optional(CONF_POOL_STATE): cv.use_id(PentairIfIcComponent),
+        cv.Optional(CONF_FORMAT): cv.one_of(*POOL_STATE_FORMATS, lower=True),
+        cv.Optional(CONF_POOL_EVENTS): cv.use_id(PentairIfIcComponent),
+        cv.Optional(CONF_COALESCE): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAX_CLIENTS): cv.int_range(min=1, max=8),
+        cv.Optional(CONF_POOL_COMMANDS): cv.use_id(PentairIfIcComponent),
+        cv.Optional(CONF_POOL_SOCKET): cv.use_id(PentairIfIcComponent),
+        cv.Optional(CONF_PORT): cv.All(cv.only_with_esp_idf, cv.port),
+        cv.Optional(CONF_METRICS): cv.use_id(PentairIfIcComponent),
+        cv.Optional(CONF_COMPRESSION): validate_compression,
+        cv.Optional(CONF_KEEP_UNCOMPRESSED): cv.boolean,
+        cv.Optional(CONF_CACHE_CONTROL): cv.string,
+        cv.Optional(CONF_CACHE_TTL): cv.All(cv.only_with_esp_idf, cv.positive_not_null_time_period),
+        cv.Optional(CONF_STALE_WHILE_REVALIDATE): cv.positive_time_period_milliseconds,
     }
 ).add_extra(
-    cv.has_exactly_one_key(CONF_TEXT, CONF_FILE, CONF_URL)
+    cv.All(cv.has_exactly_one_key(
+        CONF_TEXT, CONF_FILE, CONF_URL, CONF_POOL_STATE, CONF_POOL_EVENTS, CONF_POOL_COMMANDS, CONF_POOL_SOCKET,
+        CONF_METRICS
+    ), validate_endpoint_options)
 )
 
+
+def validate_unique_paths(endpoints):
+    seen = set()
+    for endpoint in endpoints:
+        path = endpoint[CONF_PATH]
+        if path in seen:
+            raise cv.Invalid(f"Duplicate endpoint path '{path}'")
+        seen.add(path)
+    return endpoints
+
+
 CONFIG_SCHEMA = cv.Schema(
     {
         cv.GenerateID(): cv.declare_id(CustomWebHandler),
-        cv.Required(CONF_ENDPOINTS): cv.ensure_list(ENDPOINT_SCHEMA),
+        # Route table slots are uint8_t (endpoint index + 1)
+        cv.Required(CONF_ENDPOINTS): cv.All(
+            cv.ensure_list(ENDPOINT_SCHEMA), cv.Length(max=255), validate_unique_paths
+        ),
+        cv.Optional(CONF_MAX_CONCURRENT_DOWNLOADS, default=4): cv.int_range(min=1, max=16),
+        cv.Optional(CONF_PROXY_TIMEOUT, default="10s"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_MAX_CONCURRENT_PROXIES, default=2): cv.int_range(min=1, max=8),
+        cv.Optional(CONF_PROXY_CACHE_SIZE, default="64KB"): cv.All(cv.validate_bytes, cv.int_range(min=1024)),
     }
 ).extend(cv.COMPONENT_SCHEMA)
 
 
+def compress(data, encoding):
+    """Build-time compression at maximum level; gzip mtime is pinned so builds are reproducible."""
+    if encoding == COMPRESSION_GZIP:
+        return gzip.compress(data, compresslevel=9, mtime=0)
+    import brotli
+
+    return brotli.compress(data, quality=11)
+
+
+def embed_bytes(var_name, data):
+    """Declare data as a PROGMEM array and return an expression naming it."""
+    data_hex = ", ".join(f"0x{b:02x}" for b in data)
+    cg.add_global(cg.RawStatement(
+        f"static const uint8_t {var_name}[] PROGMEM = {{{data_hex}}};"
+    ))
+    return cg.RawExpression(var_name)
+
+
+def embed_text(var_name, data):
+    """Declare data as a PROGMEM string constant and return an expression naming it."""
+    cg.add_global(cg.RawStatement(
+        f"static const char {var_name}[] PROGMEM = {cpp_string_escape(data)};"
+    ))
+    return cg.RawExpression(var_name)
+
+
+def route_hash(path, seed):
+    """FNV-1a salted with seed, must match route_hash() in custom_web_handler.h."""
+    h = 2166136261 ^ seed
+    for b in path:
+        h ^= b
+        h = (h * 16777619) & 0xFFFFFFFF
+    return h
+
+
+def build_route_table(paths):
+    """Find a seed that gives every path its own slot; returns (table, seed).
+
+    The table starts at the next power of two above the endpoint count and
+    doubles whenever no seed in the search window is collision free.
+    """
+    encoded = [p.encode("utf-8") for p in paths]
+    size = 1
+    while size < len(encoded):
+        size *= 2
+    while True:
+        for seed in range(4096):
+            table = [0] * size
+            for index, path in enumerate(encoded):
+                slot = route_hash(path, seed) & (size - 1)
+                if table[slot]:
+                    break
+                table[slot] = index + 1
+            else:
+                return table, seed
+        size *= 2
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
+    cg.add(var.set_max_concurrent_downloads(config[CONF_MAX_CONCURRENT_DOWNLOADS]))
+    if CORE.using_esp_idf:
+        cg.add(var.set_proxy_timeout(config[CONF_PROXY_TIMEOUT]))
+        cg.add(var.set_max_concurrent_proxies(config[CONF_MAX_CONCURRENT_PROXIES]))
+        cg.add(var.set_proxy_cache_size(config[CONF_PROXY_CACHE_SIZE]))
     
     for i, endpoint in enumerate(config[CONF_ENDPOINTS]):
         path = endpoint[CONF_PATH]
-        content_type = endpoint[CONF_CONTENT_TYPE]
+        default_type = "text/html"
+        if CONF_POOL_STATE in endpoint:
+            default_type = POOL_STATE_FORMATS[endpoint.get(CONF_FORMAT, "json")][1]
+        content_type = endpoint.get(CONF_CONTENT_TYPE, default_type)
         
         if CONF_TEXT in endpoint:
-            # Static text response
-            cg.add(var.add_text_endpoint(path, content_type, endpoint[CONF_TEXT]))
+            # Static text response, served by pointer from flash
+            text = endpoint[CONF_TEXT].encode("utf-8")
+            cg.add(var.add_text_endpoint(path, content_type, embed_text(f"custom_web_text_{i}", text), len(text)))
         elif CONF_FILE in endpoint:
             # Embedded file response - declare as progmem array
             with open(CORE.relative_config_path(endpoint[CONF_FILE]), "rb") as f:
                 file_content = f.read()
             
-            # Create a unique identifier for this file
-            file_var_name = f"custom_web_file_{i}"
+            # Compress at build time; a variant is only kept if it is actually smaller
+            variants = {}
+            for encoding in endpoint.get(CONF_COMPRESSION, [COMPRESSION_GZIP]):
+                compressed = compress(file_content, encoding)
+                if len(compressed) < len(file_content):
+                    variants[encoding] = compressed
             
-            # Generate the progmem declaration manually
-            data_hex = ", ".join(f"0x{b:02x}" for b in file_content)
-            cg.add_global(cg.RawStatement(
-                f"static const uint8_t {file_var_name}[] PROGMEM = {{{data_hex}}};"
-            ))
+            # Raw bytes are the fallback for clients without a matching Accept-Encoding
+            if endpoint.get(CONF_KEEP_UNCOMPRESSED, True) or not variants:
+                cg.add(var.add_file_endpoint(
+                    path, content_type, embed_bytes(f"custom_web_file_{i}", file_content), len(file_content)
+                ))
+            else:
+                cg.add(var.add_file_endpoint(path, content_type, cg.nullptr, 0))
+            
+            for encoding, compressed in variants.items():
+                data = embed_bytes(f"custom_web_file_{i}_{encoding}", compressed)
+                cg.add(var.add_file_encoding(path, ENCODINGS[encoding], data, len(compressed)))
             
-            cg.add(var.add_file_endpoint(path, content_type, cg.RawExpression(file_var_name), len(file_content)))
+            # Content hash as ETag; browsers revalidate with If-None-Match and get a 304
+            etag = hashlib.sha256(file_content).hexdigest()[:16]
+            cg.add(var.set_file_caching(path, etag, endpoint.get(CONF_CACHE_CONTROL, "no-cache")))
         elif CONF_URL in endpoint:
             # URL proxy response
             cg.add(var.add_url_endpoint(path, content_type, endpoint[CONF_URL]))
+            if CONF_CACHE_TTL in endpoint:
+                # Stale responses are served for another TTL by default while one refresh runs
+                ttl = endpoint[CONF_CACHE_TTL].total_milliseconds
+                stale = endpoint.get(CONF_STALE_WHILE_REVALIDATE)
+                stale = ttl if stale is None else stale.total_milliseconds
+                cg.add(var.set_url_cache(path, ttl, stale))
+        elif CONF_POOL_STATE in endpoint:
+            # Whole pool snapshot as one JSON document or CBOR array
+            pool = await cg.get_variable(endpoint[CONF_POOL_STATE])
+            pool_format = POOL_STATE_FORMATS[endpoint.get(CONF_FORMAT, "json")][0]
+            cg.add(var.add_pool_state_endpoint(path, content_type, pool, pool_format))
+        elif CONF_POOL_EVENTS in endpoint:
+            # Server-Sent Events stream of state changes
+            pool = await cg.get_variable(endpoint[CONF_POOL_EVENTS])
+            coalesce = endpoint.get(CONF_COALESCE, cv.TimePeriod(milliseconds=100))
+            cg.add(var.add_pool_events_endpoint(
+                path, pool, coalesce.total_milliseconds, endpoint.get(CONF_MAX_CLIENTS, 4)
+            ))
+        elif CONF_POOL_COMMANDS in endpoint:
+            # POST endpoint queuing a batch of control commands atomically
+            pool = await cg.get_variable(endpoint[CONF_POOL_COMMANDS])
+            cg.add(var.add_pool_commands_endpoint(path, pool))
+        elif CONF_METRICS in endpoint:
+            # OpenMetrics text for Prometheus-style scrapers
+            pool = await cg.get_variable(endpoint[CONF_METRICS])
+            cg.add(var.add_metrics_endpoint(path, pool))
+        elif CONF_POOL_SOCKET in endpoint:
+            # WebSocket with binary state frames and command batches
+            pool = await cg.get_variable(endpoint[CONF_POOL_SOCKET])
+            coalesce = endpoint.get(CONF_COALESCE, cv.TimePeriod(milliseconds=100))
+            cg.add(var.add_pool_socket_endpoint(
+                path, pool, coalesce.total_milliseconds, endpoint.get(CONF_MAX_CLIENTS, 4), endpoint.get(CONF_PORT, 8081)
+            ))
+            cg.add_define("USE_CUSTOM_WEB_POOL_SOCKET")
+            if CORE.using_esp_idf:
+                add_idf_sdkconfig_option("CONFIG_HTTPD_WS_SUPPORT", True)
+
+    table, seed = build_route_table([endpoint[CONF_PATH] for endpoint in config[CONF_ENDPOINTS]])
+    table_hex = ", ".join(str(slot) for slot in table)
+    cg.add_global(cg.RawStatement(
+        f"static constexpr uint8_t custom_web_routes[{len(table)}] = {{{table_hex}}};"
+    ))
+    cg.add(var.set_route_table(cg.RawExpression("custom_web_routes"), len(table), seed))
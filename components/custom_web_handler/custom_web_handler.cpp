@@ -1,12 +1,176 @@
 #include "custom_web_handler.h"
 #include "esphome/core/log.h"
 #include "esphome/core/application.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef USE_ESP32
+#include <esp_heap_caps.h>
+#include <esp_system.h>
+#endif
 
 namespace esphome {
 namespace custom_web_handler {
 
 static const char *const TAG = "custom_web_handler";
 
+const char *content_encoding_to_str(ContentEncoding encoding) {
+  switch (encoding) {
+    case ENCODING_BROTLI:
+      return "br";
+    case ENCODING_GZIP:
+      return "gzip";
+    default:
+      return "identity";
+  }
+}
+
+static uint32_t free_heap() {
+#ifdef USE_ESP8266
+  return ESP.getFreeHeap();
+#else
+  return esp_get_free_heap_size();
+#endif
+}
+
+// Allocator low-water mark since boot; ESP8266 only has loop() samples of it
+static uint32_t min_free_heap(uint32_t sampled) {
+#ifdef USE_ESP8266
+  return std::min(sampled, free_heap());
+#else
+  (void) sampled;
+  return esp_get_minimum_free_heap_size();
+#endif
+}
+
+static uint32_t largest_free_block() {
+#ifdef USE_ESP8266
+  return ESP.getMaxFreeBlockSize();
+#else
+  return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#endif
+}
+
+// Copies a request header into buf (truncated to fit); false if absent
+static bool read_header(AsyncWebServerRequest *request, const char *name, char *buf, size_t size) {
+#ifdef USE_ESP_IDF
+  esp_err_t err = httpd_req_get_hdr_value_str(*request, name, buf, size);
+  return err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC;
+#else
+  AsyncWebHeader *header = request->getHeader(name);
+  if (header == nullptr)
+    return false;
+  snprintf(buf, size, "%s", header->value().c_str());
+  return true;
+#endif
+}
+
+// True if an If-None-Match list contains etag (quoted), compared weakly as RFC 9110 requires
+static bool etag_matches(const char *if_none_match, const char *etag) {
+  const char *p = if_none_match;
+  while (*p == ' ')
+    p++;
+  if (p[0] == '*' && (p[1] == '\0' || p[1] == ' ' || p[1] == ','))
+    return true;
+  return strstr(if_none_match, etag) != nullptr;
+}
+
+void set_reason(AsyncWebServerRequest *request, int code) {
+#ifdef USE_ESP_IDF
+  const char *status = nullptr;
+  switch (code) {
+    case 206:
+      status = "206 Partial Content";
+      break;
+    case 304:
+      status = "304 Not Modified";
+      break;
+    case 405:
+      status = "405 Method Not Allowed";
+      break;
+    case 406:
+      status = "406 Not Acceptable";
+      break;
+    case 416:
+      status = "416 Range Not Satisfiable";
+      break;
+    case 500:
+      status = "500 Internal Server Error";
+      break;
+    case 503:
+      status = "503 Service Unavailable";
+      break;
+    default:
+      return;
+  }
+  httpd_resp_set_status(*request, status);
+#else
+  (void) request;
+  (void) code;
+#endif
+}
+
+RangeResult parse_range(const char *header, size_t size, size_t *start, size_t *end) {
+  if (strncmp(header, "bytes=", 6) != 0 || strchr(header, ',') != nullptr)
+    return RANGE_NONE;
+  const char *p = header + 6;
+  char *next;
+  
+  if (*p == '-') {
+    // Suffix range: the last n bytes
+    unsigned long n = strtoul(p + 1, &next, 10);
+    if (next == p + 1)
+      return RANGE_NONE;
+    if (n == 0 || size == 0)
+      return RANGE_UNSATISFIABLE;
+    *start = n < size ? size - n : 0;
+    *end = size - 1;
+    return RANGE_PARTIAL;
+  }
+  
+  unsigned long first = strtoul(p, &next, 10);
+  if (next == p || *next != '-')
+    return RANGE_NONE;
+  p = next + 1;
+  unsigned long last = size - 1;
+  if (*p != '\0') {
+    last = strtoul(p, &next, 10);
+    if (next == p || last < first)
+      return RANGE_NONE;
+  }
+  if (first >= size)
+    return RANGE_UNSATISFIABLE;
+  *start = first;
+  *end = std::min<size_t>(last, size - 1);
+  return RANGE_PARTIAL;
+}
+
+bool accepts_encoding(const char *accept, const char *token) {
+  size_t token_len = strlen(token);
+  const char *p = accept;
+  while (*p != '\0') {
+    while (*p == ' ' || *p == ',')
+      p++;
+    const char *name = p;
+    while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ')
+      p++;
+    bool match = (size_t) (p - name) == token_len && strncasecmp(name, token, token_len) == 0;
+    
+    // Parameters up to the next list item; only q=0 matters
+    bool refused = false;
+    while (*p != '\0' && *p != ',') {
+      if ((*p == 'q' || *p == 'Q') && p[1] == '=') {
+        float q = strtof(p + 2, nullptr);
+        refused = q <= 0.0f;
+      }
+      p++;
+    }
+    if (match)
+      return !refused;
+  }
+  return false;
+}
+
 void CustomWebHandler::setup() {
   auto *base = web_server_base::global_web_server_base;
   if (base == nullptr) {
@@ -15,109 +179,826 @@ void CustomWebHandler::setup() {
     return;
   }
   
+#ifdef USE_ESP_IDF
+  this->downloads_.reset(new Download[this->max_downloads_]);
+  for (uint8_t i = 0; i < this->max_downloads_; i++)
+    this->downloads_[i].owner = this;
+#endif
+  
   base->add_handler(this);
   ESP_LOGI(TAG, "Custom web handler registered with %d endpoints", this->endpoints_.size());
+  ESP_LOGCONFIG(TAG, "Streaming files in %u byte chunks, max %u concurrent downloads", (unsigned) FILE_CHUNK_SIZE,
+                this->max_downloads_);
+  
+#ifdef USE_PENTAIR_IF_IC
+  for (const auto &endpoint : this->endpoints_) {
+    if (endpoint.type == ENDPOINT_POOL_STATE) {
+      this->state_buffer_.reset(new char[POOL_STATE_JSON_SIZE]);
+      break;
+    }
+  }
+#endif
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  for (const auto &endpoint : this->endpoints_) {
+    if (endpoint.type != ENDPOINT_POOL_SOCKET)
+      continue;
+    PoolSocket *socket = endpoint.socket;
+    if (socket->start(base)) {
+#ifdef USE_ESP_IDF
+      ESP_LOGCONFIG(TAG, "Pool socket %s on port %u", endpoint.path, socket->get_port());
+#endif
+      ESP_LOGCONFIG(TAG, "  %u clients max, %u bytes per client slot", socket->get_max_clients(),
+                    (unsigned) PoolSocket::client_slot_size());
+    } else {
+      ESP_LOGE(TAG, "Could not start pool socket %s", endpoint.path);
+    }
+  }
+#endif
+  
+#ifdef USE_ESP_IDF
+  // Proxy workers cost a task stack each; only start them if there is something to proxy
+  bool proxied = false;
+  for (const auto &endpoint : this->endpoints_) {
+    if (endpoint.type != ENDPOINT_URL)
+      continue;
+    proxied = true;
+    if (endpoint.cache_ttl_ms != 0) {
+      this->proxy_.add_cache(&endpoint, endpoint.cache_ttl_ms, endpoint.cache_stale_ms);
+      ESP_LOGCONFIG(TAG, "  %s cached for %u ms (+%u ms stale)", endpoint.path,
+                    (unsigned) endpoint.cache_ttl_ms, (unsigned) endpoint.cache_stale_ms);
+    }
+  }
+  if (proxied) {
+    if (this->proxy_.start()) {
+      ESP_LOGCONFIG(TAG, "URL proxy: %u workers, timeout %u ms, cache %u bytes", this->proxy_.get_max_concurrent(),
+                    (unsigned) this->proxy_.get_timeout(), (unsigned) this->proxy_.get_cache_size());
+    } else {
+      ESP_LOGE(TAG, "Could not start URL proxy");
+    }
+  }
+#endif
 }
 
-void CustomWebHandler::add_text_endpoint(const std::string &path, const std::string &content_type, const std::string &text) {
-  Endpoint ep;
+Endpoint *CustomWebHandler::add_endpoint_(const char *path, const char *content_type, EndpointType type) {
+  Endpoint ep{};
   ep.path = path;
+  ep.path_len = strlen(path);
   ep.content_type = content_type;
-  ep.type = ENDPOINT_TEXT;
-  ep.content = text;
-  ep.file_data = nullptr;
-  ep.file_size = 0;
+  ep.type = type;
   this->endpoints_.push_back(ep);
-  ESP_LOGCONFIG(TAG, "Added text endpoint: %s", path.c_str());
+  return &this->endpoints_.back();
 }
 
-void CustomWebHandler::add_file_endpoint(const std::string &path, const std::string &content_type, const uint8_t *data, size_t size) {
-  Endpoint ep;
-  ep.path = path;
-  ep.content_type = content_type;
-  ep.type = ENDPOINT_FILE;
-  ep.file_data = data;
-  ep.file_size = size;
-  this->endpoints_.push_back(ep);
-  ESP_LOGCONFIG(TAG, "Added file endpoint: %s (%d bytes)", path.c_str(), size);
+Endpoint *CustomWebHandler::find_path_(const char *path, EndpointType type) {
+  for (auto &endpoint : this->endpoints_) {
+    if (endpoint.type == type && strcmp(endpoint.path, path) == 0)
+      return &endpoint;
+  }
+  return nullptr;
 }
 
-void CustomWebHandler::add_url_endpoint(const std::string &path, const std::string &content_type, const std::string &url) {
-  Endpoint ep;
-  ep.path = path;
-  ep.content_type = content_type;
-  ep.type = ENDPOINT_URL;
-  ep.content = url;
-  ep.file_data = nullptr;
-  ep.file_size = 0;
-  this->endpoints_.push_back(ep);
-  ESP_LOGCONFIG(TAG, "Added URL endpoint: %s -> %s", path.c_str(), url.c_str());
+void CustomWebHandler::add_text_endpoint(const char *path, const char *content_type, const char *text, size_t size) {
+  Endpoint *ep = this->add_endpoint_(path, content_type, ENDPOINT_TEXT);
+  ep->content = text;
+  ep->content_size = size;
+  ESP_LOGCONFIG(TAG, "Added text endpoint: %s (%u bytes)", path, (unsigned) size);
+}
+
+void CustomWebHandler::add_file_endpoint(const char *path, const char *content_type, const uint8_t *data, size_t size) {
+  Endpoint *ep = this->add_endpoint_(path, content_type, ENDPOINT_FILE);
+  ep->files[ENCODING_IDENTITY] = {data, size};
+  ESP_LOGCONFIG(TAG, "Added file endpoint: %s (%u bytes)", path, (unsigned) size);
+}
+
+void CustomWebHandler::add_file_encoding(const char *path, ContentEncoding encoding, const uint8_t *data,
+                                         size_t size) {
+  Endpoint *endpoint = this->find_path_(path, ENDPOINT_FILE);
+  if (endpoint == nullptr) {
+    ESP_LOGW(TAG, "No file endpoint %s for %s variant", path, content_encoding_to_str(encoding));
+    return;
+  }
+  endpoint->files[encoding] = {data, size};
+  ESP_LOGCONFIG(TAG, "  %s variant: %u bytes", content_encoding_to_str(encoding), (unsigned) size);
+}
+
+void CustomWebHandler::set_file_caching(const char *path, const char *etag, const char *cache_control) {
+  Endpoint *endpoint = this->find_path_(path, ENDPOINT_FILE);
+  if (endpoint == nullptr) {
+    ESP_LOGW(TAG, "No file endpoint %s for caching", path);
+    return;
+  }
+  endpoint->etag = etag;
+  endpoint->cache_control = cache_control;
+}
+
+void CustomWebHandler::add_url_endpoint(const char *path, const char *content_type, const char *url) {
+  Endpoint *ep = this->add_endpoint_(path, content_type, ENDPOINT_URL);
+  ep->content = url;
+  ESP_LOGCONFIG(TAG, "Added URL endpoint: %s -> %s", path, url);
+}
+
+#ifdef USE_ESP_IDF
+void CustomWebHandler::set_url_cache(const char *path, uint32_t ttl_ms, uint32_t stale_ms) {
+  Endpoint *endpoint = this->find_path_(path, ENDPOINT_URL);
+  if (endpoint == nullptr) {
+    ESP_LOGW(TAG, "No URL endpoint %s for caching", path);
+    return;
+  }
+  endpoint->cache_ttl_ms = ttl_ms;
+  endpoint->cache_stale_ms = stale_ms;
+}
+#endif
+
+void CustomWebHandler::add_binary_endpoint(const char *path, const char *content_type, const BinarySource *source) {
+  Endpoint *ep = this->add_endpoint_(path, content_type, ENDPOINT_BINARY);
+  ep->binary = source;
+  ESP_LOGCONFIG(TAG, "Added binary endpoint: %s", path);
+}
+
+#ifdef USE_PENTAIR_IF_IC
+void CustomWebHandler::add_pool_state_endpoint(const char *path, const char *content_type,
+                                               pentair_if_ic::PentairIfIcComponent *pool, PoolStateFormat format) {
+  Endpoint *ep =
+      this->add_endpoint_(path, content_type, format == POOL_STATE_CBOR ? ENDPOINT_POOL_STATE_CBOR : ENDPOINT_POOL_STATE);
+  ep->pool = pool;
+  ESP_LOGCONFIG(TAG, "Added pool state endpoint: %s (%s)", path, format == POOL_STATE_CBOR ? "CBOR" : "JSON");
+}
+
+void CustomWebHandler::add_pool_events_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool,
+                                                uint32_t coalesce_ms, uint8_t max_clients) {
+  Endpoint *ep = this->add_endpoint_(path, "text/event-stream", ENDPOINT_POOL_EVENTS);
+  ep->pool = pool;
+  ep->events = new PoolEventStream(path, pool, coalesce_ms, max_clients);
+  ESP_LOGCONFIG(TAG, "Added pool events endpoint: %s (coalesce %u ms, max %u clients)", path,
+                (unsigned) coalesce_ms, max_clients);
+}
+
+void CustomWebHandler::add_pool_commands_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool) {
+  Endpoint *ep = this->add_endpoint_(path, "application/json", ENDPOINT_POOL_COMMANDS);
+  ep->pool = pool;
+  ep->commands = new PoolCommandEndpoint(pool);
+  ESP_LOGCONFIG(TAG, "Added pool commands endpoint: %s (POST, max %u per batch)", path,
+                (unsigned) pentair_if_ic::PentairIfIcComponent::MAX_BATCH);
+}
+
+void CustomWebHandler::add_metrics_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool) {
+  Endpoint *ep = this->add_endpoint_(path, METRICS_CONTENT_TYPE, ENDPOINT_METRICS);
+  ep->pool = pool;
+  ESP_LOGCONFIG(TAG, "Added metrics endpoint: %s", path);
+}
+
+void CustomWebHandler::loop() {
+#ifdef USE_ESP8266
+  this->heap_low_water_ = std::min(this->heap_low_water_, free_heap());
+#endif
+  for (const auto &endpoint : this->endpoints_) {
+    if (endpoint.type == ENDPOINT_POOL_EVENTS)
+      endpoint.events->loop();
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+    else if (endpoint.type == ENDPOINT_POOL_SOCKET)
+      endpoint.socket->loop();
+#endif
+  }
+}
+#endif
+
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+void CustomWebHandler::add_pool_socket_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool,
+                                                uint32_t coalesce_ms, uint8_t max_clients, uint16_t port) {
+  Endpoint *ep = this->add_endpoint_(path, "application/octet-stream", ENDPOINT_POOL_SOCKET);
+  ep->pool = pool;
+  ep->socket = new PoolSocket(path, pool, coalesce_ms, max_clients, port);
+  ESP_LOGCONFIG(TAG, "Added pool socket endpoint: %s (coalesce %u ms, max %u clients)", path, (unsigned) coalesce_ms,
+                max_clients);
+}
+#endif
+
+void CustomWebHandler::set_route_table(const uint8_t *table, size_t size, uint32_t seed) {
+  this->route_table_ = table;
+  this->route_mask_ = size - 1;
+  this->route_seed_ = seed;
+  this->routed_endpoints_ = this->endpoints_.size();
+}
+
+static bool path_equals(const Endpoint &endpoint, const char *path, size_t len) {
+  return endpoint.path_len == len && memcmp(endpoint.path, path, len) == 0;
+}
+
+const Endpoint *CustomWebHandler::find_endpoint_(AsyncWebServerRequest *request) const {
+  // Match on the server's own URL buffer; building a std::string here would cost an
+  // allocation for every request the web server sees, ours or not.
+#ifdef USE_ESP_IDF
+  const char *path = static_cast<httpd_req_t *>(*request)->uri;
+  size_t len = strcspn(path, "?");
+#else
+  const String &url = request->url();
+  const char *path = url.c_str();
+  size_t len = url.length();
+#endif
+  
+  if (this->route_table_ != nullptr) {
+    uint8_t slot = this->route_table_[route_hash(path, len, this->route_seed_) & this->route_mask_];
+    if (slot != 0 && path_equals(this->endpoints_[slot - 1], path, len))
+      return &this->endpoints_[slot - 1];
+  }
+  
+  for (size_t i = this->routed_endpoints_; i < this->endpoints_.size(); i++) {
+    if (path_equals(this->endpoints_[i], path, len))
+      return &this->endpoints_[i];
+  }
+  
+  return nullptr;
 }
 
 bool CustomWebHandler::canHandle(AsyncWebServerRequest *request) const {
+#ifdef USE_PENTAIR_IF_IC
+  // POST is only taken for command endpoints, GET for everything (commands answer it with 405)
+  if (request->method() == HTTP_POST) {
+    const Endpoint *endpoint = this->find_endpoint_(request);
+    return endpoint != nullptr && endpoint->type == ENDPOINT_POOL_COMMANDS;
+  }
+#endif
   if (request->method() != HTTP_GET)
     return false;
   
-  std::string url = request->url().c_str();
+  const Endpoint *endpoint = this->find_endpoint_(request);
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  // Upgrades are the socket's own handler's (Arduino) or server's (ESP-IDF)
+  if (endpoint != nullptr && endpoint->type == ENDPOINT_POOL_SOCKET)
+    return false;
+#endif
+  return endpoint != nullptr;
+}
+
+void CustomWebHandler::handleRequest(AsyncWebServerRequest *request) {
+  const Endpoint *endpoint = this->find_endpoint_(request);
+  if (endpoint == nullptr) {
+    request->send(404, "text/plain", "Not Found");
+    return;
+  }
   
+  switch (endpoint->type) {
+    case ENDPOINT_TEXT:
+      this->handle_text_endpoint(request, *endpoint);
+      break;
+    case ENDPOINT_FILE:
+      this->handle_file_endpoint(request, *endpoint);
+      break;
+    case ENDPOINT_URL:
+      this->handle_url_endpoint(request, *endpoint);
+      break;
+    case ENDPOINT_BINARY:
+      this->handle_binary_endpoint(request, *endpoint);
+      break;
+#ifdef USE_PENTAIR_IF_IC
+    case ENDPOINT_POOL_STATE:
+      this->handle_pool_state_endpoint(request, *endpoint);
+      break;
+    case ENDPOINT_POOL_STATE_CBOR:
+      this->handle_pool_state_cbor_endpoint(request, *endpoint);
+      break;
+    case ENDPOINT_POOL_EVENTS:
+      endpoint->events->handle_request(request);
+      break;
+    case ENDPOINT_POOL_COMMANDS:
+      if (request->method() != HTTP_POST) {
+        AsyncWebServerResponse *response = request->beginResponse(405, "text/plain", "Method Not Allowed");
+        set_reason(request, 405);
+        response->addHeader("Allow", "POST");
+        request->send(response);
+        break;
+      }
+      endpoint->commands->handle_request(request);
+      break;
+    case ENDPOINT_METRICS:
+      this->handle_metrics_endpoint(request, *endpoint);
+      break;
+#endif
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+    case ENDPOINT_POOL_SOCKET:
+      // Never taken here, see canHandle()
+      request->send(404, "text/plain", "Not Found");
+      break;
+#endif
+  }
+}
+
+#if defined(USE_PENTAIR_IF_IC) && !defined(USE_ESP_IDF)
+void CustomWebHandler::handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index,
+                                  size_t total) {
+  const Endpoint *endpoint = this->find_endpoint_(request);
+  if (endpoint != nullptr && endpoint->type == ENDPOINT_POOL_COMMANDS)
+    endpoint->commands->handle_body(request, data, len, index, total);
+}
+#endif
+
+void CustomWebHandler::handle_text_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
+  // Sent by pointer straight from the constant codegen emitted; no String copy
+  const auto *text = reinterpret_cast<const uint8_t *>(endpoint.content);
+#ifndef USE_ESP8266
+  AsyncWebServerResponse *response =
+      request->beginResponse(200, endpoint.content_type, text, endpoint.content_size);
+#else
+  AsyncWebServerResponse *response =
+      request->beginResponse_P(200, endpoint.content_type, text, endpoint.content_size);
+#endif
+  request->send(response);
+}
+
+#ifdef USE_PENTAIR_IF_IC
+void CustomWebHandler::handle_pool_state_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
+  // One seqlock copy, so pump and chlorinator fields all come from the same instant
+  pentair_if_ic::PoolState state;
+  uint32_t generation = endpoint.pool->read_state(state);
+  char *buf = this->state_buffer_.get();
+  size_t len = write_pool_state_json(buf, POOL_STATE_JSON_SIZE, state, generation, millis());
+  if (len == 0) {
+    ESP_LOGE(TAG, "Pool state does not fit in %u bytes", (unsigned) POOL_STATE_JSON_SIZE);
+    AsyncWebServerResponse *response = request->beginResponse(500, "text/plain", "State too large");
+    set_reason(request, 500);
+    request->send(response);
+    return;
+  }
+  
+#ifdef USE_ESP_IDF
+  // Sent before this returns, so the shared buffer is free for the next request
+  AsyncWebServerResponse *response =
+      request->beginResponse(200, endpoint.content_type, reinterpret_cast<const uint8_t *>(buf), len);
+#else
+  // The async server sends after we return; let the response keep its own copy
+  AsyncWebServerResponse *response = request->beginResponse(200, endpoint.content_type, String(buf));
+#endif
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+void CustomWebHandler::handle_pool_state_cbor_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
+  pentair_if_ic::PoolState state;
+  uint32_t generation = endpoint.pool->read_state(state);
+  // Small enough for the server task's stack; encoded straight from the snapshot
+  uint8_t buf[POOL_STATE_CBOR_SIZE];
+  size_t len = write_pool_state_cbor(buf, sizeof(buf), state, generation, millis());
+  if (len == 0) {
+    ESP_LOGE(TAG, "Pool state does not fit in %u bytes", (unsigned) sizeof(buf));
+    AsyncWebServerResponse *response = request->beginResponse(500, "text/plain", "State too large");
+    set_reason(request, 500);
+    request->send(response);
+    return;
+  }
+  
+#ifdef USE_ESP_IDF
+  AsyncWebServerResponse *response = request->beginResponse(200, endpoint.content_type, buf, len);
+#else
+  // Sent after this returns; the stream response keeps its own copy
+  AsyncResponseStream *response = request->beginResponseStream(endpoint.content_type);
+  response->write(buf, len);
+#endif
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+}
+
+void CustomWebHandler::handle_metrics_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
+  // Rendered family by family into a small buffer; nothing holds the whole exposition
+#ifdef USE_ESP_IDF
+  AsyncWebServerResponse *response = request->beginResponse(200, endpoint.content_type);
+  response->addHeader("Cache-Control", "no-store");
+  MetricsWriter out(*request);
+#else
+  AsyncResponseStream *response = request->beginResponseStream(endpoint.content_type);
+  response->addHeader("Cache-Control", "no-store");
+  MetricsWriter out(response);
+#endif
+  write_bus_metrics(out, endpoint.pool);
+  this->write_handler_metrics_(out);
+  out.finish();
+#ifdef USE_ESP_IDF
+  if (out.failed())
+    ESP_LOGW(TAG, "Metrics scrape of %s aborted by the client", endpoint.path);
+#else
+  request->send(response);
+#endif
+}
+
+void CustomWebHandler::write_handler_metrics_(MetricsWriter &out) {
+#ifdef USE_ESP8266
+  uint32_t min_free = min_free_heap(this->heap_low_water_);
+#else
+  uint32_t min_free = min_free_heap(0);
+#endif
+  out.family("esp_heap_free_bytes", "gauge", "Free heap");
+  out.gauge("esp_heap_free_bytes", nullptr, free_heap());
+  out.family("esp_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+  out.gauge("esp_heap_min_free_bytes", nullptr, min_free);
+  out.family("esp_heap_largest_free_block_bytes", "gauge", "Largest single allocation that would succeed now");
+  out.gauge("esp_heap_largest_free_block_bytes", nullptr, largest_free_block());
+  
+  out.family("custom_web_downloads_active", "gauge", "File downloads being streamed");
+  out.gauge("custom_web_downloads_active", nullptr, this->active_downloads());
+  
+  // Per endpoint families, one sample per configured path
+  char label[64];
+  bool events = false, commands = false;
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  bool sockets = false;
+#endif
   for (const auto &endpoint : this->endpoints_) {
-    if (url == endpoint.path) {
-      return true;
+    events |= endpoint.type == ENDPOINT_POOL_EVENTS;
+    commands |= endpoint.type == ENDPOINT_POOL_COMMANDS;
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+    sockets |= endpoint.type == ENDPOINT_POOL_SOCKET;
+#endif
+  }
+  
+  if (events) {
+    out.family("custom_web_events_clients", "gauge", "Connected Server-Sent Events clients");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_EVENTS)
+        continue;
+      format_label(label, sizeof(label), "path", endpoint.path);
+      out.gauge("custom_web_events_clients", label, endpoint.events->client_count());
+    }
+    out.family("custom_web_events_sent", "counter", "Server-Sent Events broadcast");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_EVENTS)
+        continue;
+      format_label(label, sizeof(label), "path", endpoint.path);
+      out.counter("custom_web_events_sent", label, endpoint.events->events_sent());
     }
   }
   
-  return false;
+  if (commands) {
+    out.family("custom_web_command_batches", "counter", "Command batches received, per outcome");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_COMMANDS)
+        continue;
+      char labels[96];
+      size_t len = format_label(labels, sizeof(labels), "path", endpoint.path);
+      snprintf(labels + len, sizeof(labels) - len, ",outcome=\"submitted\"");
+      out.counter("custom_web_command_batches", labels, endpoint.commands->batches_submitted());
+      snprintf(labels + len, sizeof(labels) - len, ",outcome=\"refused\"");
+      out.counter("custom_web_command_batches", labels, endpoint.commands->batches_refused());
+    }
+  }
+  
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  if (sockets) {
+    out.family("custom_web_socket_clients", "gauge", "Connected pool socket clients");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_SOCKET)
+        continue;
+      format_label(label, sizeof(label), "path", endpoint.path);
+      out.gauge("custom_web_socket_clients", label, endpoint.socket->client_count());
+    }
+    out.family("custom_web_socket_frames", "counter", "State frames broadcast");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_SOCKET)
+        continue;
+      format_label(label, sizeof(label), "path", endpoint.path);
+      out.counter("custom_web_socket_frames", label, endpoint.socket->frames_sent());
+    }
+    out.family("custom_web_socket_dropped_clients", "counter", "Clients disconnected after a frame could not be sent");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_SOCKET)
+        continue;
+      format_label(label, sizeof(label), "path", endpoint.path);
+      out.counter("custom_web_socket_dropped_clients", label, endpoint.socket->dropped_clients());
+    }
+    out.family("custom_web_socket_fanout_max_seconds", "gauge", "Longest time writing one frame to every client");
+    for (const auto &endpoint : this->endpoints_) {
+      if (endpoint.type != ENDPOINT_POOL_SOCKET)
+        continue;
+      format_label(label, sizeof(label), "path", endpoint.path);
+      out.gauge("custom_web_socket_fanout_max_seconds", label, endpoint.socket->max_fanout_us(), 1000000);
+    }
+  }
+#endif
 }
+#endif
 
-void CustomWebHandler::handleRequest(AsyncWebServerRequest *request) {
-  std::string url = request->url().c_str();
+ContentEncoding CustomWebHandler::negotiate_encoding_(AsyncWebServerRequest *request, const Endpoint &endpoint) const {
+  char accept[128];
+  bool have_accept = read_header(request, "Accept-Encoding", accept, sizeof(accept));
   
-  for (const auto &endpoint : this->endpoints_) {
-    if (url == endpoint.path) {
-      switch (endpoint.type) {
-        case ENDPOINT_TEXT:
-          this->handle_text_endpoint(request, endpoint);
-          break;
-        case ENDPOINT_FILE:
-          this->handle_file_endpoint(request, endpoint);
-          break;
-        case ENDPOINT_URL:
-          this->handle_url_endpoint(request, endpoint);
-          break;
-      }
+  // Smallest acceptable variant first
+  for (uint8_t i = 0; i < ENCODING_IDENTITY; i++) {
+    auto encoding = static_cast<ContentEncoding>(i);
+    if (endpoint.files[i].data != nullptr && have_accept && accepts_encoding(accept, content_encoding_to_str(encoding)))
+      return encoding;
+  }
+  if (endpoint.files[ENCODING_IDENTITY].data != nullptr)
+    return ENCODING_IDENTITY;
+  
+  // Compressed only, and the client takes none of the variants
+  return ENCODING_COUNT;
+}
+
+// Header of a file response. On ESP-IDF it is set on the httpd request itself,
+// since file bodies are sent without a response object; httpd keeps at most
+// max_resp_headers (8 by default) and refuses the rest, which is logged here.
+static void add_header(AsyncWebServerRequest *request, AsyncWebServerResponse *response, const char *name,
+                       const char *value) {
+#ifdef USE_ESP_IDF
+  (void) response;
+  if (httpd_resp_set_hdr(*request, name, value) != ESP_OK)
+    ESP_LOGW(TAG, "No room for %s header, raise max_resp_headers", name);
+#else
+  (void) request;
+  response->addHeader(name, value);
+#endif
+}
+
+void CustomWebHandler::add_cache_headers_(AsyncWebServerRequest *request, AsyncWebServerResponse *response,
+                                          const Endpoint &endpoint, const char *etag, size_t variants) const {
+  if (etag[0] != '\0')
+    add_header(request, response, "ETag", etag);
+  if (endpoint.cache_control != nullptr)
+    add_header(request, response, "Cache-Control", endpoint.cache_control);
+  // Caches must key on Accept-Encoding whenever the answer depends on it
+  if (variants > 1)
+    add_header(request, response, "Vary", "Accept-Encoding");
+}
+
+void CustomWebHandler::handle_file_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
+  ContentEncoding encoding = this->negotiate_encoding_(request, endpoint);
+  if (encoding == ENCODING_COUNT) {
+    // Never push an encoding the client did not accept
+    AsyncWebServerResponse *response = request->beginResponse(406, "text/plain", "Not Acceptable");
+    set_reason(request, 406);
+    response->addHeader("Vary", "Accept-Encoding");
+    request->send(response);
+    return;
+  }
+  const FileVariant &file = endpoint.files[encoding];
+  
+  size_t variants = 0;
+  for (const auto &variant : endpoint.files)
+    variants += variant.data != nullptr;
+  
+  // Each encoding is a different representation, so it gets its own strong ETag
+  char etag[48] = "";
+  if (endpoint.etag != nullptr) {
+    if (encoding == ENCODING_IDENTITY) {
+      snprintf(etag, sizeof(etag), "\"%s\"", endpoint.etag);
+    } else {
+      snprintf(etag, sizeof(etag), "\"%s-%s\"", endpoint.etag, content_encoding_to_str(encoding));
+    }
+    
+    char if_none_match[128];
+    if (read_header(request, "If-None-Match", if_none_match, sizeof(if_none_match)) &&
+        etag_matches(if_none_match, etag)) {
+      AsyncWebServerResponse *response = request->beginResponse(304, endpoint.content_type);
+      set_reason(request, 304);
+      this->add_cache_headers_(request, response, endpoint, etag, variants);
+      request->send(response);
       return;
     }
   }
   
-  request->send(404, "text/plain", "Not Found");
+  this->send_body_(request, endpoint, file.data, file.size, encoding, etag, variants);
 }
 
-void CustomWebHandler::handle_text_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
-  request->send(200, endpoint.content_type.c_str(), endpoint.content.c_str());
+void CustomWebHandler::handle_binary_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
+  // Size is sampled once; the source keeps its spans valid until the download ends
+  this->send_body_(request, endpoint, nullptr, endpoint.binary->size(), ENCODING_IDENTITY, "", 1);
 }
 
-void CustomWebHandler::handle_file_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
-#ifndef USE_ESP8266
-  AsyncWebServerResponse *response = request->beginResponse(
-      200, endpoint.content_type.c_str(), endpoint.file_data, endpoint.file_size);
+void CustomWebHandler::send_body_(AsyncWebServerRequest *request, const Endpoint &endpoint, const uint8_t *data,
+                                  size_t size, ContentEncoding encoding, const char *etag, size_t variants) {
+  // Resume support: a single byte range of the selected representation. If-Range
+  // makes a stale client start over instead of splicing two versions together.
+  size_t start = 0;
+  size_t end = size - 1;
+  RangeResult range = RANGE_NONE;
+  char header[128];
+  if (read_header(request, "Range", header, sizeof(header))) {
+    char if_range[64];
+    if (!read_header(request, "If-Range", if_range, sizeof(if_range)) || (etag[0] != '\0' && strcmp(if_range, etag) == 0))
+      range = parse_range(header, size, &start, &end);
+  }
+  
+  char content_range[48];
+  if (range == RANGE_UNSATISFIABLE) {
+    snprintf(content_range, sizeof(content_range), "bytes */%u", (unsigned) size);
+    AsyncWebServerResponse *response = request->beginResponse(416, "text/plain", "Range Not Satisfiable");
+    set_reason(request, 416);
+    response->addHeader("Content-Range", content_range);
+    request->send(response);
+    return;
+  }
+  
+  if (!this->begin_download_()) {
+    ESP_LOGW(TAG, "Too many downloads, refusing %s", endpoint.path);
+    AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Too many downloads");
+    set_reason(request, 503);
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+    return;
+  }
+  
+  size_t length = size == 0 ? 0 : end - start + 1;
+  int code = range == RANGE_PARTIAL ? 206 : 200;
+  AsyncWebServerResponse *response =
+      this->begin_file_response_(request, code, endpoint, data, size, start, length);
+  add_header(request, response, "Accept-Ranges", "bytes");
+  if (range == RANGE_PARTIAL) {
+    snprintf(content_range, sizeof(content_range), "bytes %u-%u/%u", (unsigned) start, (unsigned) end,
+             (unsigned) size);
+    add_header(request, response, "Content-Range", content_range);
+    ESP_LOGD(TAG, "Range %s of %s", content_range, endpoint.path);
+  }
+  if (encoding != ENCODING_IDENTITY)
+    add_header(request, response, "Content-Encoding", content_encoding_to_str(encoding));
+  this->add_cache_headers_(request, response, endpoint, etag, variants);
+  
+  this->send_file_response_(request, response, endpoint, data, size, start, length);
+}
+
+bool CustomWebHandler::begin_download_() {
+  uint8_t active = this->active_downloads_.load();
+  do {
+    if (active >= this->max_downloads_)
+      return false;
+  } while (!this->active_downloads_.compare_exchange_weak(active, active + 1));
+  return true;
+}
+
+// Contiguous body bytes at pos: the rest of a flash file, or whatever span a
+// binary source (nullptr for files) can expose. 0 = nothing more.
+static size_t body_span(const BinarySource *binary, const uint8_t *data, size_t size, size_t pos,
+                        const uint8_t **out) {
+  if (binary != nullptr)
+    return binary->read(pos, out);
+  *out = data + pos;
+  return size - pos;
+}
+
+#ifdef USE_ESP_IDF
+// Next chunk of a body, at most max_len bytes; returns its length, 0 if the
+// source ran dry or the client is gone
+static size_t send_body_chunk(httpd_req_t *req, const BinarySource *binary, const uint8_t *data, size_t size,
+                              size_t pos, size_t max_len) {
+  const uint8_t *span;
+  size_t len = std::min(max_len, body_span(binary, data, size, pos, &span));
+  if (len == 0 || httpd_resp_send_chunk(req, reinterpret_cast<const char *>(span), len) != ESP_OK)
+    return 0;
+  return len;
+}
+#endif
+
+AsyncWebServerResponse *CustomWebHandler::begin_file_response_(AsyncWebServerRequest *request, int code,
+                                                               const Endpoint &endpoint, const uint8_t *data,
+                                                               size_t size, size_t offset, size_t length) {
+#ifdef USE_ESP_IDF
+  // Status and type only; the body goes out in send_file_response_(). Not
+  // through beginResponse(): it registers "Accept-Ranges: none", which httpd
+  // cannot take back, so a second "bytes" would contradict it. Of the default
+  // headers it would add, the CORS one web_server_base sets is kept here.
+  // With Accept-Ranges, Content-Range, Content-Encoding and the three cache
+  // headers that makes at most 7 of httpd's default 8.
+  (void) data;
+  (void) size;
+  (void) offset;
+  (void) length;
+  httpd_req_t *req = *request;
+  httpd_resp_set_status(req, code == 206 ? "206 Partial Content" : HTTPD_200);
+  httpd_resp_set_type(req, endpoint.content_type);
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  return nullptr;
 #else
-  AsyncWebServerResponse *response = request->beginResponse_P(
-      200, endpoint.content_type.c_str(), endpoint.file_data, endpoint.file_size);
+  // The server pulls the body through this callback as its send window opens,
+  // straight out of flash into its own buffer. Everything is captured by value:
+  // endpoints_ may reallocate while a download is still being pulled.
+  const BinarySource *binary = endpoint.type == ENDPOINT_BINARY ? endpoint.binary : nullptr;
+  AsyncWebServerResponse *response = request->beginResponse(
+      endpoint.content_type, length,
+      [binary, data, size, offset, length](uint8_t *buffer, size_t max_len, size_t index) -> size_t {
+        const uint8_t *span;
+        size_t len = body_span(binary, data, size, offset + index, &span);
+        len = std::min(std::min(std::min(max_len, FILE_CHUNK_SIZE), length - index), len);
+        memcpy_P(buffer, span, len);
+        return len;
+      });
+  response->setCode(code);
+  // Counted down however the download ends, including a client that walks away
+  request->onDisconnect([this]() { this->active_downloads_--; });
+  return response;
 #endif
+}
+
+void CustomWebHandler::send_file_response_(AsyncWebServerRequest *request, AsyncWebServerResponse *response,
+                                           const Endpoint &endpoint, const uint8_t *data, size_t size, size_t offset,
+                                           size_t length) {
+#ifdef USE_ESP_IDF
+  // web_server_idf applies status and headers to the httpd request directly, so the
+  // body can follow as HTTP chunks read from memory-mapped flash with no copy. The
+  // first chunk goes out here: it carries the headers, whose strings only live
+  // until the handler returns.
+  (void) response;
+  httpd_req_t *req = *request;
+  const BinarySource *binary = endpoint.type == ENDPOINT_BINARY ? endpoint.binary : nullptr;
+  size_t sent = length == 0 ? 0 : send_body_chunk(req, binary, data, size, offset, std::min(FILE_CHUNK_SIZE, length));
+  if (sent == length) {
+    httpd_resp_send_chunk(req, nullptr, 0);
+    this->active_downloads_--;
+    return;
+  }
+  if (sent == 0) {
+    ESP_LOGW(TAG, "Download of %s aborted before the first chunk", endpoint.path);
+    this->active_downloads_--;
+    return;
+  }
+  
+  // The rest is sent from work items, one chunk each; begin_download_() left a slot free
+  Download *download = this->claim_download_();
+  httpd_req_t *async = nullptr;
+  if (download == nullptr || httpd_req_async_handler_begin(req, &async) != ESP_OK) {
+    ESP_LOGW(TAG, "Could not detach download of %s", endpoint.path);
+    if (download != nullptr)
+      download->in_use.store(false);
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    this->active_downloads_--;
+    return;
+  }
+  download->req = async;
+  download->binary = binary;
+  download->data = data;
+  download->size = size;
+  download->pos = offset + sent;
+  download->remaining = length - sent;
+  if (httpd_queue_work(async->handle, download_work_, download) != ESP_OK)
+    this->finish_download_(download, false);
+#else
+  (void) endpoint;
+  (void) data;
+  (void) size;
+  (void) offset;
+  (void) length;
   request->send(response);
+#endif
+}
+
+#ifdef USE_ESP_IDF
+CustomWebHandler::Download *CustomWebHandler::claim_download_() {
+  for (uint8_t i = 0; i < this->max_downloads_; i++) {
+    bool expected = false;
+    if (this->downloads_[i].in_use.compare_exchange_strong(expected, true))
+      return &this->downloads_[i];
+  }
+  return nullptr;
+}
+
+void CustomWebHandler::download_work_(void *arg) {
+  auto *download = static_cast<Download *>(arg);
+  size_t len = send_body_chunk(download->req, download->binary, download->data, download->size, download->pos,
+                               std::min(FILE_CHUNK_SIZE, download->remaining));
+  if (len == 0) {
+    ESP_LOGW(TAG, "Download aborted with %u bytes left", (unsigned) download->remaining);
+    download->owner->finish_download_(download, false);
+    return;
+  }
+  download->pos += len;
+  download->remaining -= len;
+  if (download->remaining == 0) {
+    download->owner->finish_download_(download, true);
+  } else if (httpd_queue_work(download->req->handle, download_work_, download) != ESP_OK) {
+    download->owner->finish_download_(download, false);
+  }
+}
+
+void CustomWebHandler::finish_download_(Download *download, bool complete) {
+  httpd_req_t *req = download->req;
+  if (complete) {
+    httpd_resp_send_chunk(req, nullptr, 0);
+  } else {
+    // A truncated chunked body must not leave a keep-alive client waiting
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+  }
+  httpd_req_async_handler_complete(req);
+  download->in_use.store(false);
+  this->active_downloads_--;
 }
+#endif
 
 void CustomWebHandler::handle_url_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint) {
-#if defined(USE_ESP32) && !defined(USE_ESP_IDF)
+#ifdef USE_ESP_IDF
+  // Answered later from a proxy worker; the server task is free as soon as we return
+  if (!this->proxy_.submit(*request, &endpoint)) {
+    ESP_LOGW(TAG, "URL proxy busy, refusing %s", endpoint.path);
+    AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Proxy busy");
+    set_reason(request, 503);
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+  }
+#elif defined(USE_ESP32)
   HTTPClient http;
-  http.begin(endpoint.content.c_str());
+  http.begin(endpoint.content);
   
   int httpCode = http.GET();
   
   if (httpCode > 0) {
     if (httpCode == HTTP_CODE_OK) {
       String payload = http.getString();
-      request->send(200, endpoint.content_type.c_str(), payload.c_str());
+      request->send(200, endpoint.content_type, payload.c_str());
     } else {
       request->send(httpCode, "text/plain", "HTTP Error");
     }
@@ -128,7 +1009,7 @@ void CustomWebHandler::handle_url_endpoint(AsyncWebServerRequest *request, const
   
   http.end();
 #else
-  request->send(501, "text/plain", "URL endpoints not supported on ESP-IDF or ESP8266");
+  request->send(501, "text/plain", "URL endpoints not supported on ESP8266");
 #endif
 }
 
@@ -3,6 +3,16 @@
 #include "esphome/core/component.h"
 #include "esphome/core/automation.h"
 #include "esphome/components/web_server_base/web_server_base.h"
+#include "metrics.h"
+#include "pool_commands.h"
+#include "pool_events.h"
+#include "pool_snapshot.h"
+#include "pool_socket.h"
+#include "url_proxy.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <type_traits>
 
 #if defined(USE_ESP32) && !defined(USE_ESP_IDF)
 #include <HTTPClient.h>
@@ -11,42 +21,250 @@
 namespace esphome {
 namespace custom_web_handler {
 
-enum EndpointType {
+enum EndpointType : uint8_t {
   ENDPOINT_TEXT,
   ENDPOINT_FILE,
   ENDPOINT_URL,
+  ENDPOINT_BINARY,
+#ifdef USE_PENTAIR_IF_IC
+  ENDPOINT_POOL_STATE,
+  ENDPOINT_POOL_STATE_CBOR,
+  ENDPOINT_POOL_EVENTS,
+  ENDPOINT_POOL_COMMANDS,
+  ENDPOINT_METRICS,
+#endif
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  ENDPOINT_POOL_SOCKET,
+#endif
+};
+
+#ifdef USE_PENTAIR_IF_IC
+enum PoolStateFormat : uint8_t {
+  POOL_STATE_JSON,
+  POOL_STATE_CBOR,
+};
+#endif
+
+// Precompressed variants of a file endpoint, in order of preference
+enum ContentEncoding : uint8_t {
+  ENCODING_BROTLI,
+  ENCODING_GZIP,
+  ENCODING_IDENTITY,
+  ENCODING_COUNT,
+};
+
+// Token for Accept-Encoding / Content-Encoding
+const char *content_encoding_to_str(ContentEncoding encoding);
+// True if the Accept-Encoding list names token without q=0
+bool accepts_encoding(const char *accept, const char *token);
+
+enum RangeResult {
+  RANGE_NONE,  // Absent, malformed or multi-range: send the whole body
+  RANGE_PARTIAL,
+  RANGE_UNSATISFIABLE,
 };
 
+// Single "bytes=" range against a body of size bytes; start/end are inclusive
+RangeResult parse_range(const char *header, size_t size, size_t *start, size_t *end);
+
+// Sets the status line on ESP-IDF for codes web_server_idf does not map itself
+// (it only knows 200, 404 and 409); call right after beginResponse()
+void set_reason(AsyncWebServerRequest *request, int code);
+
+struct FileVariant {
+  const uint8_t *data;  // nullptr if this encoding is not embedded
+  size_t size;
+};
+
+// Dynamic binary content (e.g. a bus capture) registered from C++. size() is
+// read once per request; read() points data at the contiguous bytes starting at
+// offset and returns their count (0 = end). Spans must stay valid until the
+// download finishes. The endpoint table keeps a pointer, so the source must
+// outlive the handler.
+struct BinarySource {
+  std::function<size_t()> size;
+  std::function<size_t(size_t offset, const uint8_t **data)> read;
+};
+
+// FNV-1a over the request path, salted with a seed that __init__.py picks so
+// every configured path lands in its own slot of the route table.
+inline constexpr uint32_t route_hash(const char *path, size_t len, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= static_cast<uint8_t>(path[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// One row of the endpoint table. Plain data: every string points at a constant
+// emitted by codegen (flash on ESP32, PROGMEM text on ESP8266), so registering
+// endpoints allocates nothing beyond the table itself and serving one copies
+// nothing.
 struct Endpoint {
-  std::string path;
-  std::string content_type;
+  const char *path;
+  const char *content_type;
+  const char *content;                // For TEXT: body; for URL: upstream URL
+  const char *etag;                   // For FILE: content hash, unquoted; nullptr = no ETag
+  const char *cache_control;          // For FILE: Cache-Control value, nullptr = none
+  const BinarySource *binary;         // For BINARY
+#ifdef USE_PENTAIR_IF_IC
+  pentair_if_ic::PentairIfIcComponent *pool;  // For POOL_* and METRICS
+  PoolEventStream *events;                     // For POOL_EVENTS
+  PoolCommandEndpoint *commands;               // For POOL_COMMANDS
+#endif
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  PoolSocket *socket;  // For POOL_SOCKET
+#endif
+  FileVariant files[ENCODING_COUNT];  // For FILE
+  uint32_t content_size;              // For TEXT
+  uint32_t cache_ttl_ms;              // For URL: response cache TTL, 0 = not cached
+  uint32_t cache_stale_ms;            // For URL: stale-while-revalidate window after the TTL
+  uint16_t path_len;
   EndpointType type;
-  std::string content;  // For TEXT and URL
-  const uint8_t *file_data;  // For FILE
-  size_t file_size;  // For FILE
 };
+static_assert(std::is_trivially_copyable<Endpoint>::value, "Endpoint must stay plain data");
 
 class CustomWebHandler : public Component, public AsyncWebHandler {
  public:
   void setup() override;
+#ifdef USE_PENTAIR_IF_IC
+  void loop() override;
+#endif
   float get_setup_priority() const override { return setup_priority::WIFI - 1.0f; }
   
-  void add_text_endpoint(const std::string &path, const std::string &content_type, const std::string &text);
-  void add_file_endpoint(const std::string &path, const std::string &content_type, const uint8_t *data, size_t size);
-  void add_url_endpoint(const std::string &path, const std::string &content_type, const std::string &url);
+  // All strings are kept by pointer and must live as long as the handler
+  // (string literals or generated constants). text may be in PROGMEM.
+  void add_text_endpoint(const char *path, const char *content_type, const char *text, size_t size);
+  void add_file_endpoint(const char *path, const char *content_type, const uint8_t *data, size_t size);
+  // Attach a precompressed variant to an existing file endpoint
+  void add_file_encoding(const char *path, ContentEncoding encoding, const uint8_t *data, size_t size);
+  // Validators for conditional GET on an existing file endpoint
+  void set_file_caching(const char *path, const char *etag, const char *cache_control);
+  void add_url_endpoint(const char *path, const char *content_type, const char *url);
+  // Served with the same streaming and Range support as files
+  void add_binary_endpoint(const char *path, const char *content_type, const BinarySource *source);
+#ifdef USE_PENTAIR_IF_IC
+  // Snapshot of pump, chlorinator and alarm state
+  void add_pool_state_endpoint(const char *path, const char *content_type, pentair_if_ic::PentairIfIcComponent *pool,
+                               PoolStateFormat format = POOL_STATE_JSON);
+  // Server-Sent Events stream of state changes, batched over coalesce_ms
+  void add_pool_events_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool, uint32_t coalesce_ms,
+                                uint8_t max_clients);
+  // POST endpoint queuing a batch of control commands in one go
+  void add_pool_commands_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool);
+  // OpenMetrics text for scrapers: pool bus internals, heap and this handler's own counters
+  void add_metrics_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool);
+#endif
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+  // WebSocket pushing binary state frames and taking command batches; on ESP-IDF
+  // it is served by its own small server on port
+  void add_pool_socket_endpoint(const char *path, pentair_if_ic::PentairIfIcComponent *pool, uint32_t coalesce_ms,
+                                uint8_t max_clients, uint16_t port);
+#endif
+  // Perfect-hash table generated at codegen: slot holds endpoint index + 1, 0 = empty.
+  // size must be a power of two.
+  void set_route_table(const uint8_t *table, size_t size, uint32_t seed);
+  // File downloads streamed at once; more get a 503 so browsers retry later
+  void set_max_concurrent_downloads(uint8_t max_downloads) { this->max_downloads_ = max_downloads; }
+  
+#ifdef USE_ESP_IDF
+  // url: endpoints: upstream timeout and proxies in flight at once
+  void set_proxy_timeout(uint32_t timeout_ms) { this->proxy_.set_timeout(timeout_ms); }
+  void set_max_concurrent_proxies(uint8_t max_proxies) { this->proxy_.set_max_concurrent(max_proxies); }
+  // Byte budget shared by all cached url: responses
+  void set_proxy_cache_size(size_t cache_size) { this->proxy_.set_cache_size(cache_size); }
+  // Cache an existing url: endpoint's response
+  void set_url_cache(const char *path, uint32_t ttl_ms, uint32_t stale_ms);
+#endif
+  
+  // Download diagnostics
+  uint8_t active_downloads() const { return this->active_downloads_.load(); }
   
   bool canHandle(AsyncWebServerRequest *request) const override;
   void handleRequest(AsyncWebServerRequest *request) override;
 #ifndef USE_ESP_IDF
   bool isRequestHandlerTrivial() override { return false; }
+#ifdef USE_PENTAIR_IF_IC
+  void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) override;
+#endif
 #endif
 
  protected:
   std::vector<Endpoint> endpoints_;
   
+  Endpoint *add_endpoint_(const char *path, const char *content_type, EndpointType type);
+  Endpoint *find_path_(const char *path, EndpointType type);
+  
+#ifdef USE_ESP_IDF
+  UrlProxy proxy_;
+#endif
+  
+  const uint8_t *route_table_{nullptr};
+  size_t route_mask_{0};
+  uint32_t route_seed_{0};
+  size_t routed_endpoints_{0};  // Endpoints covered by the route table, later ones are scanned
+  
+  const Endpoint *find_endpoint_(AsyncWebServerRequest *request) const;
+  // Best variant the client accepts; ENCODING_COUNT if there is none
+  ContentEncoding negotiate_encoding_(AsyncWebServerRequest *request, const Endpoint &endpoint) const;
+  void add_cache_headers_(AsyncWebServerRequest *request, AsyncWebServerResponse *response, const Endpoint &endpoint,
+                          const char *etag, size_t variants) const;
+  
+  // Files leave flash in chunks of this size; the network stack's send buffer is
+  // the only RAM a download holds, however large the file.
+  static constexpr size_t FILE_CHUNK_SIZE = 1436;  // One TCP segment
+  uint8_t max_downloads_{4};
+  std::atomic<uint8_t> active_downloads_{0};
+  
+  bool begin_download_();
+#ifdef USE_ESP_IDF
+  // A download detached from the handler. Each httpd work item sends one chunk
+  // and queues the next, so downloads interleave with each other and with
+  // other requests on the server task. One slot per allowed download.
+  struct Download {
+    CustomWebHandler *owner;
+    std::atomic<bool> in_use{false};
+    httpd_req_t *req;            // Detached copy
+    const BinarySource *binary;  // nullptr for flash files
+    const uint8_t *data;
+    size_t size;
+    size_t pos;        // Next body byte
+    size_t remaining;
+  };
+  std::unique_ptr<Download[]> downloads_;
+  Download *claim_download_();
+  void finish_download_(Download *download, bool complete);
+  static void download_work_(void *arg);
+#endif
+  // Body of size bytes, honouring Range; data is the flash copy for FILE endpoints
+  void send_body_(AsyncWebServerRequest *request, const Endpoint &endpoint, const uint8_t *data, size_t size,
+                  ContentEncoding encoding, const char *etag, size_t variants);
+  // Status and body source; on ESP-IDF the status goes straight onto the httpd
+  // request and nullptr is returned (see add_header())
+  AsyncWebServerResponse *begin_file_response_(AsyncWebServerRequest *request, int code, const Endpoint &endpoint,
+                                               const uint8_t *data, size_t size, size_t offset, size_t length);
+  void send_file_response_(AsyncWebServerRequest *request, AsyncWebServerResponse *response,
+                           const Endpoint &endpoint, const uint8_t *data, size_t size, size_t offset, size_t length);
+  
   void handle_text_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
   void handle_file_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
   void handle_url_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
+  void handle_binary_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
+#ifdef USE_PENTAIR_IF_IC
+  void handle_pool_state_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
+  void handle_pool_state_cbor_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
+  void handle_metrics_endpoint(AsyncWebServerRequest *request, const Endpoint &endpoint);
+  void write_handler_metrics_(MetricsWriter &out);
+  
+#ifdef USE_ESP8266
+  // No allocator low-water mark on ESP8266; sampled from loop() instead
+  uint32_t heap_low_water_{UINT32_MAX};
+#endif
+  
+  // Rendered into once per request; allocated in setup() if a pool_state endpoint exists
+  std::unique_ptr<char[]> state_buffer_;
+#endif
 };
 
 }  // namespace custom_web_handler
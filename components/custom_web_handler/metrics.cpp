@@ -0,0 +1,256 @@
+#include "metrics.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include <algorithm>
+#include <cstdio>
+
+namespace esphome {
+namespace custom_web_handler {
+
+using pentair_if_ic::BusStats;
+using pentair_if_ic::PentairIfIcComponent;
+
+size_t format_fixed(char *out, uint64_t value, uint32_t scale) {
+  size_t decimals = 0;
+  for (uint32_t s = scale; s > 1; s /= 10)
+    decimals++;
+  // Fractional zeros would only be printed to be stripped again
+  while (decimals > 0 && value % 10 == 0) {
+    value /= 10;
+    decimals--;
+  }
+
+  char digits[21];  // Reversed; 2^64 has 20
+  size_t n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  while (n <= decimals)
+    digits[n++] = '0';
+
+  size_t len = 0;
+  while (n > 0) {
+    if (n == decimals)
+      out[len++] = '.';
+    out[len++] = digits[--n];
+  }
+  out[len] = '\0';
+  return len;
+}
+
+size_t format_label(char *out, size_t size, const char *name, const char *value) {
+  int n = snprintf(out, size, "%s=\"", name);
+  if (n < 0 || (size_t) n + 2 > size) {
+    out[0] = '\0';
+    return 0;
+  }
+  size_t len = n;
+  for (const char *p = value; *p != '\0'; p++) {
+    bool escape = *p == '\\' || *p == '"' || *p == '\n';
+    if (len + (escape ? 2 : 1) + 2 > size)
+      break;
+    if (escape)
+      out[len++] = '\\';
+    out[len++] = *p == '\n' ? 'n' : *p;
+  }
+  out[len++] = '"';
+  out[len] = '\0';
+  return len;
+}
+
+void MetricsWriter::family(const char *name, const char *type, const char *help) {
+  this->write_("# TYPE ");
+  this->write_(name);
+  this->write_(" ");
+  this->write_(type);
+  this->write_("\n# HELP ");
+  this->write_(name);
+  this->write_(" ");
+  this->write_(help);
+  this->write_("\n");
+}
+
+void MetricsWriter::sample(const char *name, const char *suffix, const char *labels, uint64_t value,
+                           uint32_t scale) {
+  char number[22];
+  size_t len = format_fixed(number, value, scale);
+  this->write_(name);
+  this->write_(suffix);
+  this->labels_(labels, nullptr);
+  this->write_(" ");
+  this->write_(number, len);
+  this->write_("\n");
+}
+
+void MetricsWriter::histogram_(const char *name, const char *labels, const uint32_t *bounds,
+                               const uint32_t *buckets, size_t n, uint64_t sum, uint32_t scale) {
+  // Summed here rather than read from the histogram's own count, so the +Inf
+  // bucket and _count agree even if a sample lands mid-scrape
+  uint64_t cumulative = 0;
+  char le[22];
+  for (size_t i = 0; i <= n; i++) {
+    cumulative += buckets[i];
+    if (i < n) {
+      format_fixed(le, bounds[i], scale);
+    } else {
+      strcpy(le, "+Inf");
+    }
+    char number[22];
+    size_t len = format_fixed(number, cumulative, 1);
+    this->write_(name);
+    this->write_("_bucket");
+    this->labels_(labels, le);
+    this->write_(" ");
+    this->write_(number, len);
+    this->write_("\n");
+  }
+  this->sample(name, "_count", labels, cumulative);
+  this->sample(name, "_sum", labels, sum, scale);
+}
+
+void MetricsWriter::labels_(const char *labels, const char *le) {
+  bool have_labels = labels != nullptr && labels[0] != '\0';
+  if (!have_labels && le == nullptr)
+    return;
+  this->write_("{");
+  if (have_labels)
+    this->write_(labels);
+  if (le != nullptr) {
+    this->write_(have_labels ? ",le=\"" : "le=\"");
+    this->write_(le);
+    this->write_("\"");
+  }
+  this->write_("}");
+}
+
+void MetricsWriter::finish() {
+  this->write_("# EOF\n");
+  this->flush_();
+#ifdef USE_ESP_IDF
+  if (!this->failed_)
+    httpd_resp_send_chunk(this->req_, nullptr, 0);
+#endif
+}
+
+void MetricsWriter::write_(const char *data, size_t len) {
+  while (len > 0) {
+    if (this->len_ == sizeof(this->buf_))
+      this->flush_();
+    size_t n = std::min(len, sizeof(this->buf_) - this->len_);
+    memcpy(this->buf_ + this->len_, data, n);
+    this->len_ += n;
+    data += n;
+    len -= n;
+  }
+}
+
+void MetricsWriter::flush_() {
+  if (this->len_ == 0 || this->failed_) {
+    this->len_ = 0;
+    return;
+  }
+#ifdef USE_ESP_IDF
+  if (httpd_resp_send_chunk(this->req_, this->buf_, this->len_) != ESP_OK)
+    this->failed_ = true;
+#else
+  this->stream_->write(reinterpret_cast<const uint8_t *>(this->buf_), this->len_);
+#endif
+  this->len_ = 0;
+}
+
+void write_bus_metrics(MetricsWriter &out, PentairIfIcComponent *pool) {
+  const BusStats &stats = pool->bus_stats();
+  char labels[40];
+
+  out.family("pentair_rx_bytes", "counter", "Bytes received from the bus, excluding suppressed echoes");
+  out.counter("pentair_rx_bytes", nullptr, stats.rx_bytes);
+  out.family("pentair_tx_bytes", "counter", "Bytes transmitted on the bus");
+  out.counter("pentair_tx_bytes", nullptr, stats.tx_bytes);
+  out.family("pentair_bus_busy_seconds", "counter", "Wire time of all bytes on the bus");
+  out.counter("pentair_bus_busy_seconds", nullptr, (uint64_t) pool->bus_busy_bytes() * pool->byte_time_us(), 1000000);
+  out.family("pentair_bus_utilization_ratio", "gauge", "Share of the last 10 s the bus was busy");
+  out.gauge("pentair_bus_utilization_ratio", nullptr, stats.utilization_permille, 1000);
+
+  out.family("pentair_rx_frames", "counter", "Valid frames received, per device");
+  for (uint8_t i = 0; i < pentair_if_ic::BUS_DEVICE_COUNT; i++) {
+    snprintf(labels, sizeof(labels), "device=\"%s\"",
+             pentair_if_ic::bus_device_to_str(static_cast<pentair_if_ic::BusDevice>(i)));
+    out.counter("pentair_rx_frames", labels, stats.rx_frames[i]);
+  }
+  out.family("pentair_rx_errors", "counter", "Received data discarded as corrupt, per reason");
+  for (uint8_t i = 0; i < pentair_if_ic::RX_ERROR_COUNT; i++) {
+    snprintf(labels, sizeof(labels), "reason=\"%s\"",
+             pentair_if_ic::rx_error_to_str(static_cast<pentair_if_ic::RxError>(i)));
+    out.counter("pentair_rx_errors", labels, stats.rx_errors[i]);
+  }
+  out.counter("pentair_rx_errors", "reason=\"gap\"", pool->rx_gap_discards());
+  out.family("pentair_echo_frames", "counter", "Own frames read back and suppressed");
+  out.counter("pentair_echo_frames", nullptr, pool->rx_echo_frames());
+  out.family("pentair_echo_missing", "counter", "Own frames whose echo never came back");
+  out.counter("pentair_echo_missing", nullptr, pool->rx_missing_echoes());
+  out.family("pentair_tx_collisions", "counter", "Own frames that came back corrupted by another node");
+  out.counter("pentair_tx_collisions", nullptr, pool->tx_collisions());
+
+  out.family("pentair_tx_queue_depth", "gauge", "Commands waiting in each send queue class");
+  for (uint8_t i = 0; i < pentair_if_ic::TX_PRIORITY_COUNT; i++) {
+    auto priority = static_cast<pentair_if_ic::TxPriority>(i);
+    snprintf(labels, sizeof(labels), "class=\"%s\"", pentair_if_ic::tx_priority_to_str(priority));
+    out.gauge("pentair_tx_queue_depth", labels, pool->tx_queue_depth(priority));
+  }
+  out.family("pentair_tx_queue_capacity", "gauge", "Send queue class bound");
+  for (uint8_t i = 0; i < pentair_if_ic::TX_PRIORITY_COUNT; i++) {
+    auto priority = static_cast<pentair_if_ic::TxPriority>(i);
+    snprintf(labels, sizeof(labels), "class=\"%s\"", pentair_if_ic::tx_priority_to_str(priority));
+    out.gauge("pentair_tx_queue_capacity", labels, pool->tx_queue_capacity(priority));
+  }
+  out.family("pentair_tx_queue_high_water", "gauge", "Deepest each send queue class has been");
+  for (uint8_t i = 0; i < pentair_if_ic::TX_PRIORITY_COUNT; i++) {
+    auto priority = static_cast<pentair_if_ic::TxPriority>(i);
+    snprintf(labels, sizeof(labels), "class=\"%s\"", pentair_if_ic::tx_priority_to_str(priority));
+    out.gauge("pentair_tx_queue_high_water", labels, pool->tx_queue_high_water(priority));
+  }
+  out.family("pentair_tx_dropped", "counter", "Commands dropped because their queue class was full");
+  for (uint8_t i = 0; i < pentair_if_ic::TX_PRIORITY_COUNT; i++) {
+    auto priority = static_cast<pentair_if_ic::TxPriority>(i);
+    snprintf(labels, sizeof(labels), "class=\"%s\"", pentair_if_ic::tx_priority_to_str(priority));
+    out.counter("pentair_tx_dropped", labels, pool->tx_dropped(priority));
+  }
+  out.family("pentair_tx_expired", "counter", "Commands discarded unsent past their deadline");
+  out.counter("pentair_tx_expired", nullptr, pool->tx_expired());
+  out.family("pentair_tx_starved", "gauge", "1 while commands wait past the starvation threshold");
+  out.gauge("pentair_tx_starved", nullptr, pool->is_tx_starved() ? 1 : 0);
+  out.family("pentair_tx_starvation_events", "counter", "Times the send path became starved");
+  out.counter("pentair_tx_starvation_events", nullptr, pool->tx_starvation_events());
+  out.family("pentair_inbox_high_water", "gauge", "Most commands picked up from the inbox in one loop");
+  out.gauge("pentair_inbox_high_water", nullptr, stats.inbox_high_water);
+
+  out.family("pentair_commands", "counter", "Completed commands, per result");
+  for (uint8_t i = pentair_if_ic::COMMAND_ACKED; i < pentair_if_ic::COMMAND_UNKNOWN; i++) {
+    // Same names as the JSON results, with underscores as label values
+    const char *result = pentair_if_ic::command_result_to_str(static_cast<pentair_if_ic::CommandResult>(i));
+    size_t len = snprintf(labels, sizeof(labels), "result=\"%s\"", result);
+    for (size_t j = 0; j < len; j++) {
+      if (labels[j] == ' ')
+        labels[j] = '_';
+    }
+    out.counter("pentair_commands", labels, stats.command_results[i].load(std::memory_order_relaxed));
+  }
+  out.family("pentair_command_rtt_seconds", "histogram", "Command sent to reply received, last attempt");
+  for (uint8_t i = 0; i < pentair_if_ic::BUS_DEVICE_COUNT; i++) {
+    snprintf(labels, sizeof(labels), "device=\"%s\"",
+             pentair_if_ic::bus_device_to_str(static_cast<pentair_if_ic::BusDevice>(i)));
+    out.histogram("pentair_command_rtt_seconds", labels, stats.rtt_ms[i], 1000);
+  }
+
+  out.family("pentair_loop_seconds", "histogram", "Time spent in one component loop() call");
+  out.histogram("pentair_loop_seconds", nullptr, stats.loop_us, 1000000);
+  out.family("pentair_loop_max_seconds", "gauge", "Longest component loop() call");
+  out.gauge("pentair_loop_max_seconds", nullptr, stats.loop_us.max(), 1000000);
+}
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "esphome/components/pentair_if_ic/pentair_if_ic.h"
+#include <cstring>
+
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace custom_web_handler {
+
+static const char *const METRICS_CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+// OpenMetrics text exposition written as it is produced. Lines collect in a
+// small buffer that goes out whenever it fills: as an HTTP chunk on ESP-IDF,
+// into an AsyncResponseStream on Arduino (which holds the whole body until
+// the handler returns, as every Arduino response built in the handler does).
+//
+// Values are unsigned fixed point: value / scale, where scale is a power of
+// ten, so microsecond counters become seconds without floating point.
+class MetricsWriter {
+ public:
+#ifdef USE_ESP_IDF
+  explicit MetricsWriter(httpd_req_t *req) : req_(req) {}
+#else
+  explicit MetricsWriter(AsyncResponseStream *stream) : stream_(stream) {}
+#endif
+
+  // Opens a metric family; its samples must follow before the next family.
+  // Counter families are named without _total, which sample() appends.
+  void family(const char *name, const char *type, const char *help);
+  // name + suffix {labels} value; labels is the text between the braces, or nullptr
+  void sample(const char *name, const char *suffix, const char *labels, uint64_t value, uint32_t scale = 1);
+  void counter(const char *name, const char *labels, uint64_t value, uint32_t scale = 1) {
+    this->sample(name, "_total", labels, value, scale);
+  }
+  void gauge(const char *name, const char *labels, uint64_t value, uint32_t scale = 1) {
+    this->sample(name, "", labels, value, scale);
+  }
+  // _bucket (cumulative, bounds as le), _count and _sum samples
+  template<size_t N>
+  void histogram(const char *name, const char *labels, const pentair_if_ic::Histogram<N> &histogram, uint32_t scale) {
+    uint32_t buckets[N + 1];
+    uint32_t bounds[N];
+    for (size_t i = 0; i <= N; i++)
+      buckets[i] = histogram.bucket(i);
+    for (size_t i = 0; i < N; i++)
+      bounds[i] = histogram.bound(i);
+    this->histogram_(name, labels, bounds, buckets, N, histogram.sum(), scale);
+  }
+  // Terminating "# EOF" line; ends the response
+  void finish();
+
+  // A chunk could not be sent (client gone); everything after it was discarded
+  bool failed() const { return this->failed_; }
+
+ protected:
+  void histogram_(const char *name, const char *labels, const uint32_t *bounds, const uint32_t *buckets, size_t n,
+                  uint64_t sum, uint32_t scale);
+  void labels_(const char *labels, const char *le);
+  void write_(const char *data, size_t len);
+  void write_(const char *str) { this->write_(str, strlen(str)); }
+  void flush_();
+
+#ifdef USE_ESP_IDF
+  httpd_req_t *req_;
+#else
+  AsyncResponseStream *stream_;
+#endif
+  char buf_[256];
+  size_t len_{0};
+  bool failed_{false};
+};
+
+// value / scale in decimal, without trailing fractional zeros; returns the
+// length. out needs room for 22 characters.
+size_t format_fixed(char *out, uint64_t value, uint32_t scale);
+
+// name="value" into out, escaping the value as OpenMetrics requires and
+// truncating it to fit; returns the length
+size_t format_label(char *out, size_t size, const char *name, const char *value);
+
+// Bus traffic, errors, queues, command results, RTT and loop timing of pool
+void write_bus_metrics(MetricsWriter &out, pentair_if_ic::PentairIfIcComponent *pool);
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
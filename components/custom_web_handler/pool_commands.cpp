@@ -0,0 +1,438 @@
+#include "pool_commands.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include "esphome/core/log.h"
+#include <cstring>
+
+namespace esphome {
+namespace custom_web_handler {
+
+static const char *const TAG = "custom_web_handler.commands";
+
+using pentair_if_ic::CommandHandle;
+using pentair_if_ic::CommandResult;
+using pentair_if_ic::PoolCommand;
+using pentair_if_ic::PoolCommandType;
+
+// Just enough of a JSON reader for the request body: arrays of flat objects
+// with string and integer members
+class JsonCursor {
+ public:
+  JsonCursor(const char *p, const char *end) : p_(p), end_(end) {}
+
+  // Skips whitespace, then takes c if it is next
+  bool consume(char c) {
+    this->skip_ws_();
+    if (this->p_ == this->end_ || *this->p_ != c)
+      return false;
+    this->p_++;
+    return true;
+  }
+  bool string(const char **str, size_t *len) {
+    if (!this->consume('"'))
+      return false;
+    *str = this->p_;
+    while (this->p_ != this->end_ && *this->p_ != '"') {
+      if (*this->p_ == '\\')
+        return false;
+      this->p_++;
+    }
+    if (this->p_ == this->end_)
+      return false;
+    *len = this->p_ - *str;
+    this->p_++;
+    return true;
+  }
+  bool integer(int32_t *value) {
+    this->skip_ws_();
+    bool negative = this->p_ != this->end_ && *this->p_ == '-';
+    if (negative)
+      this->p_++;
+    const char *start = this->p_;
+    int32_t result = 0;
+    // Nine digits cannot overflow; no command takes anything near that
+    while (this->p_ != this->end_ && *this->p_ >= '0' && *this->p_ <= '9' && this->p_ - start < 9)
+      result = result * 10 + (*this->p_++ - '0');
+    if (this->p_ == start || (this->p_ != this->end_ && *this->p_ >= '0' && *this->p_ <= '9'))
+      return false;
+    *value = negative ? -result : result;
+    return true;
+  }
+  bool at_end() {
+    this->skip_ws_();
+    return this->p_ == this->end_;
+  }
+
+ protected:
+  void skip_ws_() {
+    while (this->p_ != this->end_ && (*this->p_ == ' ' || *this->p_ == '\t' || *this->p_ == '\r' || *this->p_ == '\n'))
+      this->p_++;
+  }
+
+  const char *p_;
+  const char *end_;
+};
+
+static bool equals(const char *str, size_t len, const char *literal) {
+  return strlen(literal) == len && memcmp(str, literal, len) == 0;
+}
+
+static PoolCommandType find_command_type(const char *name, size_t len) {
+  for (uint8_t i = 0; i < pentair_if_ic::POOL_COMMAND_TYPE_COUNT; i++) {
+    auto type = static_cast<PoolCommandType>(i);
+    if (equals(name, len, pentair_if_ic::pool_command_type_to_str(type)))
+      return type;
+  }
+  return pentair_if_ic::POOL_COMMAND_TYPE_COUNT;
+}
+
+static bool takes_value(PoolCommandType type) {
+  return type != pentair_if_ic::POOL_COMMAND_RUN && type != pentair_if_ic::POOL_COMMAND_STOP;
+}
+
+const char *parse_pool_commands(const char *body, size_t len, ParsedCommand *out, size_t max, size_t *count) {
+  JsonCursor in(body, body + len);
+  *count = 0;
+  if (!in.consume('['))
+    return "expected an array of commands";
+  if (in.consume(']'))
+    return "no commands";
+
+  do {
+    if (*count == max)
+      return "too many commands";
+    if (!in.consume('{'))
+      return "expected a command object";
+    bool have_cmd = false;
+    bool have_value = false;
+    PoolCommand command{pentair_if_ic::POOL_COMMAND_TYPE_COUNT, 0};
+    if (!in.consume('}')) {
+      do {
+        const char *key;
+        size_t key_len;
+        if (!in.string(&key, &key_len) || !in.consume(':'))
+          return "expected a member name";
+        if (equals(key, key_len, "cmd")) {
+          const char *name;
+          size_t name_len;
+          if (!in.string(&name, &name_len))
+            return "cmd must be a string";
+          command.type = find_command_type(name, name_len);
+          have_cmd = true;
+        } else if (equals(key, key_len, "value")) {
+          if (!in.integer(&command.value))
+            return "value must be an integer";
+          have_value = true;
+        } else {
+          return "unknown member, expected cmd or value";
+        }
+      } while (in.consume(','));
+      if (!in.consume('}'))
+        return "expected , or } in command";
+    }
+
+    ParsedCommand &parsed = out[(*count)++];
+    parsed.command = command;
+    if (!have_cmd) {
+      parsed.error = "missing cmd";
+    } else if (command.type == pentair_if_ic::POOL_COMMAND_TYPE_COUNT) {
+      parsed.error = "unknown command";
+    } else if (takes_value(command.type) && !have_value) {
+      parsed.error = "missing value";
+    } else {
+      if (command.type == pentair_if_ic::POOL_COMMAND_LOCAL_PROGRAM)
+        parsed.command.value--;
+      parsed.error = pentair_if_ic::validate_pool_command(parsed.command);
+      // The later one would supersede the earlier in the send queue
+      for (size_t i = 0; parsed.error == nullptr && i + 1 < *count; i++) {
+        if (pentair_if_ic::pool_commands_conflict(out[i].command.type, command.type))
+          parsed.error = "conflicts with an earlier command";
+      }
+    }
+  } while (in.consume(','));
+
+  if (!in.consume(']') || !in.at_end())
+    return "expected , or ] after command";
+  return nullptr;
+}
+
+// The response body, one small piece at a time: HTTP chunks on ESP-IDF, a
+// stream response on Arduino. Nothing larger than one result is ever held.
+class ResultWriter {
+ public:
+#ifdef USE_ESP_IDF
+  explicit ResultWriter(httpd_req_t *req) : req_(req) {}
+#else
+  explicit ResultWriter(AsyncResponseStream *stream) : stream_(stream) {}
+#endif
+
+  void begin() { this->send_("{\"results\":[", 12); }
+  // id 0 = never queued
+  void add(const ParsedCommand &parsed, uint32_t id, CommandResult result, uint8_t error_code) {
+    char buf[112];
+    BufferWriter out(buf, sizeof(buf));
+    out.printf("%s{\"cmd\":\"%s\"", this->first_ ? "" : ",", pentair_if_ic::pool_command_type_to_str(parsed.command.type));
+    if (parsed.error != nullptr) {
+      out.printf(",\"error\":\"%s\"}", parsed.error);
+    } else {
+      if (id != 0)
+        out.printf(",\"id\":%u", (unsigned) id);
+      out.printf(",\"result\":\"%s\"", pentair_if_ic::command_result_to_str(result));
+      if (result == pentair_if_ic::COMMAND_REJECTED)
+        out.printf(",\"error_code\":%u", error_code);
+      out.write("}");
+    }
+    this->first_ = false;
+    this->send_(buf, out.length());
+  }
+  void end() {
+    this->send_("]}", 2);
+#ifdef USE_ESP_IDF
+    httpd_resp_send_chunk(this->req_, nullptr, 0);
+#endif
+  }
+
+ protected:
+  void send_(const char *data, size_t len) {
+#ifdef USE_ESP_IDF
+    httpd_resp_send_chunk(this->req_, data, len);
+#else
+    this->stream_->write(reinterpret_cast<const uint8_t *>(data), len);
+#endif
+  }
+
+#ifdef USE_ESP_IDF
+  httpd_req_t *req_;
+#else
+  AsyncResponseStream *stream_;
+#endif
+  bool first_{true};
+};
+
+#ifdef USE_ESP_IDF
+static void begin_json(httpd_req_t *req, const char *status) {
+  httpd_resp_set_status(req, status);
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+}
+
+// Every command of a batch that was not queued, with why
+static void send_unqueued(httpd_req_t *req, const char *status, const ParsedCommand *commands, size_t count) {
+  begin_json(req, status);
+  ResultWriter writer(req);
+  writer.begin();
+  for (size_t i = 0; i < count; i++)
+    writer.add(commands[i], 0, pentair_if_ic::COMMAND_DROPPED, 0);
+  writer.end();
+}
+
+static void send_error(httpd_req_t *req, const char *status, const char *error) {
+  char buf[96];
+  BufferWriter out(buf, sizeof(buf));
+  out.printf("{\"error\":\"%s\"}", error);
+  begin_json(req, status);
+  httpd_resp_send(req, buf, out.length());
+}
+
+void PoolCommandEndpoint::handle_request(AsyncWebServerRequest *request) {
+  httpd_req_t *req = *request;
+  char content_type[48];
+  // Anything else would already have been consumed as a form by the web server
+  if (httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type)) != ESP_OK ||
+      strncmp(content_type, "application/json", 16) != 0) {
+    send_error(req, "415 Unsupported Media Type", "Content-Type must be application/json");
+    return;
+  }
+  if (req->content_len > POOL_COMMANDS_BODY_SIZE) {
+    send_error(req, "413 Content Too Large", "body too large");
+    return;
+  }
+
+  char body[POOL_COMMANDS_BODY_SIZE];
+  size_t len = 0;
+  while (len < req->content_len) {
+    int received = httpd_req_recv(req, body + len, req->content_len - len);
+    if (received <= 0) {
+      ESP_LOGW(TAG, "Could not read command body");
+      send_error(req, "400 Bad Request", "could not read body");
+      return;
+    }
+    len += received;
+  }
+  this->submit_(request, body, len);
+}
+
+PoolCommandEndpoint::Batch *PoolCommandEndpoint::claim_batch_() {
+  for (auto &batch : this->batches_) {
+    bool expected = false;
+    if (batch.in_use.compare_exchange_strong(expected, true))
+      return &batch;
+  }
+  return nullptr;
+}
+
+bool PoolCommandEndpoint::submit_(AsyncWebServerRequest *request, const char *body, size_t len) {
+  httpd_req_t *req = *request;
+  ParsedCommand commands[MAX_BATCH];
+  size_t count;
+  const char *error = parse_pool_commands(body, len, commands, this->pool_->max_batch(), &count);
+  if (error != nullptr) {
+    send_error(req, "400 Bad Request", error);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (commands[i].error != nullptr) {
+      send_unqueued(req, "400 Bad Request", commands, count);
+      return false;
+    }
+  }
+
+  Batch *batch = this->claim_batch_();
+  if (batch == nullptr) {
+    ESP_LOGW(TAG, "Too many command batches waiting, refusing");
+    this->batches_refused_++;
+    httpd_resp_set_hdr(req, "Retry-After", "1");
+    send_unqueued(req, "503 Service Unavailable", commands, count);
+    return false;
+  }
+  // Detached first: the loop task may complete the commands as soon as they are queued
+  if (httpd_req_async_handler_begin(req, &batch->req) != ESP_OK) {
+    batch->in_use.store(false);
+    send_error(req, "500 Internal Server Error", "could not detach request");
+    return false;
+  }
+  this->server_ = req->handle;
+  batch->owner = this;
+  batch->count = count;
+  batch->remaining = count;
+
+  PoolCommand pool_commands[MAX_BATCH];
+  pentair_if_ic::CommandCallback callbacks[MAX_BATCH];
+  for (size_t i = 0; i < count; i++) {
+    batch->commands[i] = commands[i];
+    pool_commands[i] = commands[i].command;
+    callbacks[i] = [batch, i](CommandResult result, uint8_t error_code) {
+      batch->results[i] = result;
+      batch->error_codes[i] = error_code;
+      if (--batch->remaining == 0)
+        batch->owner->complete_batch_(batch);
+    };
+  }
+
+  if (!this->pool_->submit_batch(pool_commands, count, callbacks, batch->handles)) {
+    this->batches_refused_++;
+    httpd_resp_set_hdr(batch->req, "Retry-After", "1");
+    send_unqueued(batch->req, "503 Service Unavailable", commands, count);
+    httpd_req_async_handler_complete(batch->req);
+    batch->in_use.store(false);
+    return false;
+  }
+  this->batches_submitted_++;
+  ESP_LOGD(TAG, "Batch of %u commands queued", (unsigned) count);
+  return true;
+}
+
+void PoolCommandEndpoint::complete_batch_(Batch *batch) {
+  // Socket writes belong on the server task; a detached request may be answered
+  // from any task, so if the hand-off fails, answer from here
+  if (httpd_queue_work(this->server_, PoolCommandEndpoint::respond_work_, batch) != ESP_OK)
+    PoolCommandEndpoint::respond_work_(batch);
+}
+
+void PoolCommandEndpoint::respond_work_(void *arg) {
+  auto *batch = static_cast<Batch *>(arg);
+  begin_json(batch->req, "200 OK");
+  ResultWriter writer(batch->req);
+  writer.begin();
+  for (size_t i = 0; i < batch->count; i++)
+    writer.add(batch->commands[i], batch->handles[i].id, batch->results[i], batch->error_codes[i]);
+  writer.end();
+  httpd_req_async_handler_complete(batch->req);
+  batch->in_use.store(false);
+}
+#else
+static void send_error(AsyncWebServerRequest *request, int code, const char *error) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->setCode(code);
+  response->printf("{\"error\":\"%s\"}", error);
+  request->send(response);
+}
+
+static void send_results(AsyncWebServerRequest *request, int code, const ParsedCommand *commands, size_t count,
+                         const CommandHandle *handles) {
+  AsyncResponseStream *response = request->beginResponseStream("application/json");
+  response->setCode(code);
+  response->addHeader("Cache-Control", "no-store");
+  ResultWriter writer(response);
+  writer.begin();
+  for (size_t i = 0; i < count; i++) {
+    CommandResult result = handles != nullptr ? pentair_if_ic::COMMAND_PENDING : pentair_if_ic::COMMAND_DROPPED;
+    writer.add(commands[i], handles != nullptr ? handles[i].id : 0, result, 0);
+  }
+  writer.end();
+  request->send(response);
+}
+
+void PoolCommandEndpoint::handle_body(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index,
+                                      size_t total) {
+  if (total > POOL_COMMANDS_BODY_SIZE)
+    return;
+  // The request frees _tempObject when it is destroyed
+  if (index == 0)
+    request->_tempObject = malloc(total);
+  if (request->_tempObject != nullptr && index + len <= total)
+    memcpy(static_cast<uint8_t *>(request->_tempObject) + index, data, len);
+}
+
+void PoolCommandEndpoint::handle_request(AsyncWebServerRequest *request) {
+  if (!request->contentType().startsWith("application/json")) {
+    send_error(request, 415, "Content-Type must be application/json");
+    return;
+  }
+  if (request->contentLength() > POOL_COMMANDS_BODY_SIZE) {
+    send_error(request, 413, "body too large");
+    return;
+  }
+  if (request->_tempObject == nullptr) {
+    send_error(request, 400, "no body");
+    return;
+  }
+  this->submit_(request, static_cast<const char *>(request->_tempObject), request->contentLength());
+}
+
+bool PoolCommandEndpoint::submit_(AsyncWebServerRequest *request, const char *body, size_t len) {
+  ParsedCommand commands[MAX_BATCH];
+  size_t count;
+  const char *error = parse_pool_commands(body, len, commands, this->pool_->max_batch(), &count);
+  if (error != nullptr) {
+    send_error(request, 400, error);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (commands[i].error != nullptr) {
+      send_results(request, 400, commands, count, nullptr);
+      return false;
+    }
+  }
+
+  PoolCommand pool_commands[MAX_BATCH];
+  CommandHandle handles[MAX_BATCH];
+  for (size_t i = 0; i < count; i++)
+    pool_commands[i] = commands[i].command;
+  if (!this->pool_->submit_batch(pool_commands, count, nullptr, handles)) {
+    this->batches_refused_++;
+    send_results(request, 503, commands, count, nullptr);
+    return false;
+  }
+  this->batches_submitted_++;
+  // Results are not waited for here; the ids can be matched against the component's logs
+  send_results(request, 202, commands, count, handles);
+  return true;
+}
+#endif
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
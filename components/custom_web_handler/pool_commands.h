@@ -0,0 +1,97 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "pool_snapshot.h"
+#include <atomic>
+
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace custom_web_handler {
+
+// Largest request body accepted; a full batch needs well under half of it
+static const size_t POOL_COMMANDS_BODY_SIZE = 512;
+
+// One command of a request body. error says why it cannot be sent (nullptr if
+// it can); an unrecognised "cmd" has type POOL_COMMAND_TYPE_COUNT.
+struct ParsedCommand {
+  pentair_if_ic::PoolCommand command;
+  const char *error;
+};
+
+// Parses a body such as [{"cmd":"rpm","value":2400},{"cmd":"run"}] into out,
+// validating each command on its own and against the earlier ones (see
+// pool_commands_conflict()). Strings may not contain escapes. HTTP
+// local_program numbers are 1-4 like external_program; they are converted to
+// the component's 0-3 here. Returns nullptr, or why the body as a whole is
+// malformed.
+const char *parse_pool_commands(const char *body, size_t len, ParsedCommand *out, size_t max, size_t *count);
+
+// POST endpoint taking a batch of control commands. A batch is validated in
+// full and then queued with submit_batch(), so either every command reaches
+// the bus in order or none does.
+//
+// ESP-IDF: the request is detached (async) and answered once the last command
+// completes, with each command's final result. Completions arrive on the loop
+// task; the response is handed back to the server task with httpd_queue_work().
+// Batches waiting at once are limited to MAX_PENDING, in preallocated slots.
+// Arduino: answered at once with 202 and the command ids, results pending.
+class PoolCommandEndpoint {
+ public:
+  explicit PoolCommandEndpoint(pentair_if_ic::PentairIfIcComponent *pool) : pool_(pool) {}
+
+  void handle_request(AsyncWebServerRequest *request);
+#ifndef USE_ESP_IDF
+  // Collects the body, which the async server delivers before handle_request()
+  void handle_body(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+#endif
+
+  uint32_t batches_submitted() const { return this->batches_submitted_; }
+  uint32_t batches_refused() const { return this->batches_refused_; }
+
+ protected:
+  static const size_t MAX_BATCH = pentair_if_ic::PentairIfIcComponent::MAX_BATCH;
+
+  // Validates and queues a parsed body, or answers with why not; true if queued
+  bool submit_(AsyncWebServerRequest *request, const char *body, size_t len);
+
+  pentair_if_ic::PentairIfIcComponent *pool_;
+  uint32_t batches_submitted_{0};
+  uint32_t batches_refused_{0};
+
+#ifdef USE_ESP_IDF
+  static const uint8_t MAX_PENDING = 2;
+
+  // A batch waiting for its commands to complete
+  struct Batch {
+    PoolCommandEndpoint *owner;
+    std::atomic<bool> in_use{false};
+    httpd_req_t *req;  // Detached copy, answered by respond_work_()
+    uint8_t count;
+    uint8_t remaining;  // Loop task only once submitted
+    ParsedCommand commands[MAX_BATCH];
+    pentair_if_ic::CommandHandle handles[MAX_BATCH];
+    pentair_if_ic::CommandResult results[MAX_BATCH];
+    uint8_t error_codes[MAX_BATCH];
+  };
+
+  Batch *claim_batch_();
+  // Called on the loop task by the last command callback
+  void complete_batch_(Batch *batch);
+  static void respond_work_(void *arg);
+
+  Batch batches_[MAX_PENDING];
+  httpd_handle_t server_{nullptr};
+#endif
+};
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
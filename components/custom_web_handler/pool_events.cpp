@@ -0,0 +1,196 @@
+#include "pool_events.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include "custom_web_handler.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include <cstring>
+
+namespace esphome {
+namespace custom_web_handler {
+
+static const char *const TAG = "custom_web_handler.events";
+
+using pentair_if_ic::PoolState;
+
+PoolEventStream::PoolEventStream(const char *path, pentair_if_ic::PentairIfIcComponent *pool, uint32_t coalesce_ms,
+                                 uint8_t max_clients)
+    : pool_(pool),
+      coalesce_ms_(coalesce_ms),
+      max_clients_(max_clients)
+#ifndef USE_ESP_IDF
+      ,
+      source_(path)
+#endif
+{
+#ifdef USE_ESP_IDF
+  (void) path;  // Routed by CustomWebHandler; the source only needs it on Arduino
+  this->clients_.reserve(max_clients);
+#else
+  this->source_.onConnect([this](AsyncEventSourceClient *client) {
+    // The source has already counted this client
+    if (this->source_.count() > this->max_clients_) {
+      ESP_LOGW(TAG, "Too many event clients, closing");
+      client->close();
+      return;
+    }
+    BufferWriter out(this->snapshot_, sizeof(this->snapshot_));
+    uint32_t generation = this->write_snapshot_(out, false);
+    if (!out.overflowed())
+      client->send(this->snapshot_, "snapshot", generation, 2000);
+  });
+#endif
+}
+
+uint32_t PoolEventStream::write_snapshot_(BufferWriter &out, bool framed) {
+  PoolState state;
+  uint32_t generation = this->pool_->read_state(state);
+  if (framed)
+    out.printf("retry: 2000\nid: %u\nevent: snapshot\ndata: ", (unsigned) generation);
+  write_pool_state_json(out, state, generation, millis());
+  if (framed)
+    out.write("\n\n");
+  return generation;
+}
+
+uint8_t PoolEventStream::client_count() const {
+#ifdef USE_ESP_IDF
+  return this->client_count_.load();
+#else
+  return this->source_.count();
+#endif
+}
+
+void PoolEventStream::loop() {
+  uint32_t now = millis();
+  uint32_t generation = this->pool_->state_generation();
+  if (this->client_count() == 0) {
+    // Nobody listening: no snapshot reads, no formatting. Deltas carry absolute
+    // values, so a later one against the old baseline is still correct.
+    this->pending_ = false;
+    this->last_event_ms_ = now;
+    return;
+  }
+
+  if (generation != this->sent_generation_ && !this->pending_) {
+    this->pending_ = true;
+    this->pending_since_ms_ = now;
+  }
+
+#ifdef USE_ESP_IDF
+  // The previous event is still being written out; keep coalescing until it is
+  if (this->sending_.load())
+    return;
+#endif
+
+  if (this->pending_ && now - this->pending_since_ms_ >= this->coalesce_ms_) {
+    this->pending_ = false;
+    PoolState state;
+    this->sent_generation_ = this->pool_->read_state(state);
+    BufferWriter out(this->event_, sizeof(this->event_));
+#ifdef USE_ESP_IDF
+    out.printf("id: %u\nevent: state\ndata: ", (unsigned) this->sent_generation_);
+#endif
+    bool changed = write_pool_state_delta(out, this->sent_, state, this->sent_generation_);
+    this->sent_ = state;
+    // Only timestamps moved: nothing worth an event
+    if (!changed)
+      return;
+#ifdef USE_ESP_IDF
+    out.write("\n\n");
+#endif
+    if (out.overflowed()) {
+      ESP_LOGE(TAG, "State event does not fit in %u bytes", (unsigned) sizeof(this->event_));
+      return;
+    }
+    this->publish_(out.length());
+    return;
+  }
+
+#ifdef USE_ESP_IDF
+  if (now - this->last_event_ms_ >= KEEPALIVE_MS) {
+    static const char KEEPALIVE[] = ": keepalive\n\n";
+    memcpy(this->event_, KEEPALIVE, sizeof(KEEPALIVE));
+    this->publish_(sizeof(KEEPALIVE) - 1);
+  }
+#endif
+}
+
+void PoolEventStream::publish_(size_t len) {
+  this->last_event_ms_ = millis();
+#ifdef USE_ESP_IDF
+  this->event_len_ = len;
+  this->sending_.store(true);
+  if (httpd_queue_work(this->server_.load(), PoolEventStream::broadcast_work_, this) != ESP_OK) {
+    ESP_LOGW(TAG, "Could not queue event");
+    this->sending_.store(false);
+    return;
+  }
+#else
+  this->source_.send(this->event_, "state", this->sent_generation_);
+#endif
+  this->events_sent_++;
+}
+
+#ifdef USE_ESP_IDF
+void PoolEventStream::broadcast_work_(void *arg) {
+  auto *stream = static_cast<PoolEventStream *>(arg);
+  auto &clients = stream->clients_;
+  for (auto it = clients.begin(); it != clients.end();) {
+    // A failed send means the client went away; its socket is released here
+    if (httpd_resp_send_chunk(*it, stream->event_, stream->event_len_) != ESP_OK) {
+      httpd_req_async_handler_complete(*it);
+      it = clients.erase(it);
+      stream->client_count_--;
+      ESP_LOGD(TAG, "Event client gone, %u left", (unsigned) clients.size());
+    } else {
+      ++it;
+    }
+  }
+  stream->sending_.store(false);
+}
+#endif
+
+void PoolEventStream::handle_request(AsyncWebServerRequest *request) {
+#ifdef USE_ESP_IDF
+  // Runs on the server task, like broadcast_work_(), so clients_ needs no lock
+  httpd_req_t *req = *request;
+  httpd_req_t *client;
+  if (this->clients_.size() >= this->max_clients_) {
+    ESP_LOGW(TAG, "Too many event clients, refusing");
+    AsyncWebServerResponse *response = request->beginResponse(503, "text/plain", "Too many event clients");
+    set_reason(request, 503);
+    response->addHeader("Retry-After", "5");
+    request->send(response);
+    return;
+  }
+  if (httpd_req_async_handler_begin(req, &client) != ESP_OK) {
+    AsyncWebServerResponse *response = request->beginResponse(500, "text/plain", "Could not open stream");
+    set_reason(request, 500);
+    request->send(response);
+    return;
+  }
+
+  httpd_resp_set_type(client, "text/event-stream");
+  httpd_resp_set_hdr(client, "Cache-Control", "no-cache");
+  BufferWriter out(this->snapshot_, sizeof(this->snapshot_));
+  this->write_snapshot_(out, true);
+  if (out.overflowed() || httpd_resp_send_chunk(client, this->snapshot_, out.length()) != ESP_OK) {
+    httpd_req_async_handler_complete(client);
+    return;
+  }
+
+  this->server_.store(req->handle);
+  this->clients_.push_back(client);
+  this->client_count_++;
+  ESP_LOGD(TAG, "Event client connected, %u open", (unsigned) this->clients_.size());
+#else
+  this->source_.handleRequest(request);
+#endif
+}
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "pool_snapshot.h"
+#include <atomic>
+#include <vector>
+
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace custom_web_handler {
+
+// Server-Sent Events stream of pool state changes. loop() only compares the
+// state generation; the first change opens a coalescing window, and when it
+// closes every field that differs from the last event goes out as one "state"
+// event, built once and shared by all clients. A new client first gets the
+// full document as a "snapshot" event.
+//
+// ESP-IDF: each client is a detached (async) httpd request. Events are handed
+// to the server task with httpd_queue_work(), so all socket writes happen
+// there; while one is in flight the next window simply keeps coalescing.
+// Arduino: the clients and framing are AsyncEventSource's.
+class PoolEventStream {
+ public:
+  PoolEventStream(const char *path, pentair_if_ic::PentairIfIcComponent *pool, uint32_t coalesce_ms,
+                  uint8_t max_clients);
+
+  // Called from the handler's loop()
+  void loop();
+  // Opens a stream for this request, or refuses it if all client slots are taken
+  void handle_request(AsyncWebServerRequest *request);
+
+  uint8_t client_count() const;
+  uint32_t events_sent() const { return this->events_sent_; }
+  uint32_t get_coalesce() const { return this->coalesce_ms_; }
+  uint8_t get_max_clients() const { return this->max_clients_; }
+
+ protected:
+  // Comment line so dead connections are found and idle proxies keep them open
+  static const uint32_t KEEPALIVE_MS = 15000;
+  static const size_t EVENT_SIZE = POOL_STATE_JSON_SIZE + 48;  // Document plus SSE framing
+
+  // Full document for a new client, from one state read; framed wraps it as a
+  // complete SSE "snapshot" event (ESP-IDF, where we write the stream ourselves).
+  // Returns the state generation; out reports whether it fit.
+  uint32_t write_snapshot_(BufferWriter &out, bool framed);
+  void publish_(size_t len);
+
+  pentair_if_ic::PentairIfIcComponent *pool_;
+  uint32_t coalesce_ms_;
+  uint8_t max_clients_;
+
+  pentair_if_ic::PoolState sent_{};  // State as of the last event
+  uint32_t sent_generation_{0};
+  bool pending_{false};  // Coalescing window open
+  uint32_t pending_since_ms_{0};
+  uint32_t last_event_ms_{0};
+  uint32_t events_sent_{0};
+
+  char event_[EVENT_SIZE];     // Written by loop(), read by every client send
+  char snapshot_[EVENT_SIZE];  // Written on the server task for each new client
+
+#ifdef USE_ESP_IDF
+  static void broadcast_work_(void *arg);
+
+  std::atomic<httpd_handle_t> server_{nullptr};
+  std::atomic<bool> sending_{false};  // event_ belongs to the server task until cleared
+  size_t event_len_{0};
+  std::atomic<uint8_t> client_count_{0};
+  std::vector<httpd_req_t *> clients_;  // Server task only
+#else
+  AsyncEventSource source_;
+#endif
+};
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
@@ -0,0 +1,289 @@
+#include "pool_snapshot.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace esphome {
+namespace custom_web_handler {
+
+using pentair_if_ic::PoolState;
+
+void BufferWriter::printf(const char *fmt, ...) {
+  if (this->overflow_)
+    return;
+  va_list args;
+  va_start(args, fmt);
+  int written = vsnprintf(this->buf_ + this->len_, this->size_ - this->len_, fmt, args);
+  va_end(args);
+  if (written < 0 || (size_t) written >= this->size_ - this->len_) {
+    this->overflow_ = true;
+    return;
+  }
+  this->len_ += written;
+}
+
+void BufferWriter::write(const char *str) {
+  if (this->overflow_)
+    return;
+  size_t len = strlen(str);
+  if (len >= this->size_ - this->len_) {
+    this->overflow_ = true;
+    return;
+  }
+  memcpy(this->buf_ + this->len_, str, len + 1);
+  this->len_ += len;
+}
+
+void CborWriter::byte_(uint8_t value) {
+  if (this->len_ >= this->size_) {
+    this->overflow_ = true;
+    return;
+  }
+  this->buf_[this->len_++] = value;
+}
+
+void CborWriter::head_(uint8_t major, uint32_t value) {
+  major <<= 5;
+  if (value < 24) {
+    this->byte_(major | value);
+    return;
+  }
+  // Additional info 24/25/26 = 1/2/4 byte big-endian argument
+  uint8_t bytes = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : 4;
+  this->byte_(major | (bytes == 1 ? 24 : bytes == 2 ? 25 : 26));
+  for (int8_t shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+    this->byte_(value >> shift);
+}
+
+static const char *json_bool(bool value) { return value ? "true" : "false"; }
+
+void write_pool_state_json(BufferWriter &out, const PoolState &state, uint32_t generation, uint32_t now_ms) {
+  out.printf("{\"generation\":%u,\"uptime_ms\":%u,\"pump\":", (unsigned) generation, (unsigned) now_ms);
+
+  if (state.pump_updated_ms == 0) {
+    out.write("null");
+  } else {
+    const auto *program = pentair_if_ic::find_program(state.program);
+    out.printf("{\"age_ms\":%u,\"running\":%s,\"rpm\":%u,\"power\":%u,\"flow\":", (unsigned) (now_ms - state.pump_updated_ms),
+               json_bool(state.running), state.rpm, state.power_w);
+    out.milli(state.flow_milli);
+    out.write(",\"pressure\":");
+    out.milli(state.pressure_milli);
+    // Program names come from the shared table and never need escaping
+    out.printf(",\"time_remaining\":%u,\"clock\":%u,\"program\":\"%s\",\"program_code\":%u}", state.time_remaining_min,
+               state.clock_min, program != nullptr ? program->name : "Unknown", state.program);
+  }
+
+  out.write(",\"chlorinator\":");
+  if (state.chlor_updated_ms == 0) {
+    out.write("null,\"alarms\":null}");
+  } else {
+    out.printf("{\"age_ms\":%u,\"salt_ppm\":%u,\"water_temp\":%u,\"set_percent\":%u,\"status\":%u,\"error\":%u}",
+               (unsigned) (now_ms - state.chlor_updated_ms), state.salt_ppm, state.water_temp, state.set_percent,
+               state.status, state.error_flags);
+    out.write(",\"alarms\":{");
+    for (uint8_t bit = 0; bit < 8; bit++)
+      out.printf("%s\"%s\":%s", bit == 0 ? "" : ",", pentair_if_ic::ALARM_NAMES[bit],
+                 json_bool(state.error_flags & (1 << bit)));
+    out.write("}}");
+  }
+}
+
+size_t write_pool_state_json(char *buf, size_t size, const PoolState &state, uint32_t generation, uint32_t now_ms) {
+  BufferWriter out(buf, size);
+  write_pool_state_json(out, state, generation, now_ms);
+  return out.overflowed() ? 0 : out.length();
+}
+
+size_t write_pool_state_cbor(uint8_t *buf, size_t size, const PoolState &state, uint32_t generation, uint32_t now_ms) {
+  CborWriter out(buf, size);
+  out.array(5);
+  out.uint(POOL_STATE_CBOR_VERSION);
+  out.uint(generation);
+  out.uint(now_ms);
+
+  if (state.pump_updated_ms == 0) {
+    out.null();
+  } else {
+    out.array(9);
+    out.uint(now_ms - state.pump_updated_ms);
+    out.boolean(state.running);
+    out.uint(state.rpm);
+    out.uint(state.power_w);
+    out.uint(state.flow_milli);
+    out.uint(state.pressure_milli);
+    out.uint(state.time_remaining_min);
+    out.uint(state.clock_min);
+    out.uint(state.program);
+  }
+
+  if (state.chlor_updated_ms == 0) {
+    out.null();
+  } else {
+    out.array(6);
+    out.uint(now_ms - state.chlor_updated_ms);
+    out.uint(state.salt_ppm);
+    out.uint(state.water_temp);
+    out.uint(state.set_percent);
+    out.uint(state.status);
+    out.uint(state.error_flags);
+  }
+
+  return out.overflowed() ? 0 : out.length();
+}
+
+// One field of a binary state frame; the index in FRAME_FIELDS is its mask bit
+struct FrameField {
+  uint8_t width;
+  bool chlorinator;  // Present once the chlorinator has answered, else once the pump has
+  uint32_t (*get)(const PoolState &state);
+};
+
+static const FrameField FRAME_FIELDS[] = {
+    {1, false, [](const PoolState &s) -> uint32_t { return s.running; }},
+    {2, false, [](const PoolState &s) -> uint32_t { return s.rpm; }},
+    {2, false, [](const PoolState &s) -> uint32_t { return s.power_w; }},
+    {4, false, [](const PoolState &s) -> uint32_t { return s.flow_milli; }},
+    {4, false, [](const PoolState &s) -> uint32_t { return s.pressure_milli; }},
+    {2, false, [](const PoolState &s) -> uint32_t { return s.time_remaining_min; }},
+    {2, false, [](const PoolState &s) -> uint32_t { return s.clock_min; }},
+    {1, false, [](const PoolState &s) -> uint32_t { return s.program; }},
+    {2, true, [](const PoolState &s) -> uint32_t { return s.salt_ppm; }},
+    {1, true, [](const PoolState &s) -> uint32_t { return s.water_temp; }},
+    {1, true, [](const PoolState &s) -> uint32_t { return s.set_percent; }},
+    {1, true, [](const PoolState &s) -> uint32_t { return s.status; }},
+    {1, true, [](const PoolState &s) -> uint32_t { return s.error_flags; }},
+};
+
+static uint8_t *put_le(uint8_t *p, uint32_t value, uint8_t width) {
+  for (uint8_t i = 0; i < width; i++)
+    *p++ = value >> (8 * i);
+  return p;
+}
+
+size_t write_pool_state_frame(uint8_t *buf, size_t size, PoolFrameType type, const PoolState &prev,
+                              const PoolState &cur, uint32_t generation) {
+  if (size < POOL_STATE_FRAME_SIZE)
+    return 0;
+  bool full = type == POOL_FRAME_SNAPSHOT;
+  uint8_t *p = buf + 7;  // Type, generation and mask are filled in last
+  uint16_t mask = 0;
+  for (uint8_t i = 0; i < sizeof(FRAME_FIELDS) / sizeof(FRAME_FIELDS[0]); i++) {
+    const FrameField &field = FRAME_FIELDS[i];
+    uint32_t cur_ms = field.chlorinator ? cur.chlor_updated_ms : cur.pump_updated_ms;
+    uint32_t prev_ms = field.chlorinator ? prev.chlor_updated_ms : prev.pump_updated_ms;
+    if (cur_ms == 0)
+      continue;
+    uint32_t value = field.get(cur);
+    // A section seen for the first time goes out whole, as in the JSON deltas
+    if (!full && prev_ms != 0 && field.get(prev) == value)
+      continue;
+    mask |= 1 << i;
+    p = put_le(p, value, field.width);
+  }
+  if (!full && mask == 0)
+    return 0;
+  buf[0] = type;
+  put_le(put_le(buf + 1, generation, 4), mask, 2);
+  return p - buf;
+}
+
+// Writes the changed members of one delta section, opening it on the first one.
+// Every section follows the generation member, hence the leading comma.
+class DeltaSection {
+ public:
+  DeltaSection(BufferWriter &out, const char *name, bool full) : out_(out), name_(name), full_(full) {}
+
+  void uint(const char *key, uint32_t prev, uint32_t cur) {
+    if (this->member_(key, prev != cur))
+      this->out_.printf("%u", (unsigned) cur);
+  }
+  void milli(const char *key, uint32_t prev, uint32_t cur) {
+    if (this->member_(key, prev != cur))
+      this->out_.milli(cur);
+  }
+  void boolean(const char *key, bool prev, bool cur) {
+    if (this->member_(key, prev != cur))
+      this->out_.write(json_bool(cur));
+  }
+  void string(const char *key, bool changed, const char *cur) {
+    if (this->member_(key, changed))
+      this->out_.printf("\"%s\"", cur);
+  }
+
+  // Closes the section; true if anything was written
+  bool close() {
+    if (this->open_)
+      this->out_.write("}");
+    return this->open_;
+  }
+
+ protected:
+  bool member_(const char *key, bool changed) {
+    if (!changed && !this->full_)
+      return false;
+    if (this->open_) {
+      this->out_.write(",");
+    } else {
+      this->out_.printf(",\"%s\":{", this->name_);
+      this->open_ = true;
+    }
+    this->out_.printf("\"%s\":", key);
+    return true;
+  }
+
+  BufferWriter &out_;
+  const char *name_;
+  bool full_;
+  bool open_{false};
+};
+
+bool write_pool_state_delta(BufferWriter &out, const PoolState &prev, const PoolState &cur, uint32_t generation) {
+  size_t start = out.length();
+  bool changed = false;
+  out.printf("{\"generation\":%u", (unsigned) generation);
+
+  if (cur.pump_updated_ms != 0) {
+    DeltaSection pump(out, "pump", prev.pump_updated_ms == 0);
+    const auto *program = pentair_if_ic::find_program(cur.program);
+    pump.boolean("running", prev.running, cur.running);
+    pump.uint("rpm", prev.rpm, cur.rpm);
+    pump.uint("power", prev.power_w, cur.power_w);
+    pump.milli("flow", prev.flow_milli, cur.flow_milli);
+    pump.milli("pressure", prev.pressure_milli, cur.pressure_milli);
+    pump.uint("time_remaining", prev.time_remaining_min, cur.time_remaining_min);
+    pump.uint("clock", prev.clock_min, cur.clock_min);
+    pump.string("program", prev.program != cur.program, program != nullptr ? program->name : "Unknown");
+    pump.uint("program_code", prev.program, cur.program);
+    changed |= pump.close();
+  }
+
+  if (cur.chlor_updated_ms != 0) {
+    bool full = prev.chlor_updated_ms == 0;
+    DeltaSection chlorinator(out, "chlorinator", full);
+    chlorinator.uint("salt_ppm", prev.salt_ppm, cur.salt_ppm);
+    chlorinator.uint("water_temp", prev.water_temp, cur.water_temp);
+    chlorinator.uint("set_percent", prev.set_percent, cur.set_percent);
+    chlorinator.uint("status", prev.status, cur.status);
+    chlorinator.uint("error", prev.error_flags, cur.error_flags);
+    changed |= chlorinator.close();
+
+    DeltaSection alarms(out, "alarms", full);
+    for (uint8_t bit = 0; bit < 8; bit++)
+      alarms.boolean(pentair_if_ic::ALARM_NAMES[bit], prev.error_flags & (1 << bit), cur.error_flags & (1 << bit));
+    changed |= alarms.close();
+  }
+
+  out.write("}");
+  if (!changed)
+    out.truncate(start);
+  return changed;
+}
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
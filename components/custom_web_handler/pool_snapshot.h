@@ -0,0 +1,121 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PENTAIR_IF_IC
+
+#include "esphome/components/pentair_if_ic/pentair_if_ic.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace custom_web_handler {
+
+// Appends formatted text to a caller-owned buffer without ever growing it. Once
+// something does not fit, the writer stops and overflowed() reports it.
+class BufferWriter {
+ public:
+  BufferWriter(char *buf, size_t size) : buf_(buf), size_(size) {}
+
+  void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+  void write(const char *str);
+  // Thousandths as a fixed-point decimal, e.g. 1234 -> 1.234
+  void milli(uint32_t value) { this->printf("%u.%03u", (unsigned) (value / 1000), (unsigned) (value % 1000)); }
+
+  // Drops everything after len, e.g. a section that turned out to be empty
+  void truncate(size_t len) {
+    this->len_ = len;
+    this->buf_[len] = '\0';
+    this->overflow_ = false;
+  }
+
+  size_t length() const { return this->len_; }
+  bool overflowed() const { return this->overflow_; }
+
+ protected:
+  char *buf_;
+  size_t size_;
+  size_t len_{0};
+  bool overflow_{false};
+};
+
+// Minimal CBOR (RFC 8949) encoder into a caller-owned buffer: unsigned
+// integers in their shortest form, booleans, null and definite-length arrays.
+// Like BufferWriter it never grows the buffer and flags what does not fit.
+class CborWriter {
+ public:
+  CborWriter(uint8_t *buf, size_t size) : buf_(buf), size_(size) {}
+
+  void uint(uint32_t value) { this->head_(0, value); }
+  void array(uint8_t count) { this->head_(4, count); }
+  void boolean(bool value) { this->byte_(value ? 0xF5 : 0xF4); }
+  void null() { this->byte_(0xF6); }
+
+  size_t length() const { return this->len_; }
+  bool overflowed() const { return this->overflow_; }
+
+ protected:
+  void head_(uint8_t major, uint32_t value);
+  void byte_(uint8_t value);
+
+  uint8_t *buf_;
+  size_t size_;
+  size_t len_{0};
+  bool overflow_{false};
+};
+
+// Room for the largest document write_pool_state_json() produces (~490 bytes)
+static const size_t POOL_STATE_JSON_SIZE = 512;
+
+// One JSON document with everything the dashboard shows: pump, chlorinator and
+// alarm bits from a single seqlock snapshot. Sections that have never been
+// received are null.
+void write_pool_state_json(BufferWriter &out, const pentair_if_ic::PoolState &state, uint32_t generation,
+                           uint32_t now_ms);
+// Same into a plain buffer; returns the length, or 0 if buf was too small
+size_t write_pool_state_json(char *buf, size_t size, const pentair_if_ic::PoolState &state, uint32_t generation,
+                             uint32_t now_ms);
+
+// Schema version, first element of the CBOR snapshot; bump on any layout change
+static const uint8_t POOL_STATE_CBOR_VERSION = 1;
+// Room for the largest CBOR snapshot: 12 bytes of header (array, version,
+// two 5-byte uint32s), 31 for the pump and 17 for the chlorinator (60 bytes)
+static const size_t POOL_STATE_CBOR_SIZE = 64;
+static_assert(POOL_STATE_CBOR_SIZE >= 12 + 31 + 17, "CBOR snapshot buffer too small");
+
+// The same snapshot as a fixed-position CBOR array, for collectors that scrape
+// many controllers; see README for the layout. Flow and pressure stay integer
+// thousandths and the alarm bits stay packed, so nothing is converted or
+// spelled out. Returns the length, or 0 if buf was too small.
+size_t write_pool_state_cbor(uint8_t *buf, size_t size, const pentair_if_ic::PoolState &state, uint32_t generation,
+                             uint32_t now_ms);
+
+// Binary state frames for the WebSocket endpoint: a type byte, the generation
+// (uint32), a uint16 mask of the fields present, then each present field in
+// field order at its fixed width, all little-endian. See README for the field
+// table. A snapshot carries every field received so far, a delta only those
+// that changed.
+enum PoolFrameType : uint8_t {
+  POOL_FRAME_SNAPSHOT = 0x01,
+  POOL_FRAME_DELTA = 0x02,
+  POOL_FRAME_COMMAND_RESULTS = 0x03,  // Server to client, answers POOL_FRAME_COMMANDS
+  POOL_FRAME_COMMANDS = 0x10,         // Client to server
+};
+// Room for a frame with every field (31 bytes)
+static const size_t POOL_STATE_FRAME_SIZE = 32;
+
+// Returns the frame length, or 0 if buf was too small or a delta found no change
+size_t write_pool_state_frame(uint8_t *buf, size_t size, PoolFrameType type, const pentair_if_ic::PoolState &prev,
+                              const pentair_if_ic::PoolState &cur, uint32_t generation);
+
+// Only the fields of cur that differ from prev, with the same names and
+// sections as the full document; a section seen for the first time is written
+// whole. Values are absolute, so applying a delta twice is harmless. Returns
+// false (and writes nothing) if no field changed.
+bool write_pool_state_delta(BufferWriter &out, const pentair_if_ic::PoolState &prev,
+                            const pentair_if_ic::PoolState &cur, uint32_t generation);
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_PENTAIR_IF_IC
@@ -0,0 +1,397 @@
+#include "pool_socket.h"
+
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef USE_ESP_IDF
+#include <unistd.h>
+#endif
+
+namespace esphome {
+namespace custom_web_handler {
+
+static const char *const TAG = "custom_web_handler.socket";
+
+using pentair_if_ic::CommandHandle;
+using pentair_if_ic::CommandResult;
+using pentair_if_ic::PoolCommand;
+using pentair_if_ic::PoolCommandType;
+using pentair_if_ic::PoolState;
+
+PoolSocket::PoolSocket(const char *path, pentair_if_ic::PentairIfIcComponent *pool, uint32_t coalesce_ms,
+                       uint8_t max_clients, uint16_t port)
+    : path_(path),
+      pool_(pool),
+      coalesce_ms_(coalesce_ms),
+      max_clients_(max_clients),
+      port_(port),
+      clients_(new Client[max_clients])
+#ifndef USE_ESP_IDF
+      ,
+      socket_(path)
+#endif
+{
+  for (uint8_t i = 0; i < max_clients; i++)
+    this->clients_[i].owner = this;
+#ifndef USE_ESP_IDF
+  this->socket_.onEvent([this](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg,
+                               uint8_t *data, size_t len) {
+    switch (type) {
+      case WS_EVT_CONNECT: {
+        if (this->open_client_(client->id()) == nullptr) {
+          ESP_LOGW(TAG, "Too many socket clients, closing");
+          client->close();
+          return;
+        }
+        uint8_t buf[POOL_STATE_FRAME_SIZE];
+        size_t frame_len = this->write_snapshot_(buf);
+        client->binary(reinterpret_cast<const char *>(buf), frame_len);
+        break;
+      }
+      case WS_EVT_DISCONNECT:
+        this->close_client_(client->id());
+        break;
+      case WS_EVT_DATA: {
+        // Command frames are a few dozen bytes; anything fragmented is not one
+        auto *info = static_cast<AwsFrameInfo *>(arg);
+        if (!info->final || info->index != 0 || info->len != len || info->opcode != WS_BINARY)
+          return;
+        Client *slot = this->find_client_(client->id());
+        if (slot != nullptr)
+          this->handle_commands_(*slot, data, len);
+        break;
+      }
+      default:
+        break;
+    }
+  });
+#endif
+}
+
+bool PoolSocket::start(web_server_base::WebServerBase *base) {
+#ifdef USE_ESP_IDF
+  (void) base;  // Own server on its own port
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = this->port_;
+  config.ctrl_port = ESP_HTTPD_DEF_CTRL_PORT + 1;  // The main server holds the default
+  config.max_open_sockets = this->max_clients_;
+  config.max_uri_handlers = 1;
+  // A stalled client holds up a broadcast for at most this many seconds, then is dropped
+  config.send_wait_timeout = 1;
+  config.global_user_ctx = this;
+  config.global_user_ctx_free_fn = [](void *) {};  // Not heap memory; httpd must not free it
+  config.close_fn = PoolSocket::close_fn_;
+  if (httpd_start(&this->server_, &config) != ESP_OK) {
+    ESP_LOGE(TAG, "Could not start socket server on port %u", this->port_);
+    return false;
+  }
+  httpd_uri_t uri{};
+  uri.uri = this->path_;
+  uri.method = HTTP_GET;
+  uri.handler = PoolSocket::ws_handler_;
+  uri.user_ctx = this;
+  uri.is_websocket = true;
+  return httpd_register_uri_handler(this->server_, &uri) == ESP_OK;
+#else
+  base->add_handler(&this->socket_);
+  return true;
+#endif
+}
+
+PoolSocket::Client *PoolSocket::find_client_(uint32_t id) {
+  for (uint8_t i = 0; i < this->max_clients_; i++) {
+    if (this->clients_[i].open && this->clients_[i].id == id)
+      return &this->clients_[i];
+  }
+  return nullptr;
+}
+
+PoolSocket::Client *PoolSocket::open_client_(uint32_t id) {
+  for (uint8_t i = 0; i < this->max_clients_; i++) {
+    Client &client = this->clients_[i];
+    // A slot whose batch is still in flight keeps it until the results are sent
+    if (client.open || client.busy.load())
+      continue;
+    client.id = id;
+    client.open = true;
+    this->client_count_++;
+    ESP_LOGD(TAG, "Socket client connected, %u open", this->client_count_.load());
+    return &client;
+  }
+  return nullptr;
+}
+
+void PoolSocket::close_client_(uint32_t id) {
+  Client *client = this->find_client_(id);
+  if (client == nullptr)
+    return;
+  client->open = false;
+  this->client_count_--;
+  ESP_LOGD(TAG, "Socket client gone, %u left", this->client_count_.load());
+}
+
+size_t PoolSocket::write_snapshot_(uint8_t *buf) {
+  PoolState empty{};
+  PoolState state;
+  uint32_t generation = this->pool_->read_state(state);
+  return write_pool_state_frame(buf, POOL_STATE_FRAME_SIZE, POOL_FRAME_SNAPSHOT, empty, state, generation);
+}
+
+void PoolSocket::loop() {
+  uint32_t now = millis();
+#ifndef USE_ESP_IDF
+  // Frees the memory of clients that went away
+  this->socket_.cleanupClients(this->max_clients_);
+#endif
+  if (this->client_count() == 0) {
+    // Frames carry absolute values, so a later delta against the old baseline is still correct
+    this->pending_ = false;
+    return;
+  }
+
+  uint32_t generation = this->pool_->state_generation();
+  if (generation != this->sent_generation_ && !this->pending_) {
+    this->pending_ = true;
+    this->pending_since_ms_ = now;
+  }
+#ifdef USE_ESP_IDF
+  // The previous frame is still being written out; keep coalescing until it is
+  if (this->sending_.load())
+    return;
+#endif
+  if (!this->pending_ || now - this->pending_since_ms_ < this->coalesce_ms_)
+    return;
+
+  this->pending_ = false;
+  PoolState state;
+  this->sent_generation_ = this->pool_->read_state(state);
+  size_t len =
+      write_pool_state_frame(this->frame_, sizeof(this->frame_), POOL_FRAME_DELTA, this->sent_, state, this->sent_generation_);
+  this->sent_ = state;
+  // Only timestamps moved: nothing worth a frame
+  if (len != 0)
+    this->publish_(len);
+}
+
+void PoolSocket::publish_(size_t len) {
+#ifdef USE_ESP_IDF
+  this->frame_len_ = len;
+  this->sending_.store(true);
+  if (httpd_queue_work(this->server_, PoolSocket::broadcast_work_, this) != ESP_OK) {
+    ESP_LOGW(TAG, "Could not queue frame");
+    this->sending_.store(false);
+    return;
+  }
+#else
+  // One message buffer, referenced from every client's queue
+  uint32_t start = micros();
+  AsyncWebSocketMessageBuffer *buffer = this->socket_.makeBuffer(this->frame_, len);
+  if (buffer == nullptr)
+    return;
+  this->socket_.binaryAll(buffer);
+  this->record_fanout_(start);
+#endif
+  this->frames_sent_++;
+}
+
+void PoolSocket::record_fanout_(uint32_t start_us) {
+  this->last_fanout_us_ = micros() - start_us;
+  if (this->last_fanout_us_ > this->max_fanout_us_) {
+    this->max_fanout_us_ = this->last_fanout_us_;
+    ESP_LOGD(TAG, "New fan-out peak: %u us to %u clients", (unsigned) this->max_fanout_us_, this->client_count());
+  }
+}
+
+void PoolSocket::handle_commands_(Client &client, const uint8_t *data, size_t len) {
+  if (len < 4 || data[0] != POOL_FRAME_COMMANDS) {
+    ESP_LOGW(TAG, "Unexpected socket frame (%u bytes)", (unsigned) len);
+    return;
+  }
+  uint16_t seq = data[1] | data[2] << 8;
+  size_t count = data[3];
+  if (count == 0 || count > MAX_BATCH || len != 4 + count * 5) {
+    ESP_LOGW(TAG, "Malformed command frame %u", seq);
+    return;
+  }
+
+  PoolCommand commands[MAX_BATCH];
+  bool valid = true;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *p = data + 4 + i * 5;
+    auto type = static_cast<PoolCommandType>(std::min<uint8_t>(p[0], pentair_if_ic::POOL_COMMAND_TYPE_COUNT));
+    auto value = static_cast<int32_t>(p[1] | p[2] << 8 | p[3] << 16 | (uint32_t) p[4] << 24);
+    // Local programs are numbered 1-4 on the wire, as over HTTP. Adjusted in
+    // uint32_t so INT32_MIN wraps (and then fails validation) instead of overflowing.
+    if (type == pentair_if_ic::POOL_COMMAND_LOCAL_PROGRAM)
+      value = static_cast<int32_t>(static_cast<uint32_t>(value) - 1);
+    commands[i] = {type, value};
+    if (pentair_if_ic::validate_pool_command(commands[i]) != nullptr)
+      valid = false;
+    for (size_t j = 0; j < i; j++) {
+      if (pentair_if_ic::pool_commands_conflict(commands[j].type, type))
+        valid = false;
+    }
+  }
+  if (count > this->pool_->max_batch())
+    valid = false;
+
+  bool idle = false;
+  if (!valid || !client.busy.compare_exchange_strong(idle, true)) {
+    // Nothing queued: every command of the frame reports dropped
+    CommandHandle none[MAX_BATCH]{};
+    uint8_t results[MAX_BATCH];
+    uint8_t error_codes[MAX_BATCH]{};
+    memset(results, pentair_if_ic::COMMAND_DROPPED, sizeof(results));
+    this->send_results_(client.id, seq, count, none, results, error_codes);
+    return;
+  }
+
+  client.seq = seq;
+  client.count = count;
+  client.remaining = count;
+  pentair_if_ic::CommandCallback callbacks[MAX_BATCH];
+  for (size_t i = 0; i < count; i++) {
+    callbacks[i] = [&client, i](CommandResult result, uint8_t error_code) {
+      client.results[i] = result;
+      client.error_codes[i] = error_code;
+      if (--client.remaining == 0)
+        client.owner->complete_batch_(client);
+    };
+  }
+  if (!this->pool_->submit_batch(commands, count, callbacks, client.handles)) {
+    memset(client.results, pentair_if_ic::COMMAND_DROPPED, sizeof(client.results));
+    memset(client.error_codes, 0, sizeof(client.error_codes));
+    this->send_results_(client.id, seq, count, client.handles, client.results, client.error_codes);
+    client.busy.store(false);
+  }
+}
+
+void PoolSocket::complete_batch_(Client &client) {
+#ifdef USE_ESP_IDF
+  if (httpd_queue_work(this->server_, PoolSocket::results_work_, &client) != ESP_OK) {
+    ESP_LOGW(TAG, "Could not queue results of command frame %u", client.seq);
+    client.busy.store(false);
+  }
+#else
+  if (client.open)
+    this->send_results_(client.id, client.seq, client.count, client.handles, client.results, client.error_codes);
+  client.busy.store(false);
+#endif
+}
+
+void PoolSocket::send_results_(uint32_t id, uint16_t seq, size_t count, const CommandHandle *handles,
+                               const uint8_t *results, const uint8_t *error_codes) {
+  uint8_t buf[RESULTS_FRAME_SIZE];
+  uint8_t *p = buf;
+  *p++ = POOL_FRAME_COMMAND_RESULTS;
+  *p++ = seq;
+  *p++ = seq >> 8;
+  *p++ = count;
+  for (size_t i = 0; i < count; i++) {
+    for (uint8_t shift = 0; shift < 32; shift += 8)
+      *p++ = handles[i].id >> shift;
+    *p++ = results[i];
+    *p++ = error_codes[i];
+  }
+  this->send_(id, buf, p - buf);
+}
+
+void PoolSocket::send_(uint32_t id, const uint8_t *data, size_t len) {
+#ifdef USE_ESP_IDF
+  httpd_ws_frame_t frame{};
+  frame.final = true;
+  frame.type = HTTPD_WS_TYPE_BINARY;
+  frame.payload = const_cast<uint8_t *>(data);
+  frame.len = len;
+  if (httpd_ws_send_frame_async(this->server_, id, &frame) != ESP_OK)
+    httpd_sess_trigger_close(this->server_, id);
+#else
+  this->socket_.binary(id, reinterpret_cast<const char *>(data), len);
+#endif
+}
+
+#ifdef USE_ESP_IDF
+esp_err_t PoolSocket::ws_handler_(httpd_req_t *req) {
+  // Everything below runs on the socket server's task, like the work functions,
+  // so client slots need no lock
+  auto *socket = static_cast<PoolSocket *>(req->user_ctx);
+  int fd = httpd_req_to_sockfd(req);
+  if (req->method == HTTP_GET) {
+    // Handshake done; returning an error closes the connection
+    if (socket->open_client_(fd) == nullptr) {
+      ESP_LOGW(TAG, "Too many socket clients, refusing");
+      return ESP_FAIL;
+    }
+    uint8_t buf[POOL_STATE_FRAME_SIZE];
+    httpd_ws_frame_t frame{};
+    frame.final = true;
+    frame.type = HTTPD_WS_TYPE_BINARY;
+    frame.payload = buf;
+    frame.len = socket->write_snapshot_(buf);
+    return httpd_ws_send_frame(req, &frame);
+  }
+
+  uint8_t buf[COMMANDS_FRAME_SIZE];
+  httpd_ws_frame_t frame{};
+  if (httpd_ws_recv_frame(req, &frame, 0) != ESP_OK)
+    return ESP_FAIL;
+  if (frame.len > sizeof(buf)) {
+    ESP_LOGW(TAG, "Socket frame of %u bytes too large, closing", (unsigned) frame.len);
+    return ESP_FAIL;
+  }
+  frame.payload = buf;
+  if (frame.len > 0 && httpd_ws_recv_frame(req, &frame, frame.len) != ESP_OK)
+    return ESP_FAIL;
+  Client *client = socket->find_client_(fd);
+  if (frame.type == HTTPD_WS_TYPE_BINARY && client != nullptr)
+    socket->handle_commands_(*client, buf, frame.len);
+  return ESP_OK;
+}
+
+void PoolSocket::close_fn_(httpd_handle_t server, int fd) {
+  auto *socket = static_cast<PoolSocket *>(httpd_get_global_user_ctx(server));
+  socket->close_client_(fd);
+  close(fd);
+}
+
+void PoolSocket::broadcast_work_(void *arg) {
+  auto *socket = static_cast<PoolSocket *>(arg);
+  uint32_t start = micros();
+  httpd_ws_frame_t frame{};
+  frame.final = true;
+  frame.type = HTTPD_WS_TYPE_BINARY;
+  frame.payload = socket->frame_;
+  frame.len = socket->frame_len_;
+  for (uint8_t i = 0; i < socket->max_clients_; i++) {
+    const Client &client = socket->clients_[i];
+    if (!client.open)
+      continue;
+    // The slot is freed by close_fn_() once the session is torn down
+    if (httpd_ws_send_frame_async(socket->server_, client.id, &frame) != ESP_OK) {
+      ESP_LOGD(TAG, "Socket client %u stalled, dropping", (unsigned) client.id);
+      socket->dropped_clients_++;
+      httpd_sess_trigger_close(socket->server_, client.id);
+    }
+  }
+  socket->record_fanout_(start);
+  socket->sending_.store(false);
+}
+
+void PoolSocket::results_work_(void *arg) {
+  auto *client = static_cast<Client *>(arg);
+  if (client->open) {
+    client->owner->send_results_(client->id, client->seq, client->count, client->handles, client->results,
+                                 client->error_codes);
+  }
+  client->busy.store(false);
+}
+#endif
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_CUSTOM_WEB_POOL_SOCKET
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_CUSTOM_WEB_POOL_SOCKET
+
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "pool_snapshot.h"
+#include <atomic>
+#include <memory>
+
+#ifdef USE_ESP_IDF
+#include <esp_http_server.h>
+#endif
+
+namespace esphome {
+namespace custom_web_handler {
+
+// WebSocket carrying binary state frames (see write_pool_state_frame()) and
+// command batches. loop() coalesces changes like PoolEventStream, builds one
+// delta frame and every client is sent those same bytes.
+//
+// Costs are fixed at construction: max_clients slots, each holding one
+// client's in-flight command batch, plus one shared frame buffer. A client may
+// have one batch in flight; its results frame goes to that client alone.
+//
+// ESP-IDF: httpd only performs the WebSocket handshake for URI handlers
+// registered as such, which web_server_idf's catch-all handler is not, so the
+// socket runs on a second, small httpd instance on its own port. Frames go out
+// on that server's task via httpd_queue_work(), one broadcast at a time.
+// Arduino: AsyncWebSocket on the main server; a broadcast is one shared
+// message buffer queued to every client.
+class PoolSocket {
+ public:
+  PoolSocket(const char *path, pentair_if_ic::PentairIfIcComponent *pool, uint32_t coalesce_ms, uint8_t max_clients,
+             uint16_t port);
+
+  // Starts the socket server (ESP-IDF) or registers with the web server (Arduino)
+  bool start(web_server_base::WebServerBase *base);
+  // Called from the handler's loop()
+  void loop();
+
+  uint8_t client_count() const { return this->client_count_.load(); }
+  // Bytes reserved per client slot; the network stack's socket buffers come on top
+  static size_t client_slot_size() { return sizeof(Client); }
+  uint32_t frames_sent() const { return this->frames_sent_; }
+  // Time spent writing one frame to every client, last and worst so far
+  uint32_t last_fanout_us() const { return this->last_fanout_us_; }
+  uint32_t max_fanout_us() const { return this->max_fanout_us_; }
+  uint32_t dropped_clients() const { return this->dropped_clients_; }
+  uint8_t get_max_clients() const { return this->max_clients_; }
+  uint16_t get_port() const { return this->port_; }
+
+ protected:
+  static const size_t MAX_BATCH = pentair_if_ic::PentairIfIcComponent::MAX_BATCH;
+  // Type, sequence number, count, then type and int32 value per command
+  static const size_t COMMANDS_FRAME_SIZE = 4 + MAX_BATCH * 5;
+  // Type, sequence number, count, then id, result and error code per command
+  static const size_t RESULTS_FRAME_SIZE = 4 + MAX_BATCH * 6;
+
+  struct Client {
+    PoolSocket *owner;
+    uint32_t id;  // Socket fd (ESP-IDF) or AsyncWebSocket client id
+    bool open{false};
+    // Command batch in flight; the slot is not reused until it is answered
+    std::atomic<bool> busy{false};
+    uint16_t seq;
+    uint8_t count;
+    uint8_t remaining;  // Loop task only once submitted
+    pentair_if_ic::CommandHandle handles[MAX_BATCH];
+    uint8_t results[MAX_BATCH];
+    uint8_t error_codes[MAX_BATCH];
+  };
+
+  Client *find_client_(uint32_t id);
+  Client *open_client_(uint32_t id);
+  void close_client_(uint32_t id);
+  // Snapshot frame for a client that just connected; returns its length
+  size_t write_snapshot_(uint8_t *buf);
+  void handle_commands_(Client &client, const uint8_t *data, size_t len);
+  // Called on the loop task by the last command callback of a batch
+  void complete_batch_(Client &client);
+  void send_results_(uint32_t id, uint16_t seq, size_t count, const pentair_if_ic::CommandHandle *handles,
+                     const uint8_t *results, const uint8_t *error_codes);
+  void send_(uint32_t id, const uint8_t *data, size_t len);
+  void publish_(size_t len);
+  void record_fanout_(uint32_t start_us);
+
+  const char *path_;
+  pentair_if_ic::PentairIfIcComponent *pool_;
+  uint32_t coalesce_ms_;
+  uint8_t max_clients_;
+  uint16_t port_;
+  std::unique_ptr<Client[]> clients_;
+  std::atomic<uint8_t> client_count_{0};
+
+  pentair_if_ic::PoolState sent_{};  // State as of the last frame
+  uint32_t sent_generation_{0};
+  bool pending_{false};  // Coalescing window open
+  uint32_t pending_since_ms_{0};
+  uint32_t frames_sent_{0};
+  uint32_t last_fanout_us_{0};
+  uint32_t max_fanout_us_{0};
+  uint32_t dropped_clients_{0};
+
+  uint8_t frame_[POOL_STATE_FRAME_SIZE];  // Written by loop(), read by every client send
+
+#ifdef USE_ESP_IDF
+  static esp_err_t ws_handler_(httpd_req_t *req);
+  static void close_fn_(httpd_handle_t server, int fd);
+  static void broadcast_work_(void *arg);
+  static void results_work_(void *arg);
+
+  httpd_handle_t server_{nullptr};
+  std::atomic<bool> sending_{false};  // frame_ belongs to the server task until cleared
+  size_t frame_len_{0};
+#else
+  AsyncWebSocket socket_;
+#endif
+};
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_CUSTOM_WEB_POOL_SOCKET
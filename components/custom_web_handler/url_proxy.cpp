@@ -0,0 +1,362 @@
+#include "url_proxy.h"
+
+#ifdef USE_ESP_IDF
+
+#include "custom_web_handler.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/log.h"
+#include <esp_http_client.h>
+#include <sdkconfig.h>
+#include <algorithm>
+#include <cstring>
+
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+#include <esp_crt_bundle.h>
+#endif
+
+namespace esphome {
+namespace custom_web_handler {
+
+static const char *const TAG = "custom_web_handler.proxy";
+
+bool UrlProxy::start() {
+  // One waiting slot per worker; more than that and the client is better off retrying
+  this->jobs_ = xQueueCreate(this->max_concurrent_, sizeof(Job));
+  if (this->jobs_ == nullptr)
+    return false;
+
+  for (uint8_t i = 0; i < this->max_concurrent_; i++) {
+    if (xTaskCreate(UrlProxy::worker_task_, "url_proxy", WORKER_STACK_SIZE, this, 5, nullptr) != pdPASS) {
+      ESP_LOGE(TAG, "Could not start proxy worker %u", i);
+      return i > 0;
+    }
+  }
+  return true;
+}
+
+void UrlProxy::add_cache(const Endpoint *endpoint, uint32_t ttl_ms, uint32_t stale_ms) {
+  CacheEntry entry{};
+  entry.endpoint = endpoint;
+  entry.ttl_ms = ttl_ms;
+  entry.stale_ms = stale_ms;
+  this->cache_.push_back(std::move(entry));
+}
+
+UrlProxy::CacheEntry *UrlProxy::find_cache_(const Endpoint *endpoint) {
+  for (auto &entry : this->cache_) {
+    if (entry.endpoint == endpoint)
+      return &entry;
+  }
+  return nullptr;
+}
+
+bool UrlProxy::enqueue_(const Job &job) { return xQueueSend(this->jobs_, &job, 0) == pdTRUE; }
+
+bool UrlProxy::submit(httpd_req_t *req, const Endpoint *endpoint) {
+  if (this->jobs_ == nullptr)
+    return false;
+
+  Job job{nullptr, endpoint, millis()};
+  CacheEntry *entry = this->find_cache_(endpoint);
+  if (entry != nullptr) {
+    std::shared_ptr<CachedBody> body;
+    bool revalidate = false;
+    {
+      LockGuard guard(this->cache_lock_);
+      if (entry->body != nullptr) {
+        uint32_t age = job.queued_ms - entry->body->fetched_ms;
+        if (age < entry->ttl_ms + entry->stale_ms) {
+          body = entry->body;
+          revalidate = age >= entry->ttl_ms && !entry->fetching;
+        }
+      }
+      if (body == nullptr && entry->fetching) {
+        // A fetch is already on its way; wait for it rather than starting another
+        if (this->parked_ == MAX_WAITERS || httpd_req_async_handler_begin(req, &job.req) != ESP_OK)
+          return false;
+        entry->waiting_since_ms[entry->waiter_count] = job.queued_ms;
+        entry->waiters[entry->waiter_count++] = job.req;
+        this->parked_++;
+        return true;
+      }
+      if (body == nullptr || revalidate)
+        entry->fetching = true;
+    }
+
+    if (body != nullptr) {
+      // Fresh, or stale within the window: answer now, refresh in the background
+      if (revalidate && !this->enqueue_(job))
+        this->finish_fetch_(entry, nullptr, true);
+      send_body_(req, *endpoint, *body);
+      return true;
+    }
+  }
+
+  if (httpd_req_async_handler_begin(req, &job.req) == ESP_OK) {
+    if (this->enqueue_(job))
+      return true;
+    // Nobody will answer the copy; release it and let the caller answer the original
+    httpd_req_async_handler_complete(job.req);
+  }
+  if (entry != nullptr)
+    this->finish_fetch_(entry, nullptr, true);
+  return false;
+}
+
+void UrlProxy::worker_task_(void *arg) {
+  auto *proxy = static_cast<UrlProxy *>(arg);
+  Job job;
+  while (true) {
+    // Wakes up at least every SWEEP_INTERVAL_MS so parked waiters cannot outlive their timeout
+    if (xQueueReceive(proxy->jobs_, &job, pdMS_TO_TICKS(SWEEP_INTERVAL_MS)) == pdTRUE) {
+      proxy->run_(job);
+      if (job.req != nullptr)
+        httpd_req_async_handler_complete(job.req);
+    }
+    proxy->expire_waiters_();
+  }
+}
+
+void UrlProxy::send_error_(httpd_req_t *req, const char *status, const char *message) {
+  httpd_resp_set_status(req, status);
+  httpd_resp_set_type(req, "text/plain");
+  httpd_resp_send(req, message, HTTPD_RESP_USE_STRLEN);
+}
+
+void UrlProxy::send_body_(httpd_req_t *req, const Endpoint &endpoint, const CachedBody &body) {
+  char age[12];
+  snprintf(age, sizeof(age), "%u", (unsigned) ((millis() - body.fetched_ms) / 1000));
+  httpd_resp_set_status(req, HTTPD_200);
+  httpd_resp_set_type(req, endpoint.content_type);
+  httpd_resp_set_hdr(req, "Age", age);
+  httpd_resp_send(req, reinterpret_cast<const char *>(body.data), body.size);
+}
+
+void UrlProxy::run_(Job &job) {
+  CacheEntry *entry = this->find_cache_(job.endpoint);
+  bool failed = false;
+  std::shared_ptr<CachedBody> body = this->relay_(job, entry != nullptr ? this->cache_budget_ : 0, &failed);
+  if (entry != nullptr)
+    this->finish_fetch_(entry, std::move(body), failed);
+}
+
+std::shared_ptr<UrlProxy::CachedBody> UrlProxy::relay_(Job &job, size_t cache_limit, bool *failed) {
+  const Endpoint &endpoint = *job.endpoint;
+  *failed = true;
+
+  // The client has already waited as long as it would for the upstream itself
+  if (job.req != nullptr && millis() - job.queued_ms > this->timeout_ms_) {
+    ESP_LOGW(TAG, "%s: timed out waiting for a worker", endpoint.path);
+    send_error_(job.req, "504 Gateway Timeout", "Proxy busy");
+    return nullptr;
+  }
+
+  esp_http_client_config_t config{};
+  config.url = endpoint.content;
+  config.method = HTTP_METHOD_GET;
+  config.timeout_ms = this->timeout_ms_;
+#ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+  config.crt_bundle_attach = esp_crt_bundle_attach;
+#endif
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == nullptr) {
+    if (job.req != nullptr)
+      send_error_(job.req, "500 Internal Server Error", "Out of memory");
+    return nullptr;
+  }
+
+  uint32_t start = millis();
+  esp_err_t err = esp_http_client_open(client, 0);
+  if (err == ESP_OK && esp_http_client_fetch_headers(client) < 0 && !esp_http_client_is_chunked_response(client))
+    err = ESP_FAIL;
+  if (err != ESP_OK) {
+    bool timed_out = millis() - start >= this->timeout_ms_;
+    ESP_LOGW(TAG, "%s: upstream %s (%s)", endpoint.path, timed_out ? "timed out" : "failed",
+             esp_err_to_name(err));
+    if (job.req != nullptr)
+      send_error_(job.req, timed_out ? "504 Gateway Timeout" : "502 Bad Gateway", "Failed to fetch URL");
+    esp_http_client_cleanup(client);
+    return nullptr;
+  }
+
+  int status = esp_http_client_get_status_code(client);
+  if (status != 200) {
+    ESP_LOGW(TAG, "%s: upstream answered HTTP %d", endpoint.path, status);
+    if (job.req != nullptr)
+      send_error_(job.req, "502 Bad Gateway", "HTTP Error");
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return nullptr;
+  }
+
+  // Relay the body as it arrives, one read buffer at a time, so memory use does not
+  // depend on the upstream's size. The first read happens before our headers go out
+  // so an upstream that fails right away still gets a clean 502.
+  char buffer[READ_CHUNK_SIZE];
+  int len = esp_http_client_read(client, buffer, sizeof(buffer));
+  if (len < 0) {
+    ESP_LOGW(TAG, "%s: upstream read failed", endpoint.path);
+    if (job.req != nullptr)
+      send_error_(job.req, "502 Bad Gateway", "Failed to fetch URL");
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return nullptr;
+  }
+
+  // A copy for the cache is kept as long as it fits the budget
+  std::shared_ptr<CachedBody> body;
+  if (cache_limit != 0 && esp_http_client_get_content_length(client) <= (int64_t) cache_limit)
+    body = std::make_shared<CachedBody>();
+
+  if (job.req != nullptr) {
+    httpd_resp_set_status(job.req, HTTPD_200);
+    httpd_resp_set_type(job.req, endpoint.content_type);
+  }
+  size_t relayed = 0;
+  bool client_ok = job.req != nullptr;
+  while (len > 0) {
+    if (body != nullptr && !body->append(buffer, len, cache_limit))
+      body.reset();
+    if (client_ok && httpd_resp_send_chunk(job.req, buffer, len) != ESP_OK) {
+      ESP_LOGW(TAG, "%s: client went away after %u bytes", endpoint.path, (unsigned) relayed);
+      client_ok = false;
+    }
+    // Nobody left to deliver to: stop unless the cache still wants the rest
+    if (!client_ok && body == nullptr)
+      break;
+    relayed += len;
+    len = esp_http_client_read(client, buffer, sizeof(buffer));
+  }
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+
+  if (len < 0) {
+    // Too late for an error status. Closing the session without the terminating
+    // chunk tells the client the body is incomplete; a keep-alive client would
+    // otherwise wait for the rest forever.
+    ESP_LOGW(TAG, "%s: upstream read failed after %u bytes", endpoint.path, (unsigned) relayed);
+    if (client_ok)
+      httpd_sess_trigger_close(job.req->handle, httpd_req_to_sockfd(job.req));
+    return nullptr;
+  }
+  if (client_ok)
+    httpd_resp_send_chunk(job.req, nullptr, 0);
+  ESP_LOGD(TAG, "%s: relayed %u bytes in %u ms%s", endpoint.path, (unsigned) relayed,
+           (unsigned) (millis() - job.queued_ms), body != nullptr ? ", cached" : "");
+  *failed = false;
+  if (body != nullptr)
+    body->fetched_ms = millis();
+  return body;
+}
+
+void UrlProxy::finish_fetch_(CacheEntry *entry, std::shared_ptr<CachedBody> body, bool failed) {
+  httpd_req_t *waiters[MAX_WAITERS];
+  uint8_t waiter_count;
+  {
+    LockGuard guard(this->cache_lock_);
+    if (!failed) {
+      // New content upstream: the old body is outdated whether or not the new one fits
+      if (entry->body != nullptr) {
+        this->cache_bytes_ -= entry->body->size;
+        entry->body.reset();
+      }
+      if (body != nullptr) {
+        // Make room within the budget, oldest bodies first
+        while (this->cache_bytes_ + body->size > this->cache_budget_) {
+          CacheEntry *oldest = nullptr;
+          for (auto &other : this->cache_) {
+            if (other.body != nullptr && (oldest == nullptr || other.body->fetched_ms < oldest->body->fetched_ms))
+              oldest = &other;
+          }
+          this->cache_bytes_ -= oldest->body->size;
+          oldest->body.reset();
+        }
+        entry->body = body;
+        this->cache_bytes_ += body->size;
+      }
+    }
+    entry->fetching = false;
+    waiter_count = entry->waiter_count;
+    memcpy(waiters, entry->waiters, waiter_count * sizeof(httpd_req_t *));
+    entry->waiter_count = 0;
+    this->parked_ -= waiter_count;
+  }
+
+  for (uint8_t i = 0; i < waiter_count; i++) {
+    if (body != nullptr) {
+      send_body_(waiters[i], *entry->endpoint, *body);
+    } else if (failed) {
+      send_error_(waiters[i], "502 Bad Gateway", "Failed to fetch URL");
+    } else {
+      // Fetched fine but too big to keep: each waiter needs its own fetch
+      Job job{waiters[i], entry->endpoint, millis()};
+      if (this->enqueue_(job))
+        continue;
+      send_error_(waiters[i], "503 Service Unavailable", "Proxy busy");
+    }
+    httpd_req_async_handler_complete(waiters[i]);
+  }
+}
+
+void UrlProxy::expire_waiters_() {
+  httpd_req_t *expired[MAX_WAITERS];
+  uint8_t count = 0;
+  uint32_t now = millis();
+  {
+    LockGuard guard(this->cache_lock_);
+    if (this->parked_ == 0)
+      return;
+    for (auto &entry : this->cache_) {
+      uint8_t kept = 0;
+      for (uint8_t i = 0; i < entry.waiter_count; i++) {
+        if (now - entry.waiting_since_ms[i] > this->timeout_ms_) {
+          expired[count++] = entry.waiters[i];
+        } else {
+          entry.waiters[kept] = entry.waiters[i];
+          entry.waiting_since_ms[kept++] = entry.waiting_since_ms[i];
+        }
+      }
+      entry.waiter_count = kept;
+    }
+    this->parked_ -= count;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    send_error_(expired[i], "504 Gateway Timeout", "Upstream too slow");
+    httpd_req_async_handler_complete(expired[i]);
+  }
+  if (count != 0)
+    ESP_LOGW(TAG, "%u requests timed out waiting for a fetch", count);
+}
+
+UrlProxy::CachedBody::~CachedBody() {
+  if (this->data != nullptr)
+    RAMAllocator<uint8_t>().deallocate(this->data, this->capacity);
+}
+
+bool UrlProxy::CachedBody::append(const char *buf, size_t len, size_t limit) {
+  if (this->size + len > limit)
+    return false;
+  if (this->size + len > this->capacity) {
+    // RAMAllocator prefers PSRAM and falls back to internal RAM
+    RAMAllocator<uint8_t> allocator;
+    size_t capacity = std::min(std::max(std::max(this->capacity * 2, this->size + len), READ_CHUNK_SIZE), limit);
+    uint8_t *data = allocator.allocate(capacity);
+    if (data == nullptr)
+      return false;
+    if (this->data != nullptr) {
+      memcpy(data, this->data, this->size);
+      allocator.deallocate(this->data, this->capacity);
+    }
+    this->data = data;
+    this->capacity = capacity;
+  }
+  memcpy(this->data + this->size, buf, len);
+  this->size += len;
+  return true;
+}
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_ESP_IDF
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+
+#ifdef USE_ESP_IDF
+
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace esphome {
+namespace custom_web_handler {
+
+struct Endpoint;
+
+// Fetches url: endpoints off the web server task. The request is detached with
+// httpd_req_async_handler_begin() and handed to a small pool of worker tasks
+// running esp_http_client, so a slow upstream only ties up its own worker. The
+// number of workers is the concurrency cap; a bounded queue holds requests
+// waiting for one, and anything beyond that is refused with 503.
+//
+// Endpoints with a TTL keep their last body in a shared byte budget (PSRAM when
+// available). Fresh hits are answered on the server task without an upstream
+// round trip; within the stale window the old body is served while one worker
+// revalidates; misses that arrive while a fetch is running wait for it instead
+// of starting their own.
+class UrlProxy {
+ public:
+  void set_timeout(uint32_t timeout_ms) { this->timeout_ms_ = timeout_ms; }
+  void set_max_concurrent(uint8_t max_concurrent) { this->max_concurrent_ = max_concurrent; }
+  uint32_t get_timeout() const { return this->timeout_ms_; }
+  uint8_t get_max_concurrent() const { return this->max_concurrent_; }
+  void set_cache_size(size_t cache_size) { this->cache_budget_ = cache_size; }
+  size_t get_cache_size() const { return this->cache_budget_; }
+  // Cache responses of endpoint; must be called before start()
+  void add_cache(const Endpoint *endpoint, uint32_t ttl_ms, uint32_t stale_ms);
+
+  // Creates the queue and worker tasks; false if out of memory
+  bool start();
+  // Takes ownership of req and answers it from a worker. Returns false if the
+  // proxy is saturated; req is then untouched and the caller must answer it.
+  bool submit(httpd_req_t *req, const Endpoint *endpoint);
+
+ protected:
+  struct Job {
+    httpd_req_t *req;  // Async copy, owned by the worker until completed; nullptr = revalidate only
+    const Endpoint *endpoint;
+    uint32_t queued_ms;
+  };
+
+  static const uint32_t WORKER_STACK_SIZE = 8192;  // Room for TLS to https upstreams
+  static constexpr size_t READ_CHUNK_SIZE = 1024;
+  // Collapsed misses parked across all endpoints, each holding an httpd socket;
+  // answered with 504 once they have waited timeout_ms
+  static const uint8_t MAX_WAITERS = 8;
+  static const uint32_t SWEEP_INTERVAL_MS = 1000;
+
+  // Immutable once published; shared so a body being sent survives its replacement
+  struct CachedBody {
+    uint8_t *data{nullptr};
+    size_t size{0};
+    size_t capacity{0};
+    uint32_t fetched_ms{0};
+    ~CachedBody();
+    // Grows the buffer up to limit bytes; false if it would not fit
+    bool append(const char *buf, size_t len, size_t limit);
+  };
+
+  struct CacheEntry {
+    const Endpoint *endpoint;
+    uint32_t ttl_ms;
+    uint32_t stale_ms;  // Stale-while-revalidate window after the TTL
+    std::shared_ptr<CachedBody> body;
+    bool fetching{false};  // One upstream fetch at a time
+    uint8_t waiter_count{0};
+    httpd_req_t *waiters[MAX_WAITERS];  // Async copies answered when the fetch lands
+    uint32_t waiting_since_ms[MAX_WAITERS];
+  };
+
+  static void worker_task_(void *arg);
+  void run_(Job &job);
+  // Fetches and relays to job.req (if any); returns a cache copy if it fit cache_limit
+  std::shared_ptr<CachedBody> relay_(Job &job, size_t cache_limit, bool *failed);
+  bool enqueue_(const Job &job);
+  CacheEntry *find_cache_(const Endpoint *endpoint);
+  // Publishes a fetch result and answers the collapsed waiters. body is nullptr if
+  // the fetch failed or the response was too large to keep.
+  void finish_fetch_(CacheEntry *entry, std::shared_ptr<CachedBody> body, bool failed);
+  // Answers waiters whose fetch is taking longer than timeout_ms
+  void expire_waiters_();
+  static void send_body_(httpd_req_t *req, const Endpoint &endpoint, const CachedBody &body);
+  static void send_error_(httpd_req_t *req, const char *status, const char *message);
+
+  uint32_t timeout_ms_{10000};
+  uint8_t max_concurrent_{2};
+  QueueHandle_t jobs_{nullptr};
+
+  Mutex cache_lock_;  // Guards cache_ entries and cache_bytes_
+  std::vector<CacheEntry> cache_;
+  size_t cache_budget_{65536};
+  size_t cache_bytes_{0};
+  uint8_t parked_{0};  // Waiters across all entries
+};
+
+}  // namespace custom_web_handler
+}  // namespace esphome
+
+#endif  // USE_ESP_IDF
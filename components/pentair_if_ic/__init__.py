@@ -13,13 +13,66 @@ pentair_if_ic_ns = cg.esphome_ns.namespace("pentair_if_ic")
 PentairIfIcComponent = pentair_if_ic_ns.class_("PentairIfIcComponent", cg.PollingComponent, uart.UARTDevice)
 
 CONF_PENTAIR_IF_IC_ID = "pentair_if_ic_id"
+CONF_TX_QUEUE = "tx_queue"
+CONF_CONTROL = "control"
+CONF_POLL = "poll"
+CONF_CAPACITY = "capacity"
+CONF_DROP_POLICY = "drop_policy"
+CONF_MAX_AGE = "max_age"
+CONF_TX_STARVATION_THRESHOLD = "tx_starvation_threshold"
+CONF_RX_FRAME_GAP = "rx_frame_gap"
+CONF_ECHO_SUPPRESSION = "echo_suppression"
+CONF_TRANSCEIVER_ECHO = "transceiver_echo"
 
-CONFIG_SCHEMA = cv.Schema(
+TxPriority = pentair_if_ic_ns.enum("TxPriority")
+DropPolicy = pentair_if_ic_ns.enum("DropPolicy")
+DROP_POLICIES = {
+    "DROP_OLDEST": DropPolicy.DROP_OLDEST,
+    "DROP_NEWEST": DropPolicy.DROP_NEWEST,
+}
+
+
+def tx_class_schema(capacity, policy, max_age):
+    return cv.Schema(
+        {
+            cv.Optional(CONF_CAPACITY, default=capacity): cv.int_range(min=1, max=64),
+            cv.Optional(CONF_DROP_POLICY, default=policy): cv.enum(DROP_POLICIES, upper=True, space="_"),
+            cv.Optional(CONF_MAX_AGE, default=max_age): cv.positive_time_period_milliseconds,
+        }
+    )
+
+
+TX_QUEUE_SCHEMA = cv.Schema(
     {
-        cv.GenerateID(): cv.declare_id(PentairIfIcComponent),
-        cv.Optional(CONF_FLOW_CONTROL_PIN): pins.gpio_output_pin_schema,
+        cv.Optional(CONF_CONTROL, default={}): tx_class_schema(8, "DROP_OLDEST", "30s"),
+        cv.Optional(CONF_POLL, default={}): tx_class_schema(4, "DROP_NEWEST", "5s"),
     }
-).extend(uart.UART_DEVICE_SCHEMA).extend(cv.polling_component_schema("30s"))
+)
+
+
+def validate_transceiver_echo(config):
+    if config[CONF_ECHO_SUPPRESSION] and not config.get(CONF_TRANSCEIVER_ECHO, True):
+        raise cv.Invalid(f"'{CONF_ECHO_SUPPRESSION}' requires a transceiver that echoes")
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(PentairIfIcComponent),
+            cv.Optional(CONF_FLOW_CONTROL_PIN): pins.gpio_output_pin_schema,
+            cv.Optional(CONF_TX_QUEUE, default={}): TX_QUEUE_SCHEMA,
+            cv.Optional(CONF_TX_STARVATION_THRESHOLD, default="2s"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_RX_FRAME_GAP, default="10ms"): cv.All(
+                cv.positive_time_period_microseconds,
+                cv.Range(min=cv.TimePeriod(milliseconds=2), max=cv.TimePeriod(milliseconds=100)),
+            ),
+            cv.Optional(CONF_ECHO_SUPPRESSION, default=False): cv.boolean,
+            cv.Optional(CONF_TRANSCEIVER_ECHO): cv.boolean,
+        }
+    ).extend(uart.UART_DEVICE_SCHEMA).extend(cv.polling_component_schema("30s")),
+    validate_transceiver_echo,
+)
 
 FINAL_VALIDATE_SCHEMA = uart.final_validate_device_schema(
     "pentair_if_ic",
@@ -37,7 +90,18 @@ async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
     await uart.register_uart_device(var, config)
+    # Lets other components (e.g. custom_web_handler) compile their pool state support
+    cg.add_define("USE_PENTAIR_IF_IC")
 
     if CONF_FLOW_CONTROL_PIN in config:
         pin = await gpio_pin_expression(config[CONF_FLOW_CONTROL_PIN])
         cg.add(var.set_flow_control_pin(pin))
+
+    tx_queue = config[CONF_TX_QUEUE]
+    for key, priority in ((CONF_CONTROL, TxPriority.TX_PRIORITY_CONTROL), (CONF_POLL, TxPriority.TX_PRIORITY_POLL)):
+        cls = tx_queue[key]
+        cg.add(var.set_tx_queue_limit(priority, cls[CONF_CAPACITY], cls[CONF_DROP_POLICY], cls[CONF_MAX_AGE]))
+    cg.add(var.set_tx_starvation_threshold(config[CONF_TX_STARVATION_THRESHOLD]))
+    cg.add(var.set_rx_frame_gap(config[CONF_RX_FRAME_GAP]))
+    cg.add(var.set_echo_suppression(config[CONF_ECHO_SUPPRESSION]))
+    cg.add(var.set_transceiver_echo(config.get(CONF_TRANSCEIVER_ECHO, config[CONF_ECHO_SUPPRESSION])))
@@ -24,6 +24,9 @@ CONF_LOW_VOLTS = "low_volts"
 CONF_LOW_TEMP = "low_temp"
 CONF_CHECK_PCB = "check_pcb"
 
+# Bus diagnostics
+CONF_TX_STARVED = "tx_starved"
+
 CONFIG_SCHEMA = cv.Schema(
     {
         cv.GenerateID(CONF_PENTAIR_IF_IC_ID): cv.use_id(PentairIfIcComponent),
@@ -72,6 +75,11 @@ CONFIG_SCHEMA = cv.Schema(
             entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
             icon=ICON_BUG,
         ),
+        # Bus diagnostics
+        cv.Optional(CONF_TX_STARVED): binary_sensor.binary_sensor_schema(
+            device_class=DEVICE_CLASS_PROBLEM,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
     }
 )
 
@@ -116,3 +124,8 @@ async def to_code(config):
     if check_pcb_config := config.get(CONF_CHECK_PCB):
         sens = await binary_sensor.new_binary_sensor(check_pcb_config)
         cg.add(var.set_check_pcb_binary_sensor(sens))
+    
+    # Bus diagnostics
+    if tx_starved_config := config.get(CONF_TX_STARVED):
+        sens = await binary_sensor.new_binary_sensor(tx_starved_config)
+        cg.add(var.set_tx_starved_binary_sensor(sens))
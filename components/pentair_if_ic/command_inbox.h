@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace esphome {
+namespace pentair_if_ic {
+
+// Bounded lock-free multi-producer / single-consumer ring (Vyukov style).
+// Any task may push(); only the component's loop() may pop(). Each cell
+// carries its own sequence number so producers claim slots with one CAS and
+// publish them independently, and the consumer never blocks a producer.
+template<typename T, size_t N> class MpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "MpscRing size must be a power of two");
+
+ public:
+  MpscRing() {
+    for (size_t i = 0; i < N; i++)
+      this->cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // Returns false if the ring is full
+  bool push(const T &value) {
+    uint32_t pos = this->head_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = this->cells_[pos & (N - 1)];
+      uint32_t seq = cell.seq.load(std::memory_order_acquire);
+      int32_t dif = (int32_t) (seq - pos);
+      if (dif == 0) {
+        if (this->head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = this->head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Claims count consecutive slots with one CAS, so the values are popped in
+  // order with no other producer's entries in between. All or nothing: returns
+  // false, leaving values untouched, if the ring lacks room for every one.
+  bool push_batch(T *values, size_t count) {
+    if (count == 0 || count > N)
+      return count == 0;
+    uint32_t pos = this->head_.load(std::memory_order_relaxed);
+    for (;;) {
+      // The consumer frees cells in order, so if the last one is free for this
+      // lap, so are all the ones before it
+      uint32_t last = pos + count - 1;
+      uint32_t seq = this->cells_[last & (N - 1)].seq.load(std::memory_order_acquire);
+      int32_t dif = (int32_t) (seq - last);
+      if (dif == 0) {
+        if (this->head_.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+          for (size_t i = 0; i < count; i++) {
+            Cell &cell = this->cells_[(pos + i) & (N - 1)];
+            cell.value = std::move(values[i]);
+            cell.seq.store(pos + i + 1, std::memory_order_release);
+          }
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = this->head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Consumer only. Returns false if nothing is ready.
+  bool pop(T &out) {
+    Cell &cell = this->cells_[this->tail_ & (N - 1)];
+    uint32_t seq = cell.seq.load(std::memory_order_acquire);
+    if ((int32_t) (seq - (this->tail_ + 1)) < 0)
+      return false;
+    // Moved out and reset, so the cell does not keep a callback's captures
+    // alive until a producer laps the ring
+    out = std::move(cell.value);
+    cell.value = T();
+    cell.seq.store(this->tail_ + N, std::memory_order_release);
+    this->tail_++;
+    return true;
+  }
+
+ protected:
+  struct Cell {
+    std::atomic<uint32_t> seq;
+    T value;
+  };
+
+  Cell cells_[N];
+  std::atomic<uint32_t> head_{0};
+  uint32_t tail_{0};
+};
+
+}  // namespace pentair_if_ic
+}  // namespace esphome
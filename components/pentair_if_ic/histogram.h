@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace pentair_if_ic {
+
+// Fixed-bucket histogram for monitoring (see BusStats). bounds holds N
+// ascending upper bounds; bucket(i) counts samples <= bound(i) that did not fit
+// a lower bucket, and bucket(N) those above the last bound. One task records;
+// another may read it mid-record and see count() one ahead of the buckets,
+// which scrapers tolerate.
+template<size_t N> class Histogram {
+ public:
+  explicit Histogram(const uint32_t (&bounds)[N]) : bounds_(bounds) {}
+
+  void record(uint32_t value) {
+    size_t i = 0;
+    while (i < N && value > this->bounds_[i])
+      i++;
+    this->buckets_[i]++;
+    this->sum_ += value;
+    this->count_++;
+    if (value > this->max_)
+      this->max_ = value;
+  }
+
+  static constexpr size_t size() { return N; }
+  uint32_t bound(size_t i) const { return this->bounds_[i]; }
+  uint32_t bucket(size_t i) const { return this->buckets_[i]; }
+  uint32_t count() const { return this->count_; }
+  // 64 bits so microsecond sums do not wrap; a reader on another task may see
+  // a torn value on 32-bit targets for the one scrape it races with
+  uint64_t sum() const { return this->sum_; }
+  uint32_t max() const { return this->max_; }
+
+ protected:
+  const uint32_t *bounds_;
+  uint32_t buckets_[N + 1]{};
+  uint64_t sum_{0};
+  uint32_t count_{0};
+  uint32_t max_{0};
+};
+
+}  // namespace pentair_if_ic
+}  // namespace esphome
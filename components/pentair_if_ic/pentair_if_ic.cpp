@@ -1,6 +1,8 @@
 #include "pentair_if_ic.h"
 #include "esphome/core/log.h"
 #include <cinttypes>
+#include <algorithm>
+#include <cstring>
 
 namespace esphome {
 namespace pentair_if_ic {
@@ -23,6 +25,12 @@ void PentairIfIcComponent::setup() {
   this->ic_last_recv_timestamp_ = millis();
   this->ic_last_loop_timestamp_ = millis() - 31000;  // Allow immediate first poll
   this->last_received_byte_millis_ = millis();
+  this->last_rx_us_ = micros();
+  
+  // 8N1: 10 bits on the wire per byte. The driver hands bytes over when its FIFO
+  // threshold fills or the line idles for a couple of symbols; allow 10 byte times.
+  this->byte_time_us_ = 10000000UL / this->parent_->get_baud_rate();
+  this->rx_latency_us_ = this->byte_time_us_ * 10;
 }
 
 void PentairIfIcComponent::dump_config() {
@@ -44,92 +52,107 @@ void PentairIfIcComponent::dump_config() {
   LOG_TEXT_SENSOR("  ", "IF_ProgramTextSensor", this->if_program_);
   
   LOG_PIN("  Flow Control Pin: ", this->flow_control_pin_);
+  for (size_t i = 0; i < TX_PRIORITY_COUNT; i++) {
+    const TxClass &cls = this->tx_classes_[i];
+    ESP_LOGCONFIG(TAG, "  %s queue: capacity %u, %s, max age %u ms", tx_priority_to_str(static_cast<TxPriority>(i)),
+                  (unsigned) cls.capacity, cls.policy == DROP_OLDEST ? "drop oldest" : "drop newest",
+                  (unsigned) cls.max_age_ms);
+  }
+  LOG_SENSOR("  ", "TxQueueHighWaterSensor", this->tx_queue_high_water_sensor_);
+  LOG_SENSOR("  ", "TxDroppedSensor", this->tx_dropped_sensor_);
+  LOG_SENSOR("  ", "TxExpiredSensor", this->tx_expired_sensor_);
+  ESP_LOGCONFIG(TAG, "  RX frame gap: %u us", (unsigned) this->rx_frame_gap_us_);
+  ESP_LOGCONFIG(TAG, "  Transceiver echo: %s", YESNO(this->transceiver_echo_));
+  ESP_LOGCONFIG(TAG, "  Echo suppression: %s", YESNO(this->echo_suppression_));
+  LOG_SENSOR("  ", "TxCollisionsSensor", this->tx_collisions_sensor_);
+  ESP_LOGCONFIG(TAG, "  TX starvation threshold: %u ms", (unsigned) this->tx_starvation_threshold_ms_);
+  LOG_BINARY_SENSOR("  ", "TxStarvedBinarySensor", this->tx_starved_binary_sensor_);
 }
 
 void PentairIfIcComponent::loop() {
-  // Read all bytes from UART into common buffer
-  while (this->available() > 0) {
-    uint8_t c;
-    this->read_byte(&c);
+  uint32_t loop_start_us = micros();
+  
+  // Read all bytes from UART into common buffer, one chunk at a time. Each
+  // chunk is stamped with micros() so idle gaps on the line can delimit frames.
+  uint8_t chunk[RX_CHUNK_SIZE];
+  int avail;
+  while ((avail = this->available()) > 0) {
+    size_t n = std::min<size_t>(avail, RX_CHUNK_SIZE);
+    this->read_array(chunk, n);
+    this->last_rx_us_ = micros();
     this->last_received_byte_millis_ = millis();
-    ESP_LOGV(TAG, "Received byte: %02X, buffer size: %d", c, this->rx_buffer_.size());
     
-    // Check if we're currently building a packet
-    if (!this->rx_buffer_.empty()) {
-      // Continue building current packet (either IntelliFlo or IntelliChlor)
-      this->rx_buffer_.push_back(c);
-      
-      // Try to parse based on first byte
-      if (this->rx_buffer_[0] == 0xFF) {
-        // IntelliFlo packet
-        ESP_LOGV(TAG, "Validating IF packet, buffer size: %d", this->rx_buffer_.size());
-        if (!this->validate_if_received_message_()) {
-          this->rx_buffer_.clear();
-        }
-      } else if (this->rx_buffer_[0] == 0x10) {
-        // IntelliChlor packet
-        ESP_LOGV(TAG, "Parsing IC packet, buffer size: %d", this->rx_buffer_.size());
-        if (!this->parse_ic_packet_()) {
-          // Continue building
-        } else {
-          // Packet complete, clear buffer
-          this->rx_buffer_.clear();
-        }
-      } else {
-        // Invalid packet start
-        ESP_LOGW(TAG, "Invalid packet start: %02X", this->rx_buffer_[0]);
-        this->rx_buffer_.clear();
+    for (size_t i = 0; i < n; i++) {
+      if (this->echo_len_ == 0 || !this->match_echo_(chunk[i])) {
+        this->stats_.rx_bytes++;
+        this->feed_rx_byte_(chunk[i]);
       }
     }
-    // Start new packet - determine type by first byte
-    else if (c == 0xFF || c == 0x10) {
-      // Start new packet (IntelliFlo or IntelliChlor)
-      ESP_LOGD(TAG, "Starting new packet with byte: %02X", c);
-      this->rx_buffer_.push_back(c);
-    }
-    // Unknown/noise - ignore
-    else {
-      ESP_LOGV(TAG, "Ignoring unexpected byte: %02X", c);
-    }
+  }
+  
+  // Our frame has had time to go out and come back; whatever did not match by now
+  // was not an echo.
+  if (this->echo_len_ != 0 &&
+      micros() - this->echo_armed_us_ > this->echo_len_ * this->byte_time_us_ + this->rx_latency_us_) {
+    this->rx_missing_echoes_++;
+    this->abandon_echo_();
+  }
+  
+  // The UART is drained, so nothing arrived since the last chunk apart from what the
+  // driver is still holding (at most rx_latency_us_). A partial frame followed by a
+  // longer silence is a garbage tail: drop it now instead of letting it swallow the
+  // start of the next frame or waiting for the 64 byte overflow.
+  if (!this->rx_buffer_.empty()) {
+    uint32_t idle_us = micros() - this->last_rx_us_;
+    if (idle_us > this->rx_frame_gap_us_ + this->rx_latency_us_)
+      this->discard_partial_frame_(idle_us);
   }
   
   // IntelliChlor processing - only from update(), not from loop()
   // Remove ic_run_again_ logic to prevent rapid polling
   
-  // Process unified send queue
+  // Pick up commands posted from any task
+  this->drain_inbox_();
+  
+  // Process send queues
   auto since_last_cmd = millis() - this->ic_last_command_timestamp_;
   auto since_last_tx = millis() - this->last_tx_millis_;
   auto since_last_rx = millis() - this->last_received_byte_millis_;
   
+  // Continuous foreign traffic or noise can keep since_last_rx low forever. Once the
+  // oldest command has waited past the starvation threshold, transmit in the gaps
+  // between frames instead of waiting for a fully idle bus.
+  this->update_tx_starvation_();
+  bool bus_idle = since_last_rx > 100;
+  bool frame_gap = this->tx_starved_ && this->rx_buffer_.empty() && since_last_rx > TX_SLOT_GAP_MS;
+  
   // Only send if enough time has passed since ANY transmission
-  if (since_last_cmd > 100 && since_last_tx > 150 && since_last_rx > 100) {
-    if (!this->tx_queue_.empty()) {
-      auto packet = this->tx_queue_.front();
-      auto type = std::get<0>(packet);
-      auto retries = std::get<1>(packet);
-      auto attempts = std::get<2>(packet);
-      auto data = std::get<3>(packet);
-      
-      attempts++;
+  if (since_last_cmd > 100 && since_last_tx > 150 && (bus_idle || frame_gap)) {
+    if (!this->in_flight_active_)
+      this->in_flight_active_ = this->next_tx_entry_(this->in_flight_);
+    
+    if (this->in_flight_active_) {
+      TxEntry &entry = this->in_flight_;
       
-      if (type == PACKET_TYPE_IC) {
-        ESP_LOGD(TAG, "IC Process Queue Retries:%i Attempt:%i", retries, attempts);
+      if (entry.type == PACKET_TYPE_IC) {
+        entry.attempts++;
+        ESP_LOGD(TAG, "IC Process Queue Retries:%i Attempt:%i", entry.retries, entry.attempts);
         
-        if (attempts > retries) {
-          ESP_LOGE(TAG, "IC No response %i > %i removing from send queue", retries, attempts);
-          this->tx_queue_.pop();
+        if (entry.attempts > entry.retries) {
+          ESP_LOGE(TAG, "IC No response %i > %i removing from send queue", entry.retries, entry.attempts);
+          this->finish_in_flight_(COMMAND_TIMED_OUT);
         } else {
-          // Update attempts
-          std::get<2>(this->tx_queue_.front()) = attempts;
-          
           if (this->flow_control_pin_ != nullptr) {
             ESP_LOGV(TAG, "Enable Send");
             this->flow_control_pin_->digital_write(true);
           }
           
-          std::string pretty_cmd = format_hex_pretty(data);
-          ESP_LOGI(TAG, "IC Sent: %s", pretty_cmd.c_str());
-          this->write_array(data);
+          ESP_LOGI(TAG, "IC Sent: %s", format_hex_pretty(entry.data, entry.len).c_str());
+          if (!bus_idle)
+            this->log_gap_transmit_(since_last_rx);
+          this->arm_echo_(entry.data, entry.len);
+          this->write_array(entry.data, entry.len);
+          this->stats_.tx_bytes += entry.len;
           this->flush();
           
           if (this->flow_control_pin_ != nullptr) {
@@ -137,26 +160,155 @@ void PentairIfIcComponent::loop() {
             this->flow_control_pin_->digital_write(false);
           }
           
+          entry.sent_ms = millis();
           this->ic_last_command_timestamp_ = millis();
           this->last_tx_millis_ = millis();
         }
-      } else if (type == PACKET_TYPE_IF) {
-        // IntelliFlo packet - send immediately and remove from queue
-        this->flush();
-        this->write_array(&data[0], data.size());
-        
-        std::string pretty_cmd = format_hex_pretty(data);
-        ESP_LOGI(TAG, "IF Sent: %s", pretty_cmd.c_str());
-        
-        this->last_received_byte_millis_ = millis();
-        this->last_tx_millis_ = millis();
-        this->tx_queue_.pop();
+      } else if (entry.type == PACKET_TYPE_IF) {
+        // IntelliFlo packet - stays in flight until the pump replies or the ack times out
+        if (entry.attempts > 0 && millis() - entry.sent_ms < IF_ACK_TIMEOUT_MS) {
+          // Still waiting for the reply
+        } else if (entry.attempts > entry.retries) {
+          ESP_LOGW(TAG, "IF No reply to command %u, removing from send queue", (unsigned) entry.id);
+          this->finish_in_flight_(COMMAND_TIMED_OUT);
+        } else {
+          entry.attempts++;
+          this->flush();
+          if (!bus_idle)
+            this->log_gap_transmit_(since_last_rx);
+          this->arm_echo_(entry.data, entry.len);
+          this->write_array(entry.data, entry.len);
+          this->stats_.tx_bytes += entry.len;
+          
+          ESP_LOGI(TAG, "IF Sent: %s", format_hex_pretty(entry.data, entry.len).c_str());
+          
+          entry.sent_ms = millis();
+          this->last_received_byte_millis_ = millis();
+          this->last_tx_millis_ = millis();
+        }
+      }
+    }
+  }
+  
+  this->update_stats_(loop_start_us);
+}
+
+void PentairIfIcComponent::feed_rx_byte_(uint8_t c) {
+  ESP_LOGV(TAG, "Received byte: %02X, buffer size: %d", c, this->rx_buffer_.size());
+  
+  // Check if we're currently building a packet
+  if (!this->rx_buffer_.empty()) {
+    // Continue building current packet (either IntelliFlo or IntelliChlor)
+    this->rx_buffer_.push_back(c);
+    
+    // Try to parse based on first byte
+    if (this->rx_buffer_[0] == 0xFF) {
+      // IntelliFlo packet
+      ESP_LOGV(TAG, "Validating IF packet, buffer size: %d", this->rx_buffer_.size());
+      if (!this->validate_if_received_message_()) {
+        this->rx_buffer_.clear();
+      }
+    } else if (this->rx_buffer_[0] == 0x10) {
+      // IntelliChlor packet
+      ESP_LOGV(TAG, "Parsing IC packet, buffer size: %d", this->rx_buffer_.size());
+      if (!this->parse_ic_packet_()) {
+        // Continue building
+      } else {
+        // Packet complete, clear buffer
+        this->rx_buffer_.clear();
       }
+    } else {
+      // Invalid packet start
+      ESP_LOGW(TAG, "Invalid packet start: %02X", this->rx_buffer_[0]);
+      this->rx_buffer_.clear();
+    }
+  }
+  // Start new packet - determine type by first byte
+  else if (c == 0xFF || c == 0x10) {
+    // Start new packet (IntelliFlo or IntelliChlor)
+    ESP_LOGD(TAG, "Starting new packet with byte: %02X", c);
+    this->rx_buffer_.push_back(c);
+  }
+  // Unknown/noise - ignore
+  else {
+    ESP_LOGV(TAG, "Ignoring unexpected byte: %02X", c);
+  }
+}
+
+void PentairIfIcComponent::discard_partial_frame_(uint32_t idle_us) {
+  ESP_LOGD(TAG, "Line idle %u us mid-frame, discarding %u byte partial frame: %s", (unsigned) idle_us,
+           (unsigned) this->rx_buffer_.size(), format_hex_pretty(this->rx_buffer_).c_str());
+  this->rx_gap_discards_++;
+  this->rx_buffer_.clear();
+}
+
+void PentairIfIcComponent::arm_echo_(const uint8_t *data, size_t len) {
+  if (!this->echo_suppression_)
+    return;
+  if (this->echo_len_ != 0) {
+    this->rx_missing_echoes_++;
+    this->abandon_echo_();
+  }
+  memcpy(this->echo_frame_, data, len);
+  this->echo_len_ = len;
+  this->echo_pos_ = 0;
+  this->echo_armed_us_ = micros();
+}
+
+bool PentairIfIcComponent::match_echo_(uint8_t c) {
+  if (c == this->echo_frame_[this->echo_pos_]) {
+    if (++this->echo_pos_ == this->echo_len_) {
+      ESP_LOGV(TAG, "Echo of %u byte frame suppressed", this->echo_len_);
+      this->rx_echo_frames_++;
+      this->echo_len_ = 0;
     }
+    return true;
   }
+  
+  if (this->echo_pos_ == 0) {
+    // Not one byte of the echo came back; this is already other traffic, e.g. the reply
+    ESP_LOGD(TAG, "No echo of %u byte frame before %02X", this->echo_len_, c);
+    this->rx_missing_echoes_++;
+    this->abandon_echo_();
+    return false;
+  }
+  
+  // The echo started and then diverged: somebody else drove the line while we were sending
+  ESP_LOGW(TAG, "Echo mismatch at byte %u of %u (%02X != %02X), bus collision", this->echo_pos_, this->echo_len_, c,
+           this->echo_frame_[this->echo_pos_]);
+  this->tx_collisions_++;
+  if (this->in_flight_active_ && this->in_flight_.type == PACKET_TYPE_IF && this->in_flight_.attempts > 0) {
+    // The pump cannot have understood a garbled frame; resend at the next slot
+    // instead of waiting out the ack timeout. The resend uses up a retry, and a
+    // command with none left times out there instead.
+    this->in_flight_.sent_ms = millis() - IF_ACK_TIMEOUT_MS;
+  }
+  this->abandon_echo_();
+  return false;
+}
+
+void PentairIfIcComponent::abandon_echo_() {
+  // Bytes matched so far may be the start of a genuine frame; hand them to the framer
+  uint8_t matched = this->echo_pos_;
+  if (matched == 0)
+    ESP_LOGV(TAG, "No echo of %u byte frame", this->echo_len_);
+  this->echo_len_ = 0;
+  this->echo_pos_ = 0;
+  for (uint8_t i = 0; i < matched; i++)
+    this->feed_rx_byte_(this->echo_frame_[i]);
 }
 
 void PentairIfIcComponent::update() {
+  // Queue diagnostics
+  if (this->tx_queue_high_water_sensor_ != nullptr)
+    this->tx_queue_high_water_sensor_->publish_state(this->tx_queue_high_water());
+  if (this->tx_dropped_sensor_ != nullptr)
+    this->tx_dropped_sensor_->publish_state(this->tx_dropped());
+  if (this->tx_expired_sensor_ != nullptr)
+    this->tx_expired_sensor_->publish_state(this->tx_expired_);
+  if (this->tx_collisions_sensor_ != nullptr)
+    this->tx_collisions_sensor_->publish_state(this->tx_collisions_);
+  
   // Poll both devices - IC first, IF after a delay
   this->read_all_chlorinator_info();
   
@@ -178,7 +330,7 @@ void PentairIfIcComponent::read_all_chlorinator_info() {
     if (this->takeover_mode_switch_ != nullptr && this->takeover_mode_switch_->state) {
       this->ic_takeover_();
       if (this->swg_percent_number_ != nullptr) {
-        this->ic_set_percent_(this->swg_percent_number_->state);
+        this->command_swg_percent(this->swg_percent_number_->state);
       }
     }
     this->get_ic_version_();
@@ -195,7 +347,7 @@ void PentairIfIcComponent::refresh_chlorinator() {
   if (this->takeover_mode_switch_ != nullptr && this->takeover_mode_switch_->state) {
     this->ic_takeover_();
     if (this->swg_percent_number_ != nullptr) {
-      this->ic_set_percent_(this->swg_percent_number_->state);
+      this->command_swg_percent(this->swg_percent_number_->state);
     }
   }
   this->get_ic_version_();
@@ -220,13 +372,13 @@ void PentairIfIcComponent::get_ic_more_() {
 void PentairIfIcComponent::get_ic_version_() {
   uint8_t cmd[3] = {0x50, 0x14, 0x00};
   ESP_LOGD(TAG, "IC send GetVersion");
-  this->send_ic_command_(cmd, 3, 1);
+  this->send_ic_command_(cmd, 3, 1, nullptr, TX_PRIORITY_POLL);
 }
 
 void PentairIfIcComponent::get_ic_temp_() {
   uint8_t cmd[3] = {0x50, 0x15, 0x00};
   ESP_LOGD(TAG, "IC send GetTemp");
-  this->send_ic_command_(cmd, 3, 3);
+  this->send_ic_command_(cmd, 3, 3, nullptr, TX_PRIORITY_POLL);
 }
 
 void PentairIfIcComponent::ic_takeover_() {
@@ -235,43 +387,37 @@ void PentairIfIcComponent::ic_takeover_() {
   this->send_ic_command_(cmd, 3, 3);
 }
 
-void PentairIfIcComponent::ic_set_percent_(uint8_t percent) {
-  ESP_LOGD(TAG, "IC send SetPercent");
-  this->ic_last_set_percent_ = percent;
-  if (percent == 16) {
-    uint8_t cmd[4] = {0x50, 0x11, percent, 0x00};
-    this->send_ic_command_(cmd, 4, 3);
-  } else {
-    uint8_t cmd[3] = {0x50, 0x11, percent};
-    this->send_ic_command_(cmd, 3, 3);
-  }
+CommandHandle PentairIfIcComponent::command_swg_percent(uint8_t percent, CommandCallback callback) {
+  return this->submit_command({POOL_COMMAND_SWG_PERCENT, percent}, std::move(callback));
 }
 
-void PentairIfIcComponent::send_ic_command_(const uint8_t *command, int command_len, uint8_t retries) {
+size_t PentairIfIcComponent::frame_ic_command_(const uint8_t *command, size_t len, uint8_t *out) {
+  if (len + 5 > TX_MAX_PACKET)
+    return 0;
+  size_t pos = 0;
   uint8_t crc = 0;
-  std::vector<uint8_t> packet;
-  packet.reserve(command_len + 5);
-  
+  out[pos++] = IC_CMD_FRAME_HEADER[0];
+  out[pos++] = IC_CMD_FRAME_HEADER[1];
+  for (size_t i = 0; i < len; i++)
+    out[pos++] = command[i];
+  for (size_t i = 0; i < pos; i++)
+    crc += out[i];
+  out[pos++] = crc;
+  out[pos++] = IC_CMD_FRAME_FOOTER[0];
+  out[pos++] = IC_CMD_FRAME_FOOTER[1];
+  return pos;
+}
+
+CommandHandle PentairIfIcComponent::send_ic_command_(const uint8_t *command, int command_len, uint8_t retries,
+                                                     CommandCallback callback, TxPriority priority) {
   ESP_LOGD(TAG, "IC send_command_ Len:%i Retries:%i", command_len, retries);
-  
-  packet.push_back(IC_CMD_FRAME_HEADER[0]);
-  crc += IC_CMD_FRAME_HEADER[0];
-  
-  packet.push_back(IC_CMD_FRAME_HEADER[1]);
-  crc += IC_CMD_FRAME_HEADER[1];
-  
-  if (command != nullptr) {
-    for (int i = 0; i < command_len; i++) {
-      packet.push_back(command[i]);
-      crc += command[i];
-    }
+  uint8_t packet[TX_MAX_PACKET];
+  size_t len = frame_ic_command_(command, command != nullptr ? command_len : 0, packet);
+  if (len == 0) {
+    ESP_LOGE(TAG, "IC command too long: %d bytes", command_len);
+    return this->reject_command_(std::move(callback));
   }
-  
-  packet.push_back(crc);
-  packet.push_back(IC_CMD_FRAME_FOOTER[0]);
-  packet.push_back(IC_CMD_FRAME_FOOTER[1]);
-  
-  this->tx_queue_.push(std::make_tuple(PACKET_TYPE_IC, retries, (uint8_t)0, packet));
+  return this->post_packet_(PACKET_TYPE_IC, priority, retries, packet, len, std::move(callback));
 }
 
 bool PentairIfIcComponent::parse_ic_packet_() {
@@ -290,6 +436,7 @@ bool PentairIfIcComponent::parse_ic_packet_() {
     // Still building
     if (len >= 64) {
       ESP_LOGW(TAG, "IC Buffer overflow");
+      this->stats_.rx_errors[RX_ERROR_OVERFLOW]++;
       return true;  // Complete (error)
     }
     return false;
@@ -301,6 +448,7 @@ bool PentairIfIcComponent::parse_ic_packet_() {
       if (this->rx_buffer_[i] == 0x10 && this->rx_buffer_[i + 1] == 0x03) {
         // Complete IntelliChlor packet received
         this->ic_last_recv_timestamp_ = millis();
+        this->stats_.rx_frames[BUS_DEVICE_CHLORINATOR]++;
         
         std::string pretty_cmd = format_hex_pretty(this->rx_buffer_);
         ESP_LOGI(TAG, "IC Package received: %s", pretty_cmd.c_str());
@@ -322,6 +470,8 @@ bool PentairIfIcComponent::parse_ic_packet_() {
         // Temperature response
         auto temp = buffer[4];
         ESP_LOGD(TAG, "IC TempResp: %i", temp);
+        this->state_working_.water_temp = temp;
+        this->commit_chlorinator_state_();
         if (this->water_temp_sensor_ != nullptr) {
           this->water_temp_sensor_->publish_state(temp);
         }
@@ -330,6 +480,10 @@ bool PentairIfIcComponent::parse_ic_packet_() {
         uint16_t saltPPM = buffer[4] * 50;
         auto errorField = buffer[5];
         ESP_LOGD(TAG, "IC SetResp Salt:%u Error:%02X", saltPPM, errorField);
+        this->state_working_.salt_ppm = saltPPM;
+        this->state_working_.error_flags = errorField;
+        this->state_working_.set_percent = this->ic_last_set_percent_.load(std::memory_order_relaxed);
+        this->commit_chlorinator_state_();
         
         if (this->no_flow_binary_sensor_ != nullptr)
           this->no_flow_binary_sensor_->publish_state(GETBIT8(errorField, 0));
@@ -353,19 +507,21 @@ bool PentairIfIcComponent::parse_ic_packet_() {
         if (this->ic_error_sensor_ != nullptr)
           this->ic_error_sensor_->publish_state(errorField);
         if (this->set_percent_sensor_ != nullptr)
-          this->set_percent_sensor_->publish_state(this->ic_last_set_percent_);
+          this->set_percent_sensor_->publish_state(this->ic_last_set_percent_.load(std::memory_order_relaxed));
       } else if (pos >= 4 && buffer[3] == 0x01) {
         // Takeover response
         auto status = buffer[3];
         ESP_LOGD(TAG, "IC TakeoverResp Status:%02X", status);
+        this->state_working_.status = status;
+        this->commit_chlorinator_state_();
         if (this->ic_status_sensor_ != nullptr)
           this->ic_status_sensor_->publish_state(status);
       }
       
         
-        if (!this->tx_queue_.empty() && std::get<0>(this->tx_queue_.front()) == PACKET_TYPE_IC) {
+        if (this->in_flight_active_ && this->in_flight_.type == PACKET_TYPE_IC) {
           ESP_LOGD(TAG, "IC Got response, removing from send queue");
-          this->tx_queue_.pop();
+          this->finish_in_flight_(COMMAND_ACKED);
         }
         
         return true;  // Packet complete
@@ -377,6 +533,7 @@ bool PentairIfIcComponent::parse_ic_packet_() {
   if (len >= 64) {
     ESP_LOGW(TAG, "IC Clearing Buffer after error. Buffer size: %d, Contents: %s", 
              len, format_hex_pretty(this->rx_buffer_).c_str());
+    this->stats_.rx_errors[RX_ERROR_OVERFLOW]++;
     return true;  // Complete (error)
   }
   
@@ -384,6 +541,11 @@ bool PentairIfIcComponent::parse_ic_packet_() {
   return false;
 }
 
+void PentairIfIcComponent::commit_chlorinator_state_() {
+  this->state_working_.chlor_updated_ms = millis();
+  this->state_.write(this->state_working_);
+}
+
 // ========================================
 // IntelliFlo Methods
 // ========================================
@@ -414,6 +576,7 @@ bool PentairIfIcComponent::validate_if_received_message_() {
   uint16_t packet_checksum = (data[3 + 6 + packet_size] << 8) + data[3 + 7 + packet_size];
   if (checksum != packet_checksum) {
     ESP_LOGW(TAG, "IF CHECKSUM MISMATCH");
+    this->stats_.rx_errors[RX_ERROR_CHECKSUM]++;
     return false;
   }
   
@@ -422,6 +585,7 @@ bool PentairIfIcComponent::validate_if_received_message_() {
   rx_buffer_.erase(rx_buffer_.begin());
   rx_buffer_.erase(rx_buffer_.begin());
   
+  this->stats_.rx_frames[BUS_DEVICE_PUMP]++;
   std::string pretty_cmd = format_hex_pretty(rx_buffer_);
   ESP_LOGI(TAG, "IF Package received: %s", pretty_cmd.c_str());
   
@@ -432,99 +596,92 @@ bool PentairIfIcComponent::validate_if_received_message_() {
 
 void PentairIfIcComponent::parse_if_packet_(const std::vector<uint8_t> &data) {
   if (data[3] == 0x60 && data[4] == 0x07) {
-    // Pump status packet
-    if (this->if_running_ != nullptr) {
-      switch (data[6]) {
-        case STOPPED:
-          this->if_running_->publish_state(false);
-          break;
-        case RUNNING:
-          this->if_running_->publish_state(true);
-          break;
-        default:
-          ESP_LOGW(TAG, "IF Received unknown running value %02x", data[6]);
-          break;
-      }
+    // Pump status packet - decode the whole frame, commit the snapshot, then publish
+    PoolState &st = this->state_working_;
+    switch (data[6]) {
+      case STOPPED:
+        st.running = false;
+        break;
+      case RUNNING:
+        st.running = true;
+        break;
+      default:
+        ESP_LOGW(TAG, "IF Received unknown running value %02x", data[6]);
+        break;
     }
+    st.program = data[7];
+    st.power_w = (data[9] * 256) + data[10];
+    st.rpm = (data[11] * 256) + data[12];
+    st.flow_milli = flow_milli(data[13]);
+    st.pressure_milli = pressure_milli(data[14]);
+    st.time_remaining_min = data[17] * 60 + data[18];
+    st.clock_min = data[19] * 60 + data[20];
+    st.pump_updated_ms = millis();
+    this->state_.write(st);
+    
+    if (this->if_running_ != nullptr && (data[6] == STOPPED || data[6] == RUNNING))
+      this->if_running_->publish_state(st.running);
     
     if (this->if_program_ != nullptr) {
-      switch (data[7]) {
-        case NO_PROG:
-          this->if_program_->publish_state("");
-          break;
-        case LOCAL1:
-          this->if_program_->publish_state("Local 1");
-          break;
-        case LOCAL2:
-          this->if_program_->publish_state("Local 2");
-          break;
-        case LOCAL3:
-          this->if_program_->publish_state("Local 3");
-          break;
-        case LOCAL4:
-          this->if_program_->publish_state("Local 4");
-          break;
-        case EXT1:
-          this->if_program_->publish_state("External 1");
-          break;
-        case EXT2:
-          this->if_program_->publish_state("External 2");
-          break;
-        case EXT3:
-          this->if_program_->publish_state("External 3");
-          break;
-        case EXT4:
-          this->if_program_->publish_state("External 4");
-          break;
-        case TIMEOUT:
-          this->if_program_->publish_state("Time Out");
-          break;
-        case PRIMING:
-          this->if_program_->publish_state("Priming");
-          break;
-        case QUICKCLEAN:
-          this->if_program_->publish_state("Quick Clean");
-          break;
-        default:
-          ESP_LOGW(TAG, "IF Received unknown program value %02x", data[7]);
-          break;
+      const ProgramDescriptor *prog = find_program(st.program);
+      if (prog == nullptr) {
+        ESP_LOGW(TAG, "IF Received unknown program value %02x", st.program);
+      } else if (prog != this->if_last_program_) {
+        this->if_last_program_ = prog;
+        this->if_program_->publish_state(prog->name);
       }
     }
     
     if (this->if_power_ != nullptr)
-      this->if_power_->publish_state((data[9] * 256) + data[10]);
+      this->if_power_->publish_state(st.power_w);
     if (this->if_rpm_ != nullptr)
-      this->if_rpm_->publish_state((data[11] * 256) + data[12]);
+      this->if_rpm_->publish_state(st.rpm);
     if (this->if_flow_ != nullptr)
-      this->if_flow_->publish_state(data[13] * 0.227);
+      this->if_flow_->publish_state(milli_to_float(st.flow_milli));
     if (this->if_pressure_ != nullptr)
-      this->if_pressure_->publish_state(data[14] / 14.504);
+      this->if_pressure_->publish_state(milli_to_float(st.pressure_milli));
     if (this->if_time_remaining_ != nullptr)
-      this->if_time_remaining_->publish_state(data[17] * 60 + data[18]);
+      this->if_time_remaining_->publish_state(st.time_remaining_min);
     if (this->if_clock_ != nullptr)
-      this->if_clock_->publish_state(data[19] * 60 + data[20]);
+      this->if_clock_->publish_state(st.clock_min);
+  }
+  
+  // Pump (0x60) replying to us (0x10) completes the in-flight IF command
+  if (data[2] == 0x10 && data[3] == 0x60 && this->in_flight_active_) {
+    TxEntry &entry = this->in_flight_;
+    if (entry.type == PACKET_TYPE_IF && entry.attempts > 0) {
+      uint8_t action = entry.data[IF_ACTION_OFFSET];
+      if (data[4] == action) {
+        ESP_LOGD(TAG, "IF Command %u acknowledged", (unsigned) entry.id);
+        this->finish_in_flight_(COMMAND_ACKED);
+      } else if (data[4] == 0xFF) {
+        uint8_t error_code = data.size() > 6 ? data[6] : 0;
+        ESP_LOGW(TAG, "IF Command %u rejected by pump, error %02X", (unsigned) entry.id, error_code);
+        this->finish_in_flight_(COMMAND_REJECTED, error_code);
+      }
+    }
   }
 }
 
-void PentairIfIcComponent::requestPumpStatus() {
+CommandHandle PentairIfIcComponent::requestPumpStatus(CommandCallback callback) {
   ESP_LOGI(TAG, "IF Requesting pump status");
   uint8_t statusPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x07, 0x00};
-  queue_if_packet_(statusPacket, 6);
+  return this->queue_if_packet_(statusPacket, 6, std::move(callback), TX_PRIORITY_POLL);
 }
 
-void PentairIfIcComponent::pumpToLocalControl() {
+CommandHandle PentairIfIcComponent::pumpToLocalControl(CommandCallback callback) {
   ESP_LOGI(TAG, "IF Requesting local control");
   uint8_t localControlPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x04, 0x01, 0x00};
-  queue_if_packet_(localControlPacket, 7);
+  return this->queue_if_packet_(localControlPacket, 7, std::move(callback), TX_PRIORITY_POLL);
 }
 
-void PentairIfIcComponent::pumpToRemoteControl() {
+CommandHandle PentairIfIcComponent::pumpToRemoteControl(CommandCallback callback) {
   ESP_LOGI(TAG, "IF Requesting remote control");
   uint8_t remoteControlPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x04, 0x01, 0xFF};
-  queue_if_packet_(remoteControlPacket, 7);
+  return this->queue_if_packet_(remoteControlPacket, 7, std::move(callback));
 }
 
-void PentairIfIcComponent::setPumpClock(int hour, int minute) {
+CommandHandle PentairIfIcComponent::setPumpClock(int hour, int minute, CommandCallback callback) {
   ESP_LOGW(TAG, "IF Setting pump clock to %02d:%02d - NOTE: Many IntelliFlo models don't support clock setting via RS485", hour, minute);
   // This command is not supported on all IntelliFlo models
   // Some models return error 0xFF 0x19 indicating the command is rejected
@@ -532,86 +689,524 @@ void PentairIfIcComponent::setPumpClock(int hour, int minute) {
   uint8_t setClockPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x03, 0x02, 0, 0};
   setClockPacket[6] = hour;
   setClockPacket[7] = minute;
-  queue_if_packet_(setClockPacket, 8);
+  return this->queue_if_packet_(setClockPacket, 8, std::move(callback));
 }
 
-void PentairIfIcComponent::run() {
-  ESP_LOGI(TAG, "IF Run Pump");
-  uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x06, 0x01, 0x0A};
-  queue_if_packet_(pumpPowerPacket, 7);
+CommandHandle PentairIfIcComponent::run(CommandCallback callback) {
+  return this->submit_command({POOL_COMMAND_RUN, 0}, std::move(callback));
 }
 
-void PentairIfIcComponent::stop() {
-  ESP_LOGI(TAG, "IF Stop Pump");
-  uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x06, 0x01, 0x04};
-  queue_if_packet_(pumpPowerPacket, 7);
+CommandHandle PentairIfIcComponent::stop(CommandCallback callback) {
+  return this->submit_command({POOL_COMMAND_STOP, 0}, std::move(callback));
 }
 
-void PentairIfIcComponent::commandLocalProgram(int prog) {
-  ESP_LOGI(TAG, "IF Command local program %d", prog);
-  uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x05, 0x01, 0};
-  pumpPowerPacket[6] = prog + 1;
-  queue_if_packet_(pumpPowerPacket, 7);
+CommandHandle PentairIfIcComponent::commandLocalProgram(int prog, CommandCallback callback) {
+  return this->submit_command({POOL_COMMAND_LOCAL_PROGRAM, prog}, std::move(callback));
 }
 
-void PentairIfIcComponent::commandExternalProgram(int prog) {
-  ESP_LOGI(TAG, "IF Command external program %d", prog);
-  uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x01, 0x04, 0x03, 0x21, 0x00, 0x00};
-  pumpPowerPacket[9] = prog * 8;
-  queue_if_packet_(pumpPowerPacket, 10);
+CommandHandle PentairIfIcComponent::commandExternalProgram(int prog, CommandCallback callback) {
+  return this->submit_command({POOL_COMMAND_EXTERNAL_PROGRAM, prog}, std::move(callback));
 }
 
-void PentairIfIcComponent::saveValueForProgram(int prog, int value) {
+CommandHandle PentairIfIcComponent::saveValueForProgram(int prog, int value, CommandCallback callback) {
   ESP_LOGI(TAG, "IF saveValueForProgram %d: %d", prog, value);
   uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x01, 0x04, 0x03, 0, 0, 0};
   pumpPowerPacket[7] = 0x26 + prog;
   pumpPowerPacket[8] = floor(value / 256);
   pumpPowerPacket[9] = value % 256;
-  queue_if_packet_(pumpPowerPacket, 10);
+  return this->queue_if_packet_(pumpPowerPacket, 10, std::move(callback));
 }
 
-void PentairIfIcComponent::commandRPM(int rpm) {
-  ESP_LOGI(TAG, "IF Command RPM: %d rpm", rpm);
-  uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x01, 0x04, 0x02, 0xC4, 0, 0};
-  pumpPowerPacket[8] = floor(rpm / 256);
-  pumpPowerPacket[9] = rpm % 256;
-  queue_if_packet_(pumpPowerPacket, 10);
+CommandHandle PentairIfIcComponent::commandRPM(int rpm, CommandCallback callback) {
+  return this->submit_command({POOL_COMMAND_RPM, rpm}, std::move(callback));
 }
 
-void PentairIfIcComponent::commandFlow(int flow) {
+CommandHandle PentairIfIcComponent::commandFlow(int flow, CommandCallback callback) {
   ESP_LOGI(TAG, "IF Command Flow: %.1f m3/h", ((double) flow) / 10);
   uint8_t pumpPowerPacket[] = {0xA5, 0x00, 0x60, 0x10, 0x09, 0x04, 0x02, 0xC4, 0x00, 0};
   pumpPowerPacket[9] = flow;
-  queue_if_packet_(pumpPowerPacket, 10);
+  return this->queue_if_packet_(pumpPowerPacket, 10, std::move(callback));
+}
+
+size_t PentairIfIcComponent::frame_if_packet_(const uint8_t *message, size_t len, uint8_t *out) {
+  if (len + 5 > TX_MAX_PACKET)
+    return 0;
+  // FF 00 FF preamble, message, 16 bit sum of the message bytes
+  size_t pos = 0;
+  uint16_t checksum = 0;
+  out[pos++] = 0xFF;
+  out[pos++] = 0x00;
+  out[pos++] = 0xFF;
+  for (size_t i = 0; i < len; i++) {
+    out[pos++] = message[i];
+    checksum += message[i];
+  }
+  out[pos++] = checksum >> 8;
+  out[pos++] = checksum & 0xFF;
+  return pos;
 }
 
-void PentairIfIcComponent::queue_if_packet_(uint8_t message[], int messageLength) {
+CommandHandle PentairIfIcComponent::queue_if_packet_(uint8_t message[], int messageLength, CommandCallback callback,
+                                                     TxPriority priority) {
   ESP_LOGV(TAG, "IF queuePacket: message length: %d", messageLength);
+  uint8_t packet[TX_MAX_PACKET];
+  size_t len = frame_if_packet_(message, messageLength, packet);
+  if (len == 0) {
+    ESP_LOGW(TAG, "IF Asking to queue oversized packet");
+    return this->reject_command_(std::move(callback));
+  }
+  uint8_t retries = priority == TX_PRIORITY_CONTROL ? IF_CONTROL_RETRIES : 0;
+  return this->post_packet_(PACKET_TYPE_IF, priority, retries, packet, len, std::move(callback));
+}
+
+const char *pool_command_type_to_str(PoolCommandType type) {
+  switch (type) {
+    case POOL_COMMAND_RUN:
+      return "run";
+    case POOL_COMMAND_STOP:
+      return "stop";
+    case POOL_COMMAND_RPM:
+      return "rpm";
+    case POOL_COMMAND_LOCAL_PROGRAM:
+      return "local_program";
+    case POOL_COMMAND_EXTERNAL_PROGRAM:
+      return "external_program";
+    case POOL_COMMAND_SWG_PERCENT:
+      return "swg";
+    default:
+      return "unknown";
+  }
+}
+
+bool pool_commands_conflict(PoolCommandType a, PoolCommandType b) {
+  // Run and stop are the same IF action with different values
+  auto target = [](PoolCommandType type) { return type == POOL_COMMAND_STOP ? POOL_COMMAND_RUN : type; };
+  return target(a) == target(b);
+}
+
+const char *validate_pool_command(const PoolCommand &command) {
+  switch (command.type) {
+    case POOL_COMMAND_RUN:
+    case POOL_COMMAND_STOP:
+      return nullptr;
+    case POOL_COMMAND_RPM:
+      return command.value >= 450 && command.value <= 3450 ? nullptr : "rpm must be 450-3450";
+    // Slots are range-checked before find_program() narrows them to uint8_t,
+    // where 256 would wrap onto a valid one
+    case POOL_COMMAND_LOCAL_PROGRAM:
+      return command.value >= 0 && command.value < UINT8_MAX &&
+                     find_program(PROGRAM_KIND_LOCAL, static_cast<uint8_t>(command.value + 1)) != nullptr
+                 ? nullptr
+                 : "no such local program";
+    case POOL_COMMAND_EXTERNAL_PROGRAM:
+      // 0 clears the external program, 1-4 select a slot
+      return command.value == 0 || (command.value > 0 && command.value <= UINT8_MAX &&
+                                    find_program(PROGRAM_KIND_EXTERNAL, static_cast<uint8_t>(command.value)) != nullptr)
+                 ? nullptr
+                 : "no such external program";
+    case POOL_COMMAND_SWG_PERCENT:
+      return command.value >= 0 && command.value <= 100 ? nullptr : "swg percent must be 0-100";
+    default:
+      return "unknown command";
+  }
+}
+
+bool PentairIfIcComponent::encode_command_(const PoolCommand &command, TxEntry &entry) {
+  const char *error = validate_pool_command(command);
+  if (error != nullptr) {
+    ESP_LOGW(TAG, "Invalid %s command (%d): %s", pool_command_type_to_str(command.type), (int) command.value, error);
+    return false;
+  }
   
-  int checksum = 0;
-  for (int j = 0; j < messageLength; j++) {
-    checksum += message[j];
+  uint8_t packet[TX_MAX_PACKET];
+  size_t len;
+  int32_t value = command.value;
+  if (command.type == POOL_COMMAND_SWG_PERCENT) {
+    ESP_LOGD(TAG, "IC send SetPercent");
+    uint8_t cmd[4] = {0x50, 0x11, (uint8_t) value, 0x00};
+    len = frame_ic_command_(cmd, value == 16 ? 4 : 3, packet);
+    this->fill_entry_(entry, PACKET_TYPE_IC, TX_PRIORITY_CONTROL, 3, packet, len);
+    return true;
   }
   
-  std::vector<uint8_t> packet = {0xFF, 0x00, 0xFF};
-  packet.insert(packet.end(), message, message + messageLength);
-  packet.push_back(checksum >> 8);
-  packet.push_back(checksum & 0xFF);
+  switch (command.type) {
+    case POOL_COMMAND_RUN:
+    case POOL_COMMAND_STOP: {
+      bool run = command.type == POOL_COMMAND_RUN;
+      ESP_LOGI(TAG, "IF %s Pump", run ? "Run" : "Stop");
+      const uint8_t message[] = {0xA5, 0x00, 0x60, 0x10, 0x06, 0x01, (uint8_t) (run ? RUNNING : STOPPED)};
+      len = frame_if_packet_(message, sizeof(message), packet);
+      break;
+    }
+    case POOL_COMMAND_RPM: {
+      ESP_LOGI(TAG, "IF Command RPM: %d rpm", (int) value);
+      const uint8_t message[] = {0xA5, 0x00, 0x60, 0x10, 0x01, 0x04, 0x02, 0xC4, (uint8_t) (value >> 8),
+                                 (uint8_t) (value & 0xFF)};
+      len = frame_if_packet_(message, sizeof(message), packet);
+      break;
+    }
+    case POOL_COMMAND_LOCAL_PROGRAM: {
+      ESP_LOGI(TAG, "IF Command local program %d", (int) value);
+      const uint8_t message[] = {0xA5, 0x00, 0x60, 0x10, 0x05, 0x01, (uint8_t) (value + 1)};
+      len = frame_if_packet_(message, sizeof(message), packet);
+      break;
+    }
+    case POOL_COMMAND_EXTERNAL_PROGRAM: {
+      ESP_LOGI(TAG, "IF Command external program %d", (int) value);
+      const uint8_t message[] = {0xA5, 0x00, 0x60, 0x10, 0x01, 0x04, 0x03, 0x21, 0x00, (uint8_t) (value * 8)};
+      len = frame_if_packet_(message, sizeof(message), packet);
+      break;
+    }
+    default:
+      return false;
+  }
+  this->fill_entry_(entry, PACKET_TYPE_IF, TX_PRIORITY_CONTROL, IF_CONTROL_RETRIES, packet, len);
+  return true;
+}
+
+void PentairIfIcComponent::note_submitted_(const PoolCommand &command) {
+  // Reported as the set point once the chlorinator answers
+  if (command.type == POOL_COMMAND_SWG_PERCENT)
+    this->ic_last_set_percent_.store(command.value, std::memory_order_relaxed);
+}
+
+CommandHandle PentairIfIcComponent::submit_command(const PoolCommand &command, CommandCallback callback) {
+  TxEntry entry;
+  if (!this->encode_command_(command, entry))
+    return this->reject_command_(std::move(callback));
+  this->note_submitted_(command);
+  entry.callback = std::move(callback);
+  return this->push_entry_(entry);
+}
+
+bool PentairIfIcComponent::submit_batch(const PoolCommand *commands, size_t count, CommandCallback *callbacks,
+                                        CommandHandle *handles) {
+  if (count == 0 || count > this->max_batch())
+    return false;
+  TxEntry entries[MAX_BATCH];
+  for (size_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < i; j++) {
+      if (pool_commands_conflict(commands[i].type, commands[j].type)) {
+        ESP_LOGW(TAG, "Batch sets %s twice", pool_command_type_to_str(commands[i].type));
+        return false;
+      }
+    }
+    if (!this->encode_command_(commands[i], entries[i]))
+      return false;
+  }
+  entries[0].batch_len = count;
+  for (size_t i = 0; i < count; i++) {
+    handles[i] = CommandHandle{entries[i].id};
+    if (callbacks != nullptr)
+      entries[i].callback = std::move(callbacks[i]);
+  }
+  if (!this->tx_inbox_.push_batch(entries, count)) {
+    ESP_LOGW(TAG, "Command inbox full, dropping batch of %u", (unsigned) count);
+    return false;
+  }
+  for (size_t i = 0; i < count; i++)
+    this->note_submitted_(commands[i]);
+  ESP_LOGD(TAG, "Queued batch of %u commands", (unsigned) count);
+  return true;
+}
+
+void PentairIfIcComponent::fill_entry_(TxEntry &entry, PacketType type, TxPriority priority, uint8_t retries,
+                                       const uint8_t *data, size_t len) {
+  entry.type = type;
+  entry.priority = priority;
+  entry.retries = retries;
+  entry.attempts = 0;
+  entry.len = len;
+  entry.id = this->next_command_id_();
+  entry.key = tx_entry_key_(type, data, len);
+  entry.queued_ms = millis();
+  entry.deadline_ms = entry.queued_ms + this->tx_classes_[priority].max_age_ms;
+  entry.sent_ms = 0;
+  entry.batch_len = 0;
+  memcpy(entry.data, data, len);
+}
+
+CommandHandle PentairIfIcComponent::post_packet_(PacketType type, TxPriority priority, uint8_t retries,
+                                                 const uint8_t *data, size_t len, CommandCallback callback) {
+  if (len > TX_MAX_PACKET) {
+    ESP_LOGE(TAG, "Packet too long for command inbox: %u bytes", (unsigned) len);
+    return this->reject_command_(std::move(callback));
+  }
+  TxEntry entry;
+  this->fill_entry_(entry, type, priority, retries, data, len);
+  entry.callback = std::move(callback);
+  return this->push_entry_(entry);
+}
+
+CommandHandle PentairIfIcComponent::push_entry_(TxEntry &entry) {
+  if (!this->tx_inbox_.push(entry)) {
+    ESP_LOGW(TAG, "Command inbox full, dropping %s packet", entry.type == PACKET_TYPE_IC ? "IC" : "IF");
+    this->complete_command_(entry, COMMAND_DROPPED);
+  }
+  return CommandHandle{entry.id};
+}
+
+void PentairIfIcComponent::drain_inbox_() {
+  TxEntry entry;
+  uint32_t drained = 0;
+  while (this->tx_inbox_.pop(entry)) {
+    drained++;
+    TxClass &cls = this->tx_classes_[entry.priority];
+    if (entry.batch_len > 1 && cls.policy == DROP_NEWEST && cls.queue.size() + entry.batch_len > cls.capacity) {
+      // Dropping only the members that do not fit would break the batch apart
+      ESP_LOGW(TAG, "%s queue full, dropping batch of %u", tx_priority_to_str(entry.priority), entry.batch_len);
+      this->batch_drop_left_ = entry.batch_len;
+    }
+    if (this->batch_drop_left_ > 0) {
+      this->batch_drop_left_--;
+      cls.dropped++;
+      this->complete_command_(entry, COMMAND_DROPPED);
+      continue;
+    }
+    // A newer command of the same kind replaces the queued one (e.g. RPM changed again)
+    for (auto it = cls.queue.begin(); it != cls.queue.end(); ++it) {
+      if (it->key == entry.key) {
+        ESP_LOGD(TAG, "Command %u superseded by %u", (unsigned) it->id, (unsigned) entry.id);
+        this->complete_command_(*it, COMMAND_SUPERSEDED);
+        cls.queue.erase(it);
+        break;
+      }
+    }
+    if (cls.capacity == 0 || (cls.queue.size() >= cls.capacity && cls.policy == DROP_NEWEST)) {
+      ESP_LOGW(TAG, "%s queue full, dropping new command %u", tx_priority_to_str(entry.priority),
+               (unsigned) entry.id);
+      cls.dropped++;
+      this->complete_command_(entry, COMMAND_DROPPED);
+      continue;
+    }
+    if (cls.queue.size() >= cls.capacity) {
+      TxEntry &oldest = cls.queue.front();
+      ESP_LOGW(TAG, "%s queue full, dropping oldest command %u", tx_priority_to_str(entry.priority),
+               (unsigned) oldest.id);
+      cls.dropped++;
+      this->complete_command_(oldest, COMMAND_DROPPED);
+      cls.queue.pop_front();
+    }
+    cls.queue.push_back(std::move(entry));
+    if (cls.queue.size() > cls.high_water)
+      cls.high_water = cls.queue.size();
+    // Combined depth at this instant; per-class peaks happen at different times
+    size_t depth = 0;
+    for (const auto &c : this->tx_classes_)
+      depth += c.queue.size();
+    if (depth > this->tx_high_water_)
+      this->tx_high_water_ = depth;
+  }
+  if (drained > this->stats_.inbox_high_water)
+    this->stats_.inbox_high_water = drained;
+}
+
+bool PentairIfIcComponent::next_tx_entry_(TxEntry &out) {
+  // Strict priority: control commands always go before polls. Anything past
+  // its deadline is discarded here, before it can reach the wire.
+  uint32_t now = millis();
+  for (auto &cls : this->tx_classes_) {
+    while (!cls.queue.empty()) {
+      TxEntry &front = cls.queue.front();
+      if ((int32_t) (now - front.deadline_ms) > 0) {
+        ESP_LOGD(TAG, "Command %u expired after %u ms in queue", (unsigned) front.id,
+                 (unsigned) cls.max_age_ms);
+        this->tx_expired_++;
+        this->complete_command_(front, COMMAND_EXPIRED);
+        cls.queue.pop_front();
+        continue;
+      }
+      out = std::move(front);
+      cls.queue.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void PentairIfIcComponent::update_tx_starvation_() {
+  // Age of the oldest command that is still waiting for a transmit slot
+  uint32_t now = millis();
+  uint32_t oldest_age = 0;
+  if (this->in_flight_active_ && this->in_flight_.attempts == 0)
+    oldest_age = now - this->in_flight_.queued_ms;
+  for (const auto &cls : this->tx_classes_) {
+    if (!cls.queue.empty())
+      oldest_age = std::max(oldest_age, now - cls.queue.front().queued_ms);
+  }
   
-  int packetSize = messageLength + 3 + 2;
+  bool starved = oldest_age > this->tx_starvation_threshold_ms_;
+  if (starved == this->tx_starved_)
+    return;
+  this->tx_starved_ = starved;
+  if (starved) {
+    this->tx_starvation_events_++;
+    ESP_LOGW(TAG, "TX starved: oldest command waiting %u ms for a quiet bus", (unsigned) oldest_age);
+  } else {
+    ESP_LOGI(TAG, "TX starvation cleared");
+  }
+  if (this->tx_starved_binary_sensor_ != nullptr)
+    this->tx_starved_binary_sensor_->publish_state(starved);
+}
+
+void PentairIfIcComponent::log_gap_transmit_(uint32_t since_last_rx) {
+  // Every frame sent while starved would log; once per interval is enough to see it happening
+  uint32_t now = millis();
+  if (this->gap_transmits_logged_ && now - this->last_gap_log_ms_ < GAP_LOG_INTERVAL_MS)
+    return;
+  this->gap_transmits_logged_ = true;
+  this->last_gap_log_ms_ = now;
+  ESP_LOGD(TAG, "Bus starved, transmitting in inter-frame gap (%u ms)", (unsigned) since_last_rx);
+}
+
+void PentairIfIcComponent::finish_in_flight_(CommandResult result, uint8_t error_code) {
+  this->in_flight_active_ = false;
+  if ((result == COMMAND_ACKED || result == COMMAND_REJECTED) && this->in_flight_.attempts > 0) {
+    BusDevice device = this->in_flight_.type == PACKET_TYPE_IF ? BUS_DEVICE_PUMP : BUS_DEVICE_CHLORINATOR;
+    this->stats_.rtt_ms[device].record(millis() - this->in_flight_.sent_ms);
+  }
+  this->complete_command_(this->in_flight_, result, error_code);
+}
+
+void PentairIfIcComponent::set_tx_queue_limit(TxPriority priority, size_t capacity, DropPolicy policy,
+                                              uint32_t max_age_ms) {
+  this->tx_classes_[priority].capacity = capacity;
+  this->tx_classes_[priority].policy = policy;
+  this->tx_classes_[priority].max_age_ms = max_age_ms;
+}
+
+size_t PentairIfIcComponent::tx_queue_high_water() const { return this->tx_high_water_; }
+
+uint32_t PentairIfIcComponent::tx_dropped() const {
+  uint32_t dropped = 0;
+  for (const auto &cls : this->tx_classes_)
+    dropped += cls.dropped;
+  return dropped;
+}
+
+void PentairIfIcComponent::update_stats_(uint32_t loop_start_us) {
+  for (size_t i = 0; i < TX_PRIORITY_COUNT; i++)
+    this->stats_.tx_queue_depth[i] = this->tx_classes_[i].queue.size();
   
-  // Validate checksum
-  int packetchecksum = (packet[packetSize - 2] * 256) + packet[packetSize - 1];
-  int databytes = 0;
-  for (int i = 3; i < packetSize - 2; i++) {
-    databytes += packet[i];
+  // Utilization: wire time of every byte on the bus in the window
+  uint32_t now = millis();
+  uint32_t elapsed = now - this->utilization_window_start_ms_;
+  if (elapsed >= BusStats::UTILIZATION_WINDOW_MS) {
+    uint32_t bytes = this->bus_busy_bytes();
+    uint32_t busy_us = (bytes - this->utilization_window_bytes_) * this->byte_time_us_;
+    this->stats_.utilization_permille = std::min<uint32_t>(busy_us / elapsed, 1000);
+    this->utilization_window_start_ms_ = now;
+    this->utilization_window_bytes_ = bytes;
   }
   
-  bool validPacket = (packetchecksum == databytes);
-  if (!validPacket) {
-    ESP_LOGW(TAG, "IF Asking to queue malformed packet");
-  } else {
-    this->tx_queue_.push(std::make_tuple(PACKET_TYPE_IF, (uint8_t)0, (uint8_t)0, packet));
+  this->stats_.loop_us.record(micros() - loop_start_us);
+}
+
+uint32_t PentairIfIcComponent::tx_entry_key_(PacketType type, const uint8_t *data, size_t len) {
+  // IF: action byte, plus the register address for register writes (0x01)
+  // IC: command byte. Everything after that is the value being set.
+  uint32_t key = (uint32_t) type << 24;
+  if (type == PACKET_TYPE_IF && len > 10) {
+    key |= (uint32_t) data[IF_ACTION_OFFSET] << 16;
+    if (data[IF_ACTION_OFFSET] == 0x01)
+      key |= ((uint32_t) data[9] << 8) | data[10];
+  } else if (type == PACKET_TYPE_IC && len > 3) {
+    key |= (uint32_t) data[3] << 16;
+  }
+  return key;
+}
+
+const char *rx_error_to_str(RxError error) {
+  switch (error) {
+    case RX_ERROR_CHECKSUM:
+      return "checksum";
+    case RX_ERROR_OVERFLOW:
+      return "overflow";
+    default:
+      return "unknown";
+  }
+}
+
+const char *bus_device_to_str(BusDevice device) {
+  switch (device) {
+    case BUS_DEVICE_PUMP:
+      return "pump";
+    case BUS_DEVICE_CHLORINATOR:
+      return "chlorinator";
+    default:
+      return "unknown";
+  }
+}
+
+const char *tx_priority_to_str(TxPriority priority) {
+  switch (priority) {
+    case TX_PRIORITY_CONTROL:
+      return "Control";
+    case TX_PRIORITY_POLL:
+      return "Poll";
+    default:
+      return "Unknown";
+  }
+}
+
+uint32_t PentairIfIcComponent::next_command_id_() {
+  uint32_t id;
+  do {
+    id = this->command_id_counter_.fetch_add(1, std::memory_order_relaxed) & COMMAND_ID_MASK;
+  } while (id == 0);
+  return id;
+}
+
+CommandHandle PentairIfIcComponent::reject_command_(CommandCallback callback) {
+  TxEntry entry;
+  entry.id = this->next_command_id_();
+  entry.callback = std::move(callback);
+  this->complete_command_(entry, COMMAND_DROPPED);
+  return CommandHandle{entry.id};
+}
+
+void PentairIfIcComponent::complete_command_(TxEntry &entry, CommandResult result, uint8_t error_code) {
+  ESP_LOGV(TAG, "Command %u %s", (unsigned) entry.id, command_result_to_str(result));
+  this->command_history_[entry.id % COMMAND_HISTORY].store((entry.id << 3) | result, std::memory_order_release);
+  if (result < COMMAND_UNKNOWN)
+    this->stats_.command_results[result].fetch_add(1, std::memory_order_relaxed);
+  if (entry.callback) {
+    entry.callback(result, error_code);
+    entry.callback = nullptr;
+  }
+}
+
+CommandResult PentairIfIcComponent::command_result(CommandHandle handle) const {
+  if (!handle.valid())
+    return COMMAND_UNKNOWN;
+  uint32_t word = this->command_history_[handle.id % COMMAND_HISTORY].load(std::memory_order_acquire);
+  uint32_t age = (handle.id - (word >> 3)) & COMMAND_ID_MASK;
+  if (age == 0)
+    return static_cast<CommandResult>(word & 0x07);
+  // Slot still holds an older command: this one has not completed yet
+  if (age < (COMMAND_ID_MASK >> 1))
+    return COMMAND_PENDING;
+  return COMMAND_UNKNOWN;
+}
+
+const char *command_result_to_str(CommandResult result) {
+  switch (result) {
+    case COMMAND_PENDING:
+      return "pending";
+    case COMMAND_ACKED:
+      return "acked";
+    case COMMAND_TIMED_OUT:
+      return "timed out";
+    case COMMAND_REJECTED:
+      return "rejected";
+    case COMMAND_DROPPED:
+      return "dropped";
+    case COMMAND_EXPIRED:
+      return "expired";
+    case COMMAND_SUPERSEDED:
+      return "superseded";
+    default:
+      return "unknown";
   }
 }
 
@@ -10,7 +10,15 @@
 #include "esphome/components/uart/uart.h"
 #include "esphome/core/automation.h"
 #include "esphome/core/helpers.h"
-#include <queue>
+#include "command_inbox.h"
+#include "histogram.h"
+#include "pentair_programs.h"
+#include "pentair_units.h"
+#include "pool_state.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
 
 namespace esphome {
 namespace pentair_if_ic {
@@ -27,20 +35,109 @@ enum running : uint8_t {
   RUNNING = 0x0A,
 };
 
-enum program : uint8_t {
-  NO_PROG = 0x00,
-  LOCAL1 = 0x01,
-  LOCAL2 = 0x02,
-  LOCAL3 = 0x03,
-  LOCAL4 = 0x04,
-  EXT1 = 0x09,
-  EXT2 = 0x0A,
-  EXT3 = 0x0B,
-  EXT4 = 0x0C,
-  TIMEOUT = 0x0E,
-  PRIMING = 0x11,
-  QUICKCLEAN = 0x0D,
-  UNKNOWN = 0xFF,
+// Send queue classes, served in strict priority order
+enum TxPriority : uint8_t {
+  TX_PRIORITY_CONTROL = 0,  // User commands: speed, run/stop, programs, SWG output
+  TX_PRIORITY_POLL,         // Periodic status / version / keep-alive requests
+  TX_PRIORITY_COUNT,
+};
+
+const char *tx_priority_to_str(TxPriority priority);
+
+// What to discard when a send queue class is full
+enum DropPolicy : uint8_t {
+  DROP_OLDEST = 0,
+  DROP_NEWEST,
+};
+
+// Outcome of a command submitted to the bus
+enum CommandResult : uint8_t {
+  COMMAND_PENDING = 0,  // Queued or waiting for the device to reply
+  COMMAND_ACKED,        // Device replied to the command
+  COMMAND_TIMED_OUT,    // No reply after all attempts
+  COMMAND_REJECTED,     // Pump replied with an error frame (error code passed along)
+  COMMAND_DROPPED,      // Never sent: invalid arguments or no queue space
+  COMMAND_EXPIRED,      // Never sent: still queued when its deadline passed
+  COMMAND_SUPERSEDED,   // Never sent: replaced by a newer command of the same kind
+  COMMAND_UNKNOWN,      // Handle is invalid or too old to be tracked
+};
+
+const char *command_result_to_str(CommandResult result);
+
+// Completion callback, always invoked on the loop task except for commands
+// dropped at submission, which report synchronously to the caller.
+using CommandCallback = std::function<void(CommandResult result, uint8_t error_code)>;
+
+// Lightweight reference to a submitted command, see command_result()
+struct CommandHandle {
+  uint32_t id{0};
+  bool valid() const { return this->id != 0; }
+};
+
+// Control commands with a common validation and encoding path, so they can be
+// checked up front and queued together (see submit_batch())
+enum PoolCommandType : uint8_t {
+  POOL_COMMAND_RUN = 0,
+  POOL_COMMAND_STOP,
+  POOL_COMMAND_RPM,               // value: 450-3450
+  POOL_COMMAND_LOCAL_PROGRAM,     // value: 0-3 (Local 1-4), as commandLocalProgram()
+  POOL_COMMAND_EXTERNAL_PROGRAM,  // value: 0 clears, 1-4 select
+  POOL_COMMAND_SWG_PERCENT,       // value: 0-100
+  POOL_COMMAND_TYPE_COUNT,
+};
+
+const char *pool_command_type_to_str(PoolCommandType type);
+
+struct PoolCommand {
+  PoolCommandType type;
+  int32_t value;
+};
+
+// Why command cannot be sent, or nullptr if it is valid
+const char *validate_pool_command(const PoolCommand &command);
+
+// Whether two commands set the same thing (run and stop both set the motor
+// state), so that queuing both would have the later supersede the earlier
+bool pool_commands_conflict(PoolCommandType a, PoolCommandType b);
+
+// Received frames thrown away as corrupt
+enum RxError : uint8_t {
+  RX_ERROR_CHECKSUM = 0,  // IntelliFlo checksum mismatch
+  RX_ERROR_OVERFLOW,      // IntelliChlor frame without an end marker within 64 bytes
+  RX_ERROR_COUNT,
+};
+
+const char *rx_error_to_str(RxError error);
+
+// Bus devices, in the order BusStats arrays are indexed
+enum BusDevice : uint8_t {
+  BUS_DEVICE_PUMP = 0,
+  BUS_DEVICE_CHLORINATOR,
+  BUS_DEVICE_COUNT,
+};
+
+const char *bus_device_to_str(BusDevice device);
+
+static const uint32_t RTT_BOUNDS_MS[] = {25, 50, 100, 200, 500, 1000, 2000};
+static const uint32_t LOOP_BOUNDS_US[] = {100, 500, 1000, 5000, 10000, 30000, 100000};
+
+// Counters for scraping (see bus_stats()). Written by loop() except
+// command_results, which also counts commands dropped on submitting tasks.
+// Readers on other tasks get each field whole but no snapshot across fields.
+struct BusStats {
+  uint32_t rx_bytes{0};  // Read from the UART, not counting our suppressed echoes (see bus_busy_bytes())
+  uint32_t tx_bytes{0};
+  uint32_t rx_frames[BUS_DEVICE_COUNT]{};
+  uint32_t rx_errors[RX_ERROR_COUNT]{};
+  uint16_t utilization_permille{0};  // Bus busy time over the last UTILIZATION_WINDOW_MS
+  uint32_t tx_queue_depth[TX_PRIORITY_COUNT]{};
+  uint32_t inbox_high_water{0};  // Most entries drained from the command inbox in one loop()
+  std::atomic<uint32_t> command_results[COMMAND_UNKNOWN]{};
+  // Command submitted to reply, last attempt only, for acked and rejected commands
+  Histogram<7> rtt_ms[BUS_DEVICE_COUNT]{Histogram<7>(RTT_BOUNDS_MS), Histogram<7>(RTT_BOUNDS_MS)};
+  Histogram<7> loop_us{LOOP_BOUNDS_US};
+
+  static const uint32_t UTILIZATION_WINDOW_MS = 10000;
 };
 
 class PentairIfIcComponent : public PollingComponent, public uart::UARTDevice {
@@ -62,6 +159,12 @@ class PentairIfIcComponent : public PollingComponent, public uart::UARTDevice {
   SUB_BINARY_SENSOR(low_volts)
   SUB_BINARY_SENSOR(low_temp)
   SUB_BINARY_SENSOR(check_pcb)
+  // Bus diagnostics
+  SUB_SENSOR(tx_queue_high_water)
+  SUB_SENSOR(tx_dropped)
+  SUB_SENSOR(tx_expired)
+  SUB_SENSOR(tx_collisions)
+  SUB_BINARY_SENSOR(tx_starved)
 
  public:
   void setup() override;
@@ -76,18 +179,80 @@ class PentairIfIcComponent : public PollingComponent, public uart::UARTDevice {
   void set_swg_percent();
   void set_takeover_mode(bool enable);
   
-  // IntelliFlo methods
-  void requestPumpStatus();
-  void run();
-  void stop();
-  void commandLocalProgram(int prog);
-  void commandExternalProgram(int prog);
-  void saveValueForProgram(int prog, int value);
-  void commandRPM(int rpm);
-  void commandFlow(int flow);
-  void pumpToLocalControl();
-  void pumpToRemoteControl();
-  void setPumpClock(int hour, int minute);
+  // Chlorinator output without the takeover switch / rate limit path
+  CommandHandle command_swg_percent(uint8_t percent, CommandCallback callback = nullptr);
+  
+  // IntelliFlo methods. Each returns a handle and optionally takes a callback
+  // fired once the pump acknowledges, rejects or fails to answer the command.
+  CommandHandle requestPumpStatus(CommandCallback callback = nullptr);
+  CommandHandle run(CommandCallback callback = nullptr);
+  CommandHandle stop(CommandCallback callback = nullptr);
+  CommandHandle commandLocalProgram(int prog, CommandCallback callback = nullptr);
+  CommandHandle commandExternalProgram(int prog, CommandCallback callback = nullptr);
+  CommandHandle saveValueForProgram(int prog, int value, CommandCallback callback = nullptr);
+  CommandHandle commandRPM(int rpm, CommandCallback callback = nullptr);
+  CommandHandle commandFlow(int flow, CommandCallback callback = nullptr);
+  CommandHandle pumpToLocalControl(CommandCallback callback = nullptr);
+  CommandHandle pumpToRemoteControl(CommandCallback callback = nullptr);
+  CommandHandle setPumpClock(int hour, int minute, CommandCallback callback = nullptr);
+
+  // Any single control command; run(), commandRPM() etc. are shorthands for it
+  CommandHandle submit_command(const PoolCommand &command, CommandCallback callback = nullptr);
+  
+  // Queues commands as one unit. All are validated before anything is queued,
+  // and inbox slots for the whole batch are reserved at once, so the batch
+  // reaches the send queue contiguously and in order, or not at all. handles[i]
+  // receives the handle of commands[i]; callbacks may be nullptr and is consumed.
+  // A batch may hold at most max_batch() commands, no two of which conflict
+  // (see pool_commands_conflict()), so no member evicts or supersedes another
+  // in the send queue. If the control queue drops new commands when full and
+  // cannot take the whole batch, all of it is dropped.
+  // Returns false if a command is invalid or the inbox has no room for all of
+  // them; nothing is queued then and no callback fires.
+  static constexpr size_t MAX_BATCH = 8;
+  bool submit_batch(const PoolCommand *commands, size_t count, CommandCallback *callbacks, CommandHandle *handles);
+  size_t max_batch() const { return std::min(MAX_BATCH, this->tx_classes_[TX_PRIORITY_CONTROL].capacity); }
+  
+  // Result of a submitted command; safe to poll from any task
+  CommandResult command_result(CommandHandle handle) const;
+
+  // Consistent snapshot of all decoded state, safe to call from any task.
+  // Returns the snapshot generation; compare with state_generation() to detect staleness.
+  uint32_t read_state(PoolState &out) const { return this->state_.read(out); }
+  uint32_t state_generation() const { return this->state_.generation(); }
+
+  // Send queue bounds, per priority class
+  void set_tx_queue_limit(TxPriority priority, size_t capacity, DropPolicy policy, uint32_t max_age_ms);
+  // Highest combined depth of all classes at any one time
+  size_t tx_queue_high_water() const;
+  uint32_t tx_dropped() const;
+  uint32_t tx_expired() const { return this->tx_expired_; }
+  void set_rx_frame_gap(uint32_t gap_us) { this->rx_frame_gap_us_ = gap_us; }
+  uint32_t rx_gap_discards() const { return this->rx_gap_discards_; }
+  void set_echo_suppression(bool enable) { this->echo_suppression_ = enable; }
+  // The transceiver reads our own frames back, whether or not they are suppressed
+  void set_transceiver_echo(bool echo) { this->transceiver_echo_ = echo; }
+  uint32_t rx_echo_frames() const { return this->rx_echo_frames_; }
+  uint32_t tx_collisions() const { return this->tx_collisions_; }
+  // Frames whose echo never (fully) came back; not counted as collisions
+  uint32_t rx_missing_echoes() const { return this->rx_missing_echoes_; }
+  void set_tx_starvation_threshold(uint32_t threshold_ms) { this->tx_starvation_threshold_ms_ = threshold_ms; }
+  bool is_tx_starved() const { return this->tx_starved_; }
+  uint32_t tx_starvation_events() const { return this->tx_starvation_events_; }
+  // Per class; the loop() snapshot for depth, so any task may read it
+  size_t tx_queue_depth(TxPriority priority) const { return this->stats_.tx_queue_depth[priority]; }
+  size_t tx_queue_capacity(TxPriority priority) const { return this->tx_classes_[priority].capacity; }
+  size_t tx_queue_high_water(TxPriority priority) const { return this->tx_classes_[priority].high_water; }
+  uint32_t tx_dropped(TxPriority priority) const { return this->tx_classes_[priority].dropped; }
+  // Traffic, error, latency and loop timing counters
+  const BusStats &bus_stats() const { return this->stats_; }
+  uint32_t byte_time_us() const { return this->byte_time_us_; }
+  // Bytes that occupied the wire. Echoes that are read back but not suppressed
+  // are already in rx_bytes, so tx_bytes would count them twice.
+  uint32_t bus_busy_bytes() const {
+    bool echoes_in_rx = this->transceiver_echo_ && !this->echo_suppression_;
+    return this->stats_.rx_bytes + (echoes_in_rx ? 0 : this->stats_.tx_bytes);
+  }
 
   void set_flow_control_pin(GPIOPin *flow_control_pin) { this->flow_control_pin_ = flow_control_pin; }
 
@@ -107,16 +272,32 @@ class PentairIfIcComponent : public PollingComponent, public uart::UARTDevice {
   // Common receive buffer
   std::vector<uint8_t> rx_buffer_;
   uint32_t last_received_byte_millis_ = 0;
+  
+  // Receive timing, micros() resolution. Bytes reach us in chunks from the UART
+  // driver, so an idle gap is only trusted beyond the driver's delivery latency.
+  static constexpr size_t RX_CHUNK_SIZE = 64;
+  uint32_t last_rx_us_{0};         // When the last chunk was read
+  uint32_t byte_time_us_{1042};    // One byte on the wire, from the UART baud rate
+  uint32_t rx_latency_us_{10420};  // Driver delivery latency, from the UART baud rate
+  uint32_t rx_frame_gap_us_{10000};
+  uint32_t rx_gap_discards_{0};
+  void feed_rx_byte_(uint8_t c);
+  void discard_partial_frame_(uint32_t idle_us);
   uint32_t last_tx_millis_ = 0;  // Track last transmission time for bus arbitration
   
+  // Decoded state: working copy owned by loop(), published through the seqlock
+  PoolState state_working_{};
+  SeqLock<PoolState> state_;
+  
   // IntelliChlor specific
   void get_ic_version_();
   void get_ic_temp_();
   void get_ic_more_();
   void ic_takeover_();
-  void ic_set_percent_(uint8_t percent);
-  void send_ic_command_(const uint8_t *command, int command_len, uint8_t retries);
+  CommandHandle send_ic_command_(const uint8_t *command, int command_len, uint8_t retries,
+                                 CommandCallback callback = nullptr, TxPriority priority = TX_PRIORITY_CONTROL);
   bool parse_ic_packet_();
+  void commit_chlorinator_state_();
   
   // Packet type enumeration
   enum PacketType : uint8_t {
@@ -124,20 +305,125 @@ class PentairIfIcComponent : public PollingComponent, public uart::UARTDevice {
     PACKET_TYPE_IC = 1
   };
   
-  // Unified send queue: <type, retries, attempts, data>
-  std::queue<std::tuple<PacketType, uint8_t, uint8_t, std::vector<uint8_t>>> tx_queue_;
+  static const size_t TX_MAX_PACKET = 24;
+  // Offset of the action byte in a queued IF packet (after the FF 00 FF preamble)
+  static const size_t IF_ACTION_OFFSET = 7;
+  static const uint32_t IF_ACK_TIMEOUT_MS = 500;
+  // Resends of an IF control command after a collision or an unanswered attempt
+  static const uint8_t IF_CONTROL_RETRIES = 1;
+  
+  struct TxEntry {
+    PacketType type;
+    TxPriority priority;
+    uint8_t retries;
+    uint8_t attempts;
+    uint8_t len;
+    uint32_t id;
+    uint32_t key;          // Commands with the same key replace each other while queued
+    uint32_t queued_ms;    // millis() when the command was submitted
+    uint32_t deadline_ms;  // millis() after which the entry is discarded unsent
+    uint32_t sent_ms;      // millis() of the last transmission
+    uint8_t batch_len;     // Set on the first entry of a batch: entries in it
+    uint8_t data[TX_MAX_PACKET];
+    CommandCallback callback;
+  };
+  
+  // Bounded send queue per priority class
+  struct TxClass {
+    std::deque<TxEntry> queue;
+    size_t capacity;
+    DropPolicy policy;
+    uint32_t max_age_ms;  // Deadline given to entries of this class
+    size_t high_water;
+    uint32_t dropped;
+  };
+  TxClass tx_classes_[TX_PRIORITY_COUNT]{
+      {{}, 8, DROP_OLDEST, 30000, 0, 0},  // Control: newer commands supersede stale ones
+      {{}, 4, DROP_NEWEST, 5000, 0, 0},   // Poll: an identical request is already waiting
+  };
+  uint32_t tx_expired_{0};
+  uint8_t batch_drop_left_{0};  // Rest of a batch being dropped as a whole
+  size_t tx_high_water_{0};  // Deepest all classes have been together
+  
+  // Starvation: bus never idle long enough for the normal 100 ms quiet gate
+  static const uint32_t TX_SLOT_GAP_MS = 20;  // Min gap after a complete frame when starved
+  uint32_t tx_starvation_threshold_ms_{2000};
+  bool tx_starved_{false};
+  uint32_t tx_starvation_events_{0};
+  void update_tx_starvation_();
+  static const uint32_t GAP_LOG_INTERVAL_MS = 10000;
+  bool gap_transmits_logged_{false};
+  uint32_t last_gap_log_ms_{0};
+  void log_gap_transmit_(uint32_t since_last_rx);
+  
+  BusStats stats_;
+  uint32_t utilization_window_start_ms_{0};
+  uint32_t utilization_window_bytes_{0};
+  void update_stats_(uint32_t loop_start_us);
+  
+  // The command currently on the wire / awaiting its reply
+  TxEntry in_flight_;
+  bool in_flight_active_{false};
+  bool next_tx_entry_(TxEntry &out);
+  static uint32_t tx_entry_key_(PacketType type, const uint8_t *data, size_t len);
+  void finish_in_flight_(CommandResult result, uint8_t error_code = 0);
+  
+  // Echo suppression: transceivers that loop TX back onto RX hand us our own
+  // frame first. It is matched byte for byte against what we sent and never
+  // reaches the framer; a mismatch means another node talked over us.
+  bool echo_suppression_{false};
+  bool transceiver_echo_{false};
+  uint8_t echo_frame_[TX_MAX_PACKET];  // Copy of the frame on the wire
+  uint8_t echo_len_{0};               // 0 = not expecting an echo
+  uint8_t echo_pos_{0};               // Bytes matched so far
+  uint32_t echo_armed_us_{0};
+  uint32_t rx_echo_frames_{0};
+  uint32_t tx_collisions_{0};
+  uint32_t rx_missing_echoes_{0};
+  void arm_echo_(const uint8_t *data, size_t len);
+  bool match_echo_(uint8_t c);
+  void abandon_echo_();
+  
+  // Command methods may run on web server / API tasks; they only ever post
+  // here and loop() moves the entries into the send queues.
+  MpscRing<TxEntry, 16> tx_inbox_;
+  CommandHandle post_packet_(PacketType type, TxPriority priority, uint8_t retries, const uint8_t *data, size_t len,
+                             CommandCallback callback);
+  CommandHandle push_entry_(TxEntry &entry);
+  // Everything but the callback; len must not exceed TX_MAX_PACKET
+  void fill_entry_(TxEntry &entry, PacketType type, TxPriority priority, uint8_t retries, const uint8_t *data,
+                   size_t len);
+  // Validates command and builds its frame into entry; false if invalid
+  bool encode_command_(const PoolCommand &command, TxEntry &entry);
+  void note_submitted_(const PoolCommand &command);
+  // Wire framing into out[TX_MAX_PACKET]; return the frame length, 0 if it does not fit
+  static size_t frame_if_packet_(const uint8_t *message, size_t len, uint8_t *out);
+  static size_t frame_ic_command_(const uint8_t *command, size_t len, uint8_t *out);
+  void drain_inbox_();
+  
+  // Command completion tracking. Results of the last COMMAND_HISTORY commands
+  // are kept as (id << 3) | result so any task can poll a handle.
+  static const uint32_t COMMAND_ID_MASK = 0x1FFFFFFF;
+  static const size_t COMMAND_HISTORY = 32;
+  std::atomic<uint32_t> command_id_counter_{1};
+  std::atomic<uint32_t> command_history_[COMMAND_HISTORY]{};
+  uint32_t next_command_id_();
+  CommandHandle reject_command_(CommandCallback callback);
+  void complete_command_(TxEntry &entry, CommandResult result, uint8_t error_code = 0);
   
   uint32_t ic_last_command_timestamp_;
   uint32_t ic_last_recv_timestamp_;
   uint32_t ic_last_loop_timestamp_;
-  uint8_t ic_last_set_percent_ = 0;
+  // Written by submitting tasks (note_submitted_()), read by loop()
+  std::atomic<uint8_t> ic_last_set_percent_{0};
   bool ic_run_again_;
   std::string ic_version_;
   
   // IntelliFlo specific
   void parse_if_packet_(const std::vector<uint8_t> &data);
   bool validate_if_received_message_();
-  void queue_if_packet_(uint8_t message[], int messageLength);
+  CommandHandle queue_if_packet_(uint8_t message[], int messageLength, CommandCallback callback,
+                                 TxPriority priority = TX_PRIORITY_CONTROL);
   
   sensor::Sensor *if_power_{nullptr};
   sensor::Sensor *if_rpm_{nullptr};
@@ -147,6 +433,7 @@ class PentairIfIcComponent : public PollingComponent, public uart::UARTDevice {
   sensor::Sensor *if_clock_{nullptr};
   binary_sensor::BinarySensor *if_running_{nullptr};
   text_sensor::TextSensor *if_program_{nullptr};
+  const ProgramDescriptor *if_last_program_{nullptr};  // Last published program
 
   // Helper method
   template<typename... Args>
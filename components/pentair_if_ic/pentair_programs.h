@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace pentair_if_ic {
+
+// IntelliFlo program codes (status frame byte 7)
+enum program : uint8_t {
+  NO_PROG = 0x00,
+  LOCAL1 = 0x01,
+  LOCAL2 = 0x02,
+  LOCAL3 = 0x03,
+  LOCAL4 = 0x04,
+  EXT1 = 0x09,
+  EXT2 = 0x0A,
+  EXT3 = 0x0B,
+  EXT4 = 0x0C,
+  TIMEOUT = 0x0E,
+  PRIMING = 0x11,
+  QUICKCLEAN = 0x0D,
+  UNKNOWN = 0xFF,
+};
+
+enum ProgramKind : uint8_t {
+  PROGRAM_KIND_NONE = 0,
+  PROGRAM_KIND_LOCAL,
+  PROGRAM_KIND_EXTERNAL,
+  PROGRAM_KIND_SPECIAL,
+};
+
+struct ProgramDescriptor {
+  uint8_t code;
+  const char *name;
+  ProgramKind kind;
+  uint8_t index;  // 1-based slot for local/external programs, 0 otherwise
+};
+
+// Single source of truth for program names, shared by the decoder, the
+// command validators and anything serializing pump state for the web.
+inline constexpr ProgramDescriptor PROGRAMS[] = {
+    {NO_PROG, "", PROGRAM_KIND_NONE, 0},
+    {LOCAL1, "Local 1", PROGRAM_KIND_LOCAL, 1},
+    {LOCAL2, "Local 2", PROGRAM_KIND_LOCAL, 2},
+    {LOCAL3, "Local 3", PROGRAM_KIND_LOCAL, 3},
+    {LOCAL4, "Local 4", PROGRAM_KIND_LOCAL, 4},
+    {EXT1, "External 1", PROGRAM_KIND_EXTERNAL, 1},
+    {EXT2, "External 2", PROGRAM_KIND_EXTERNAL, 2},
+    {EXT3, "External 3", PROGRAM_KIND_EXTERNAL, 3},
+    {EXT4, "External 4", PROGRAM_KIND_EXTERNAL, 4},
+    {TIMEOUT, "Time Out", PROGRAM_KIND_SPECIAL, 0},
+    {PRIMING, "Priming", PROGRAM_KIND_SPECIAL, 0},
+    {QUICKCLEAN, "Quick Clean", PROGRAM_KIND_SPECIAL, 0},
+};
+inline constexpr size_t PROGRAM_COUNT = sizeof(PROGRAMS) / sizeof(PROGRAMS[0]);
+
+// Lookup by status frame code, nullptr if unknown
+inline constexpr const ProgramDescriptor *find_program(uint8_t code) {
+  for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+    if (PROGRAMS[i].code == code)
+      return &PROGRAMS[i];
+  }
+  return nullptr;
+}
+
+// Lookup by kind and 1-based slot, nullptr if there is no such program
+inline constexpr const ProgramDescriptor *find_program(ProgramKind kind, uint8_t index) {
+  for (size_t i = 0; i < PROGRAM_COUNT; i++) {
+    if (PROGRAMS[i].kind == kind && PROGRAMS[i].index == index)
+      return &PROGRAMS[i];
+  }
+  return nullptr;
+}
+
+static_assert(find_program(LOCAL3)->index == 3, "program table out of order");
+static_assert(find_program(PROGRAM_KIND_EXTERNAL, 4)->code == EXT4, "program table out of order");
+static_assert(find_program(UNKNOWN) == nullptr, "UNKNOWN must not be a named program");
+
+}  // namespace pentair_if_ic
+}  // namespace esphome
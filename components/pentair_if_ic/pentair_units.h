@@ -0,0 +1,52 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+#include <cstdint>
+
+namespace esphome {
+namespace pentair_if_ic {
+
+// IntelliFlo reports flow as whole GPM and pressure as whole PSI. Conversions
+// are done in integer thousandths of the output unit so the decode path never
+// touches double precision (software emulated on the ESP32-S3). The output
+// unit is selected at compile time by the sensor platform:
+//   USE_PENTAIR_FLOW_GPM      flow in GPM        (default m3/h)
+//   USE_PENTAIR_PRESSURE_PSI  pressure in PSI    (default bar)
+
+// 1 GPM = 0.227 m3/h (same factor the decoder has always used)
+static const uint32_t MILLI_M3H_PER_GPM = 227;
+// 1 bar = 14.504 PSI, kept as an integer ratio: bar = psi * 1000 / 14504
+static const uint32_t PSI_PER_KILOBAR = 14504;
+
+// Flow in thousandths of the configured unit
+inline constexpr uint32_t flow_milli(uint8_t gpm) {
+#ifdef USE_PENTAIR_FLOW_GPM
+  return gpm * 1000u;
+#else
+  return gpm * MILLI_M3H_PER_GPM;
+#endif
+}
+
+// Pressure in thousandths of the configured unit, rounded to nearest
+inline constexpr uint32_t pressure_milli(uint8_t psi) {
+#ifdef USE_PENTAIR_PRESSURE_PSI
+  return psi * 1000u;
+#else
+  return (psi * 1000000u + PSI_PER_KILOBAR / 2) / PSI_PER_KILOBAR;
+#endif
+}
+
+// Single precision scale for publish_state(); FPU multiply, no division
+inline float milli_to_float(uint32_t milli) { return milli * 0.001f; }
+
+static_assert(flow_milli(0) == 0, "flow conversion must be zero based");
+#ifndef USE_PENTAIR_FLOW_GPM
+static_assert(flow_milli(100) == 22700, "100 GPM is 22.700 m3/h");
+#endif
+#ifndef USE_PENTAIR_PRESSURE_PSI
+static_assert(pressure_milli(29) == 1999, "29 PSI is 1.999 bar");
+static_assert(pressure_milli(255) == 17581, "max raw pressure must not overflow");
+#endif
+
+}  // namespace pentair_if_ic
+}  // namespace esphome
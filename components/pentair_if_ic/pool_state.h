@@ -0,0 +1,84 @@
+#pragma once
+
+#include "esphome/core/hal.h"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace esphome {
+namespace pentair_if_ic {
+
+// Decoded pump + chlorinator state, committed as one unit per frame so readers
+// never see new RPM next to old power. Units match pentair_units.h.
+struct PoolState {
+  // IntelliFlo, from the 0x07 status frame
+  uint32_t pump_updated_ms;  // millis() of the last status frame, 0 = never
+  uint16_t power_w;
+  uint16_t rpm;
+  uint32_t flow_milli;
+  uint32_t pressure_milli;
+  uint16_t time_remaining_min;
+  uint16_t clock_min;
+  uint8_t program;  // Raw program code, see pentair_programs.h
+  bool running;
+
+  // IntelliChlor, merged from the version/temp/set responses
+  uint32_t chlor_updated_ms;  // millis() of the last IC response, 0 = never
+  uint16_t salt_ppm;
+  uint8_t water_temp;
+  uint8_t error_flags;  // Alarm bits, same layout as the error sensor
+  uint8_t set_percent;
+  uint8_t status;
+};
+
+// Names of the PoolState::error_flags bits, bit 0 first; same order as the
+// alarm binary sensors
+inline constexpr const char *ALARM_NAMES[8] = {
+    "no_flow", "low_salt", "high_salt", "clean", "high_current", "low_volts", "low_temp", "check_pcb",
+};
+
+// Single-writer sequence lock. The writer (the component's loop) bumps the
+// sequence to odd, copies, then bumps it to even; readers on any task retry
+// until they copy between two identical even sequences. Reads are lock-free
+// and never block the writer.
+template<typename T> class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable type");
+
+ public:
+  // Writer side, must only be called from one task
+  void write(const T &value) {
+    uint32_t seq = this->seq_.load(std::memory_order_relaxed);
+    this->seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&this->value_, &value, sizeof(T));
+    this->seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  // Copies a consistent snapshot into out and returns its generation
+  // (number of completed writes). Safe from any task.
+  uint32_t read(T &out) const {
+    for (uint32_t spins = 0;; spins++) {
+      uint32_t before = this->seq_.load(std::memory_order_acquire);
+      if ((before & 1) == 0) {
+        memcpy(&out, &this->value_, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (this->seq_.load(std::memory_order_relaxed) == before)
+          return before / 2;
+      }
+      // A higher priority reader must let a preempted writer finish
+      if (spins >= 8)
+        delay(1);
+    }
+  }
+
+  // Generation of the latest complete write; cheap staleness check
+  uint32_t generation() const { return this->seq_.load(std::memory_order_acquire) / 2; }
+
+ protected:
+  std::atomic<uint32_t> seq_{0};
+  T value_{};
+};
+
+}  // namespace pentair_if_ic
+}  // namespace esphome
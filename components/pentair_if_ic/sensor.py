@@ -2,12 +2,16 @@ import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import sensor
 from esphome.const import (
+    CONF_UNIT_OF_MEASUREMENT,
     DEVICE_CLASS_POWER,
     DEVICE_CLASS_VOLUME_FLOW_RATE,
     DEVICE_CLASS_PRESSURE,
     DEVICE_CLASS_DURATION,
     DEVICE_CLASS_TEMPERATURE,
     DEVICE_CLASS_VOLATILE_ORGANIC_COMPOUNDS_PARTS,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_WATT,
     UNIT_REVOLUTIONS_PER_MINUTE,
     UNIT_CUBIC_METER_PER_HOUR,
@@ -26,6 +30,18 @@ CONF_FLOW = "flow"
 CONF_PRESSURE = "pressure"
 CONF_TIME_REMAINING = "time_remaining"
 CONF_CLOCK = "clock"
+CONF_FLOW_UNIT = "flow_unit"
+CONF_PRESSURE_UNIT = "pressure_unit"
+
+# Output units, selected at compile time (see pentair_units.h)
+FLOW_UNITS = {
+    "M3H": UNIT_CUBIC_METER_PER_HOUR,
+    "GPM": "GPM",
+}
+PRESSURE_UNITS = {
+    "BAR": "bar",
+    "PSI": "PSI",
+}
 
 # IntelliChlor sensors
 CONF_SALT_PPM = "salt_ppm"
@@ -34,6 +50,24 @@ CONF_STATUS = "status"
 CONF_ERROR = "error"
 CONF_SET_PERCENT = "set_percent"
 
+# Bus diagnostics
+CONF_TX_QUEUE_HIGH_WATER = "tx_queue_high_water"
+CONF_TX_DROPPED = "tx_dropped"
+CONF_TX_EXPIRED = "tx_expired"
+CONF_TX_COLLISIONS = "tx_collisions"
+
+
+def _default_units(config):
+    # Unit of measurement follows the selected output unit unless overridden
+    if (flow := config.get(CONF_FLOW)) is not None:
+        flow.setdefault(CONF_UNIT_OF_MEASUREMENT, FLOW_UNITS[config[CONF_FLOW_UNIT]])
+    if (pressure := config.get(CONF_PRESSURE)) is not None:
+        pressure.setdefault(
+            CONF_UNIT_OF_MEASUREMENT, PRESSURE_UNITS[config[CONF_PRESSURE_UNIT]]
+        )
+    return config
+
+
 CONFIG_SCHEMA = cv.Schema(
     {
         cv.GenerateID(CONF_PENTAIR_IF_IC_ID): cv.use_id(PentairIfIcComponent),
@@ -47,13 +81,13 @@ CONFIG_SCHEMA = cv.Schema(
             unit_of_measurement=UNIT_REVOLUTIONS_PER_MINUTE,
             accuracy_decimals=0,
         ),
+        cv.Optional(CONF_FLOW_UNIT, default="M3H"): cv.one_of(*FLOW_UNITS, upper=True),
+        cv.Optional(CONF_PRESSURE_UNIT, default="BAR"): cv.one_of(*PRESSURE_UNITS, upper=True),
         cv.Optional(CONF_FLOW): sensor.sensor_schema(
-            unit_of_measurement=UNIT_CUBIC_METER_PER_HOUR,
             accuracy_decimals=2,
             device_class=DEVICE_CLASS_VOLUME_FLOW_RATE,
         ),
         cv.Optional(CONF_PRESSURE): sensor.sensor_schema(
-            unit_of_measurement="bar",
             accuracy_decimals=3,
             device_class=DEVICE_CLASS_PRESSURE,
         ),
@@ -81,13 +115,39 @@ CONFIG_SCHEMA = cv.Schema(
         cv.Optional(CONF_SET_PERCENT): sensor.sensor_schema(
             unit_of_measurement=UNIT_PERCENT,
         ),
+        # Bus diagnostics
+        cv.Optional(CONF_TX_QUEUE_HIGH_WATER): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_TX_DROPPED): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_TX_EXPIRED): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_TX_COLLISIONS): sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
     }
-)
+).add_extra(_default_units)
 
 
 async def to_code(config):
     var = await cg.get_variable(config[CONF_PENTAIR_IF_IC_ID])
     
+    if config[CONF_FLOW_UNIT] == "GPM":
+        cg.add_define("USE_PENTAIR_FLOW_GPM")
+    if config[CONF_PRESSURE_UNIT] == "PSI":
+        cg.add_define("USE_PENTAIR_PRESSURE_PSI")
+    
     # IntelliFlo sensors
     if power_config := config.get(CONF_POWER):
         sens = await sensor.new_sensor(power_config)
@@ -133,3 +193,20 @@ async def to_code(config):
     if set_percent_config := config.get(CONF_SET_PERCENT):
         sens = await sensor.new_sensor(set_percent_config)
         cg.add(var.set_set_percent_sensor(sens))
+    
+    # Bus diagnostics
+    if high_water_config := config.get(CONF_TX_QUEUE_HIGH_WATER):
+        sens = await sensor.new_sensor(high_water_config)
+        cg.add(var.set_tx_queue_high_water_sensor(sens))
+    
+    if dropped_config := config.get(CONF_TX_DROPPED):
+        sens = await sensor.new_sensor(dropped_config)
+        cg.add(var.set_tx_dropped_sensor(sens))
+    
+    if expired_config := config.get(CONF_TX_EXPIRED):
+        sens = await sensor.new_sensor(expired_config)
+        cg.add(var.set_tx_expired_sensor(sens))
+    
+    if collisions_config := config.get(CONF_TX_COLLISIONS):
+        sens = await sensor.new_sensor(collisions_config)
+        cg.add(var.set_tx_collisions_sensor(sens))
@@ -0,0 +1,67 @@
+// Encodes the same pool snapshot as JSON and as CBOR and reports the size and
+// time per document. Only the sizes are checked; timings vary by host.
+#include "esphome/components/custom_web_handler/pool_snapshot.h"
+#include "test.h"
+#include <chrono>
+
+using namespace esphome::custom_web_handler;
+using esphome::pentair_if_ic::PoolState;
+
+static const uint32_t ITERATIONS = 200000;
+
+// Same as typical_state() in test_pool_snapshot.cpp
+static PoolState typical_state() {
+  PoolState state{};
+  state.pump_updated_ms = 4000;
+  state.power_w = 612;
+  state.rpm = 2450;
+  state.flow_milli = 11350;
+  state.pressure_milli = 827;
+  state.time_remaining_min = 95;
+  state.clock_min = 754;
+  state.program = 2;
+  state.running = true;
+  state.chlor_updated_ms = 3000;
+  state.salt_ppm = 3250;
+  state.water_temp = 27;
+  state.set_percent = 40;
+  state.status = 0x80;
+  state.error_flags = 0x05;
+  return state;
+}
+
+// Runs encode ITERATIONS times with a changing generation so no call can be
+// skipped; returns ns per document, and the length of the last one in len.
+template<typename Encode> static double time_per_doc(Encode encode, size_t *len) {
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ITERATIONS; i++)
+    total += *len = encode(412 + (i & 0xFF));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  CHECK(total > 0);
+  return std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+}
+
+int main() {
+  PoolState state = typical_state();
+  char json[POOL_STATE_JSON_SIZE];
+  uint8_t cbor[POOL_STATE_CBOR_SIZE];
+  size_t json_len = 0, cbor_len = 0;
+
+  double json_ns = time_per_doc(
+      [&](uint32_t generation) { return write_pool_state_json(json, sizeof(json), state, generation, 5000); },
+      &json_len);
+  double cbor_ns = time_per_doc(
+      [&](uint32_t generation) { return write_pool_state_cbor(cbor, sizeof(cbor), state, generation, 5000); },
+      &cbor_len);
+
+  printf("%u encodes of a running pump and chlorinator\n", (unsigned) ITERATIONS);
+  printf("JSON %4zu bytes %8.1f ns/doc\n", json_len, json_ns);
+  printf("CBOR %4zu bytes %8.1f ns/doc\n", cbor_len, cbor_ns);
+  printf("CBOR is %.1fx smaller and %.1fx faster\n", (double) json_len / cbor_len, json_ns / cbor_ns);
+
+  // The README promises about a tenth of the JSON size
+  CHECK(cbor_len > 0);
+  CHECK(cbor_len * 8 < json_len);
+  return test_result();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// The esp_http_client calls url_proxy.cpp makes. Responses come from the
+// scripted upstreams in host.h instead of the network.
+#include <cstdint>
+
+typedef int esp_err_t;
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum {
+  HTTP_METHOD_GET = 0,
+} esp_http_client_method_t;
+
+typedef struct {
+  const char *url;
+  int timeout_ms;
+  esp_http_client_method_t method;
+  esp_err_t (*crt_bundle_attach)(void *conf);
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
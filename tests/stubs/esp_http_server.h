@@ -0,0 +1,58 @@
+#pragma once
+
+// The httpd calls the components make. Requests are plain structs; what is
+// sent on them is recorded for the tests, see host::response().
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+typedef int esp_err_t;
+#ifndef ESP_OK
+#define ESP_OK 0
+#endif
+#define ESP_FAIL -1
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_HTTPD_RESULT_TRUNC 0xb004
+
+const char *esp_err_to_name(esp_err_t code);
+
+typedef void *httpd_handle_t;
+
+enum http_method {
+  HTTP_DELETE = 0,
+  HTTP_GET = 1,
+  HTTP_HEAD = 2,
+  HTTP_POST = 3,
+  HTTP_PUT = 4,
+  HTTP_OPTIONS = 6,
+};
+
+typedef struct httpd_req {
+  httpd_handle_t handle;
+  int method;
+  char uri[513];  // const in ESP-IDF; written by host::new_request()
+  size_t content_len;
+  void *user_ctx;
+  void *sess_ctx;
+} httpd_req_t;
+
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_200 "200 OK"
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len);
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size);
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len);
+int httpd_req_to_sockfd(httpd_req_t *r);
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r);
+
+typedef void (*httpd_work_fn_t)(void *arg);
+// Runs work at once, on the calling thread
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
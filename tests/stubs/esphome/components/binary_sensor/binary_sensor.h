@@ -0,0 +1,18 @@
+#pragma once
+
+#define SUB_BINARY_SENSOR(name) \
+ protected: \
+  esphome::binary_sensor::BinarySensor *name##_binary_sensor_{nullptr}; \
+\
+ public: \
+  void set_##name##_binary_sensor(esphome::binary_sensor::BinarySensor *sensor) { this->name##_binary_sensor_ = sensor; }
+
+namespace esphome {
+namespace binary_sensor {
+class BinarySensor {
+ public:
+  void publish_state(bool state) { this->state = state; }
+  bool state{false};
+};
+}  // namespace binary_sensor
+}  // namespace esphome
@@ -0,0 +1,22 @@
+#pragma once
+
+#define SUB_NUMBER(name) \
+ protected: \
+  esphome::number::Number *name##_number_{nullptr}; \
+\
+ public: \
+  void set_##name##_number(esphome::number::Number *number) { this->name##_number_ = number; }
+
+namespace esphome {
+namespace number {
+class Number {
+ public:
+  virtual ~Number() = default;
+  void publish_state(float state) { this->state = state; }
+  float state{0.0f};
+
+ protected:
+  virtual void control(float value) = 0;
+};
+}  // namespace number
+}  // namespace esphome
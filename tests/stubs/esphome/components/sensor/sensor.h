@@ -0,0 +1,18 @@
+#pragma once
+
+#define SUB_SENSOR(name) \
+ protected: \
+  esphome::sensor::Sensor *name##_sensor_{nullptr}; \
+\
+ public: \
+  void set_##name##_sensor(esphome::sensor::Sensor *sensor) { this->name##_sensor_ = sensor; }
+
+namespace esphome {
+namespace sensor {
+class Sensor {
+ public:
+  void publish_state(float state) { this->state = state; }
+  float state{0.0f};
+};
+}  // namespace sensor
+}  // namespace esphome
@@ -0,0 +1,22 @@
+#pragma once
+
+#define SUB_SWITCH(name) \
+ protected: \
+  esphome::switch_::Switch *name##_switch_{nullptr}; \
+\
+ public: \
+  void set_##name##_switch(esphome::switch_::Switch *s) { this->name##_switch_ = s; }
+
+namespace esphome {
+namespace switch_ {
+class Switch {
+ public:
+  virtual ~Switch() = default;
+  void publish_state(bool state) { this->state = state; }
+  bool state{false};
+
+ protected:
+  virtual void write_state(bool state) = 0;
+};
+}  // namespace switch_
+}  // namespace esphome
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+#define SUB_TEXT_SENSOR(name) \
+ protected: \
+  esphome::text_sensor::TextSensor *name##_text_sensor_{nullptr}; \
+\
+ public: \
+  void set_##name##_text_sensor(esphome::text_sensor::TextSensor *sensor) { this->name##_text_sensor_ = sensor; }
+
+namespace esphome {
+namespace text_sensor {
+class TextSensor {
+ public:
+  void publish_state(const std::string &state) { this->state = state; }
+  std::string state;
+};
+}  // namespace text_sensor
+}  // namespace esphome
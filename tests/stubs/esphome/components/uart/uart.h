@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A UART with nothing attached: reads find no data, writes go nowhere
+namespace esphome {
+namespace uart {
+
+class UARTComponent {
+ public:
+  uint32_t get_baud_rate() const { return 9600; }
+};
+
+class UARTDevice {
+ public:
+  int available() { return 0; }
+  bool read_byte(uint8_t *data) {
+    (void) data;
+    return false;
+  }
+  bool read_array(uint8_t *data, size_t len) {
+    (void) data, (void) len;
+    return false;
+  }
+  void write_array(const uint8_t *data, size_t len) { (void) data, (void) len; }
+  void write_array(const std::vector<uint8_t> &data) { (void) data; }
+  void flush() {}
+
+ protected:
+  UARTComponent *parent_{nullptr};
+};
+
+}  // namespace uart
+}  // namespace esphome
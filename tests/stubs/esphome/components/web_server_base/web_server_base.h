@@ -0,0 +1,118 @@
+#pragma once
+
+// The parts of ESPHome's web_server_idf request API the components use. A
+// request wraps an httpd_req_t from host::new_request(); responses built on
+// it are sent through the httpd stand-ins, so they are recorded the same way.
+#include "esphome/core/defines.h"
+#include "esphome/core/helpers.h"
+#include <esp_http_server.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace esphome {
+namespace web_server_idf {
+
+class AsyncWebServerResponse {
+ public:
+  AsyncWebServerResponse(httpd_req_t *req) : req_(req) {}
+  virtual ~AsyncWebServerResponse() = default;
+  void addHeader(const char *name, const char *value);
+  virtual const char *get_content_data() const = 0;
+  virtual size_t get_content_size() const = 0;
+
+ protected:
+  httpd_req_t *req_;
+};
+
+class AsyncWebServerResponseContent : public AsyncWebServerResponse {
+ public:
+  AsyncWebServerResponseContent(httpd_req_t *req, std::string content)
+      : AsyncWebServerResponse(req), content_(std::move(content)) {}
+  const char *get_content_data() const override { return this->content_.data(); }
+  size_t get_content_size() const override { return this->content_.size(); }
+
+ protected:
+  std::string content_;
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse {
+ public:
+  explicit AsyncResponseStream(httpd_req_t *req) : AsyncWebServerResponse(req) {}
+  const char *get_content_data() const override { return this->content_.data(); }
+  size_t get_content_size() const override { return this->content_.size(); }
+  void print(const char *str) { this->content_.append(str); }
+  void print(const std::string &str) { this->content_.append(str); }
+  void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+  void write(const uint8_t *data, size_t len) { this->content_.append(reinterpret_cast<const char *>(data), len); }
+
+ protected:
+  std::string content_;
+};
+
+class AsyncWebServerRequest {
+ public:
+  explicit AsyncWebServerRequest(httpd_req_t *req) : req_(req) {}
+  ~AsyncWebServerRequest();
+
+  http_method method() const { return static_cast<http_method>(this->req_->method); }
+  std::string url() const;
+  size_t contentLength() const { return this->req_->content_len; }
+  bool hasHeader(const char *name) const;
+  optional<std::string> get_header(const char *name) const;
+  operator httpd_req_t *() const { return this->req_; }
+
+  void send(AsyncWebServerResponse *response);
+  void send(int code, const char *content_type = nullptr, const char *content = nullptr);
+  AsyncWebServerResponse *beginResponse(int code, const char *content_type);
+  AsyncWebServerResponse *beginResponse(int code, const char *content_type, const std::string &content);
+  AsyncWebServerResponse *beginResponse(int code, const char *content_type, const uint8_t *data,
+                                        const size_t data_size);
+  AsyncResponseStream *beginResponseStream(const char *content_type);
+
+ protected:
+  void init_response_(AsyncWebServerResponse *response, int code, const char *content_type);
+
+  httpd_req_t *req_;
+  AsyncWebServerResponse *rsp_{nullptr};
+};
+
+class AsyncWebHandler {
+ public:
+  virtual ~AsyncWebHandler() = default;
+  virtual bool canHandle(AsyncWebServerRequest *request) const {
+    (void) request;
+    return false;
+  }
+  virtual void handleRequest(AsyncWebServerRequest *request) { (void) request; }
+};
+
+class AsyncWebServer {
+ public:
+  httpd_handle_t get_server() { return this->server_; }
+
+ protected:
+  httpd_handle_t server_{nullptr};
+};
+
+}  // namespace web_server_idf
+
+using namespace web_server_idf;
+
+namespace web_server_base {
+class WebServerBase {
+ public:
+  void add_handler(AsyncWebHandler *handler) { this->handlers_.push_back(handler); }
+  AsyncWebServer *get_server() const { return this->server_.get(); }
+  uint16_t get_port() const { return 80; }
+
+ protected:
+  std::shared_ptr<AsyncWebServer> server_{std::make_shared<AsyncWebServer>()};
+  std::vector<AsyncWebHandler *> handlers_;
+};
+extern WebServerBase *global_web_server_base;
+}  // namespace web_server_base
+
+}  // namespace esphome
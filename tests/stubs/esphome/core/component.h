@@ -0,0 +1,38 @@
+#pragma once
+
+#include "esphome/core/gpio.h"
+#include "esphome/core/hal.h"
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace esphome {
+
+namespace setup_priority {
+extern const float DATA;
+extern const float WIFI;
+}  // namespace setup_priority
+
+// Nothing is scheduled on the host: timeouts and intervals are dropped
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+  void mark_failed() { this->failed_ = true; }
+  bool is_failed() const { return this->failed_; }
+  void set_timeout(uint32_t timeout, std::function<void()> &&f) { (void) timeout, (void) f; }
+  void set_interval(uint32_t interval, std::function<void()> &&f) { (void) interval, (void) f; }
+
+ protected:
+  bool failed_{false};
+};
+
+class PollingComponent : public Component {
+ public:
+  virtual void update() = 0;
+};
+
+}  // namespace esphome
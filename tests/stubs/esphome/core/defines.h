@@ -0,0 +1,7 @@
+#pragma once
+
+// What an ESP-IDF build with a pentair_if_ic component defines. The WebSocket
+// endpoint needs httpd's WebSocket API and is left out of the host build.
+#define USE_ESP32
+#define USE_ESP_IDF
+#define USE_PENTAIR_IF_IC
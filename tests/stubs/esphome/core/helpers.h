@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define YESNO(b) ((b) ? "YES" : "NO")
+
+namespace esphome {
+
+template<typename T> using optional = std::optional<T>;
+
+std::string format_hex_pretty(const uint8_t *data, size_t length);
+std::string format_hex_pretty(const std::vector<uint8_t> &data);
+
+template<typename T> class Parented {
+ protected:
+  T *parent_{nullptr};
+};
+
+class Mutex {
+ public:
+  void lock() { this->mutex_.lock(); }
+  bool try_lock() { return this->mutex_.try_lock(); }
+  void unlock() { this->mutex_.unlock(); }
+
+ private:
+  std::mutex mutex_;
+};
+
+class LockGuard {
+ public:
+  explicit LockGuard(Mutex &mutex) : mutex_(mutex) { this->mutex_.lock(); }
+  ~LockGuard() { this->mutex_.unlock(); }
+
+ private:
+  Mutex &mutex_;
+};
+
+// There is no PSRAM on the host; every allocation comes from the heap
+template<class T> class RAMAllocator {
+ public:
+  enum Flags { NONE = 0, ALLOC_INTERNAL = 1 << 0, ALLOC_EXTERNAL = 1 << 1 };
+  RAMAllocator(uint8_t flags = NONE) { (void) flags; }
+  T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::nothrow)); }
+  void deallocate(T *p, size_t n) {
+    (void) n;
+    ::operator delete(p);
+  }
+};
+
+template<typename... Ts> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) { this->callbacks_.push_back(std::move(callback)); }
+  void call(Ts... args) {
+    for (auto &callback : this->callbacks_)
+      callback(args...);
+  }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+
+}  // namespace esphome
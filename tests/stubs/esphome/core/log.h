@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdio>
+
+namespace esphome {
+void host_log(const char *level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+}  // namespace esphome
+
+#define ESP_LOGE(tag, ...) esphome::host_log("E", tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) esphome::host_log("W", tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) esphome::host_log("I", tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) esphome::host_log("D", tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) esphome::host_log("V", tag, __VA_ARGS__)
+#define ESP_LOGVV(tag, ...) esphome::host_log("VV", tag, __VA_ARGS__)
+#define ESP_LOGCONFIG(tag, ...) esphome::host_log("C", tag, __VA_ARGS__)
+
+#define LOG_SENSOR(prefix, name, sensor) (void) (sensor)
+#define LOG_BINARY_SENSOR(prefix, name, sensor) (void) (sensor)
+#define LOG_TEXT_SENSOR(prefix, name, sensor) (void) (sensor)
+#define LOG_SWITCH(prefix, name, sensor) (void) (sensor)
+#define LOG_NUMBER(prefix, name, sensor) (void) (sensor)
+#define LOG_PIN(prefix, pin) (void) (pin)
+#define LOG_UPDATE_INTERVAL(component) (void) (component)
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// One tick per millisecond
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define tskNO_AFFINITY 0x7FFFFFFF
@@ -0,0 +1,475 @@
+#include "host.h"
+#include "esphome/components/web_server_base/web_server_base.h"
+#include "esphome/core/component.h"
+#include "esphome/core/log.h"
+#include <esp_crt_bundle.h>
+#include <esp_heap_caps.h>
+#include <esp_http_client.h>
+#include <esp_system.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace host {
+
+static std::atomic<uint32_t> now_ms{1000};
+
+void set_millis(uint32_t ms) { now_ms = ms; }
+void advance_millis(uint32_t ms) { now_ms += ms; }
+
+// Requests and upstreams are touched by the proxy workers too
+static std::mutex lock;
+static std::condition_variable changed;
+
+// An async copy shares the record of the request it was made from
+static std::map<const httpd_req_t *, std::shared_ptr<Response>> responses;
+static std::vector<std::unique_ptr<httpd_req_t>> requests;
+
+static std::map<std::string, Upstream> upstreams;
+static std::map<std::string, int> fetches;
+static bool held = false;
+static int next_sockfd = 3;
+static int waiting = 0;
+
+std::string Response::header(const char *name) const {
+  for (const auto &header : this->headers) {
+    if (header.first == name)
+      return header.second;
+  }
+  return "";
+}
+
+static httpd_req_t *add_request(const httpd_req_t *from, std::shared_ptr<Response> response) {
+  auto req = std::make_unique<httpd_req_t>();
+  if (from != nullptr)
+    *req = *from;
+  httpd_req_t *raw = req.get();
+  requests.push_back(std::move(req));
+  responses[raw] = std::move(response);
+  return raw;
+}
+
+httpd_req_t *new_request(const char *uri) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto response = std::make_shared<Response>();
+  response->sockfd = next_sockfd++;
+  httpd_req_t *req = add_request(nullptr, response);
+  req->method = HTTP_GET;
+  snprintf(req->uri, sizeof(req->uri), "%s", uri);
+  return req;
+}
+
+// Caller holds lock
+static Response &record(const httpd_req_t *req) { return *responses.at(req); }
+
+Response response(httpd_req_t *req) {
+  std::lock_guard<std::mutex> guard(lock);
+  return record(req);
+}
+
+bool wait_completed(httpd_req_t *req, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> guard(lock);
+  return changed.wait_for(guard, std::chrono::milliseconds(timeout_ms), [req] {
+    const Response &response = record(req);
+    return (response.finished || response.closed) && response.completed;
+  });
+}
+
+void set_upstream(const char *url, const Upstream &upstream) {
+  std::lock_guard<std::mutex> guard(lock);
+  upstreams[url] = upstream;
+}
+
+int upstream_requests(const char *url) {
+  std::lock_guard<std::mutex> guard(lock);
+  return fetches[url];
+}
+
+void hold_upstream() {
+  std::lock_guard<std::mutex> guard(lock);
+  held = true;
+}
+
+void release_upstream() {
+  std::lock_guard<std::mutex> guard(lock);
+  held = false;
+  changed.notify_all();
+}
+
+bool wait_upstream_held(int n, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> guard(lock);
+  return changed.wait_for(guard, std::chrono::milliseconds(timeout_ms), [n] { return waiting == n; });
+}
+
+void reset() {
+  std::lock_guard<std::mutex> guard(lock);
+  responses.clear();
+  requests.clear();
+  upstreams.clear();
+  fetches.clear();
+  held = false;
+  changed.notify_all();
+  now_ms = 1000;
+}
+
+}  // namespace host
+
+namespace esphome {
+
+namespace setup_priority {
+const float DATA = 600.0f;
+const float WIFI = 250.0f;
+}  // namespace setup_priority
+
+uint32_t millis() { return host::now_ms; }
+uint32_t micros() { return host::now_ms * 1000; }
+void delay(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+void delayMicroseconds(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+void host_log(const char *level, const char *tag, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  printf("[%s][%s] ", level, tag);
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+}
+
+std::string format_hex_pretty(const uint8_t *data, size_t length) {
+  std::string out;
+  char hex[4];
+  for (size_t i = 0; i < length; i++) {
+    snprintf(hex, sizeof(hex), i == 0 ? "%02X" : ".%02X", data[i]);
+    out += hex;
+  }
+  return out;
+}
+
+std::string format_hex_pretty(const std::vector<uint8_t> &data) { return format_hex_pretty(data.data(), data.size()); }
+
+namespace web_server_base {
+WebServerBase *global_web_server_base = nullptr;
+}  // namespace web_server_base
+
+namespace web_server_idf {
+
+void AsyncWebServerResponse::addHeader(const char *name, const char *value) {
+  httpd_resp_set_hdr(this->req_, name, value);
+}
+
+void AsyncResponseStream::printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  char buf[512];
+  int len = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (len > 0)
+    this->content_.append(buf, std::min<size_t>(len, sizeof(buf) - 1));
+}
+
+AsyncWebServerRequest::~AsyncWebServerRequest() { delete this->rsp_; }
+
+std::string AsyncWebServerRequest::url() const {
+  const char *uri = this->req_->uri;
+  return std::string(uri, strcspn(uri, "?"));
+}
+
+bool AsyncWebServerRequest::hasHeader(const char *name) const {
+  return httpd_req_get_hdr_value_len(this->req_, name) != 0;
+}
+
+optional<std::string> AsyncWebServerRequest::get_header(const char *name) const {
+  size_t len = httpd_req_get_hdr_value_len(this->req_, name);
+  if (len == 0)
+    return {};
+  std::string value(len + 1, '\0');
+  httpd_req_get_hdr_value_str(this->req_, name, &value[0], len + 1);
+  value.resize(len);
+  return value;
+}
+
+// As web_server_idf: the status line only knows 200, 404 and 409, every
+// response declines ranges
+void AsyncWebServerRequest::init_response_(AsyncWebServerResponse *response, int code, const char *content_type) {
+  const char *status;
+  switch (code) {
+    case 200:
+      status = HTTPD_200;
+      break;
+    case 404:
+      status = "404 Not Found";
+      break;
+    case 409:
+      status = "409 Conflict";
+      break;
+    default:
+      status = "500 Internal Server Error";
+      break;
+  }
+  httpd_resp_set_status(this->req_, status);
+  if (content_type != nullptr && content_type[0] != '\0')
+    httpd_resp_set_type(this->req_, content_type);
+  httpd_resp_set_hdr(this->req_, "Accept-Ranges", "none");
+  delete this->rsp_;
+  this->rsp_ = response;
+}
+
+void AsyncWebServerRequest::send(AsyncWebServerResponse *response) {
+  httpd_resp_send(this->req_, response->get_content_data(), response->get_content_size());
+}
+
+void AsyncWebServerRequest::send(int code, const char *content_type, const char *content) {
+  this->send(this->beginResponse(code, content_type, content != nullptr ? content : ""));
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(int code, const char *content_type) {
+  return this->beginResponse(code, content_type, std::string());
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(int code, const char *content_type,
+                                                             const std::string &content) {
+  auto *response = new AsyncWebServerResponseContent(this->req_, content);
+  this->init_response_(response, code, content_type);
+  return response;
+}
+
+AsyncWebServerResponse *AsyncWebServerRequest::beginResponse(int code, const char *content_type,
+                                                             const uint8_t *data, const size_t data_size) {
+  return this->beginResponse(code, content_type, std::string(reinterpret_cast<const char *>(data), data_size));
+}
+
+AsyncResponseStream *AsyncWebServerRequest::beginResponseStream(const char *content_type) {
+  auto *response = new AsyncResponseStream(this->req_);
+  this->init_response_(response, 200, content_type);
+  return response;
+}
+
+}  // namespace web_server_idf
+}  // namespace esphome
+
+// ESP-IDF
+
+const char *esp_err_to_name(esp_err_t code) { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
+esp_err_t esp_crt_bundle_attach(void *conf) {
+  (void) conf;
+  return ESP_OK;
+}
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  (void) caps;
+  return 110592;
+}
+uint32_t esp_get_free_heap_size() { return 180224; }
+uint32_t esp_get_minimum_free_heap_size() { return 150000; }
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  host::record(r).status = status;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  host::record(r).type = type;
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  host::record(r).headers.emplace_back(field, value);
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  host::Response &response = host::record(r);
+  if (buf != nullptr)
+    response.body.append(buf, buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : buf_len);
+  response.finished = true;
+  host::changed.notify_all();
+  return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  host::Response &response = host::record(r);
+  if (buf_len == HTTPD_RESP_USE_STRLEN)
+    buf_len = buf != nullptr ? strlen(buf) : 0;
+  if (buf == nullptr || buf_len == 0) {
+    response.finished = true;
+    host::changed.notify_all();
+  } else {
+    response.body.append(buf, buf_len);
+    response.chunks++;
+  }
+  return ESP_OK;
+}
+
+// Requests carry no headers and no body
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+  (void) r, (void) field;
+  return 0;
+}
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size) {
+  (void) r, (void) field, (void) val, (void) val_size;
+  return ESP_ERR_NOT_FOUND;
+}
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len) {
+  (void) r, (void) buf, (void) buf_len;
+  return 0;
+}
+int httpd_req_to_sockfd(httpd_req_t *r) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  return host::record(r).sockfd;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  *out = host::add_request(r, host::responses.at(r));
+  return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r) {
+  std::lock_guard<std::mutex> guard(host::lock);
+  host::record(r).completed = true;
+  host::changed.notify_all();
+  return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg) {
+  (void) handle;
+  work(arg);
+  return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd) {
+  (void) handle;
+  std::lock_guard<std::mutex> guard(host::lock);
+  for (auto &entry : host::responses) {
+    if (entry.second->sockfd == sockfd)
+      entry.second->closed = true;
+  }
+  host::changed.notify_all();
+  return ESP_OK;
+}
+
+// FreeRTOS
+
+struct QueueDefinition {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  size_t length;
+  size_t item_size;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  auto *queue = new QueueDefinition();
+  queue->length = length;
+  queue->item_size = item_size;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> guard(queue->lock);
+  if (!queue->changed.wait_for(guard, std::chrono::milliseconds(ticks_to_wait),
+                               [queue] { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+  const auto *bytes = static_cast<const uint8_t *>(item);
+  queue->items.emplace_back(bytes, bytes + queue->item_size);
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> guard(queue->lock);
+  if (!queue->changed.wait_for(guard, std::chrono::milliseconds(ticks_to_wait),
+                               [queue] { return !queue->items.empty(); }))
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->item_size);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle) {
+  (void) name, (void) stack_depth, (void) priority;
+  std::thread(task, arg).detach();
+  if (handle != nullptr)
+    *handle = nullptr;
+  return pdPASS;
+}
+
+// esp_http_client, answered from host::upstreams
+
+struct esp_http_client {
+  std::string url;
+  host::Upstream upstream;
+  size_t read{0};
+};
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+  auto *client = new esp_http_client();
+  client->url = config->url;
+  return client;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+  (void) write_len;
+  std::unique_lock<std::mutex> guard(host::lock);
+  host::fetches[client->url]++;
+  host::waiting++;
+  host::changed.notify_all();
+  host::changed.wait(guard, [] { return !host::held; });
+  host::waiting--;
+  auto it = host::upstreams.find(client->url);
+  if (it == host::upstreams.end() || it->second.open_fails)
+    return ESP_FAIL;
+  client->upstream = it->second;
+  return ESP_OK;
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+  return client->upstream.chunked ? -1 : (int64_t) client->upstream.body.size();
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client) { return client->upstream.chunked; }
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) { return client->upstream.status; }
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) {
+  return client->upstream.chunked ? -1 : (int64_t) client->upstream.body.size();
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+  const host::Upstream &upstream = client->upstream;
+  size_t end = upstream.body.size();
+  if (upstream.fail_after >= 0) {
+    if (client->read >= (size_t) upstream.fail_after)
+      return -1;
+    end = upstream.fail_after;
+  }
+  size_t n = std::min<size_t>(len, end - client->read);
+  memcpy(buffer, upstream.body.data() + client->read, n);
+  client->read += n;
+  return n;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+  (void) client;
+  return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+  delete client;
+  return ESP_OK;
+}
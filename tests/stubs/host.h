@@ -0,0 +1,57 @@
+#pragma once
+
+// Controls for the host stand-ins in host.cpp: a settable clock, the responses
+// written to fake httpd requests, and a scripted upstream for esp_http_client.
+#include <esp_http_server.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace host {
+
+// millis() starts at 1000 and only moves when told to
+void set_millis(uint32_t ms);
+void advance_millis(uint32_t ms);
+
+// Everything sent on a request, including on its async copies
+struct Response {
+  std::string status;  // Empty until set, as httpd then sends 200 OK
+  std::string type;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  size_t chunks{0};        // httpd_resp_send_chunk() calls with data
+  bool finished{false};    // httpd_resp_send(), or the terminating chunk
+  bool completed{false};   // httpd_req_async_handler_complete() on a copy
+  bool closed{false};      // httpd_sess_trigger_close() on its socket
+  int sockfd{0};
+  std::string header(const char *name) const;
+};
+
+// A fresh request; its response is recorded until reset()
+httpd_req_t *new_request(const char *uri = "/");
+Response response(httpd_req_t *req);
+// Blocks until an async copy of req is answered (or closed) and completed;
+// false after timeout_ms
+bool wait_completed(httpd_req_t *req, uint32_t timeout_ms = 2000);
+
+// What esp_http_client_* reports for a URL
+struct Upstream {
+  int status{200};
+  std::string body;
+  bool open_fails{false};
+  bool chunked{false};   // No Content-Length
+  int fail_after{-1};    // Read error once this many body bytes were read
+};
+void set_upstream(const char *url, const Upstream &upstream);
+// Upstream fetches started (esp_http_client_open) for url
+int upstream_requests(const char *url);
+// While held, esp_http_client_open() blocks; release() lets every fetch go
+void hold_upstream();
+void release_upstream();
+// Blocks until n fetches are waiting on the hold; false after timeout_ms
+bool wait_upstream_held(int n, uint32_t timeout_ms = 2000);
+
+// Forgets requests and upstreams, releases the hold and resets the clock
+void reset();
+
+}  // namespace host
@@ -0,0 +1,3 @@
+#pragma once
+
+#define CONFIG_MBEDTLS_CERTIFICATE_BUNDLE 1
@@ -0,0 +1,43 @@
+#pragma once
+
+// Minimal checks for the host tests. A failed check prints where and what and
+// is counted; main() returns test_result() so ctest sees the failure.
+#include <cstdio>
+#include <cstring>
+
+inline int test_failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(actual, expected) \
+  do { \
+    long long actual_ = (long long) (actual); \
+    long long expected_ = (long long) (expected); \
+    if (actual_ != expected_) { \
+      fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, expected_); \
+      test_failures++; \
+    } \
+  } while (0)
+
+// A function rather than a block, so temporaries in actual live until it returns
+inline void check_str(const char *file, int line, const char *expr, const char *actual, const char *expected) {
+  if (actual == nullptr || strcmp(actual, expected) != 0) {
+    fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", file, line, expr,
+            actual != nullptr ? actual : "(null)", expected);
+    test_failures++;
+  }
+}
+
+#define CHECK_STR(actual, expected) check_str(__FILE__, __LINE__, #actual, (actual), (expected))
+
+inline int test_result() {
+  if (test_failures != 0)
+    fprintf(stderr, "%d check(s) failed\n", test_failures);
+  return test_failures == 0 ? 0 : 1;
+}
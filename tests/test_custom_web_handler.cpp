@@ -0,0 +1,100 @@
+#include "esphome/components/custom_web_handler/custom_web_handler.h"
+#include "host.h"
+#include "test.h"
+
+using namespace esphome::custom_web_handler;
+using esphome::web_server_idf::AsyncWebServerRequest;
+
+static void test_parse_range() {
+  size_t start = 0, end = 0;
+  CHECK_EQ(parse_range("bytes=0-99", 1000, &start, &end), RANGE_PARTIAL);
+  CHECK_EQ(start, 0);
+  CHECK_EQ(end, 99);
+  CHECK_EQ(parse_range("bytes=500-", 1000, &start, &end), RANGE_PARTIAL);
+  CHECK_EQ(start, 500);
+  CHECK_EQ(end, 999);
+  CHECK_EQ(parse_range("bytes=900-5000", 1000, &start, &end), RANGE_PARTIAL);
+  CHECK_EQ(start, 900);
+  CHECK_EQ(end, 999);
+
+  // Suffix ranges: the last n bytes, all of them if n exceeds the body
+  CHECK_EQ(parse_range("bytes=-100", 1000, &start, &end), RANGE_PARTIAL);
+  CHECK_EQ(start, 900);
+  CHECK_EQ(end, 999);
+  CHECK_EQ(parse_range("bytes=-2000", 1000, &start, &end), RANGE_PARTIAL);
+  CHECK_EQ(start, 0);
+  CHECK_EQ(end, 999);
+
+  CHECK_EQ(parse_range("bytes=1000-", 1000, &start, &end), RANGE_UNSATISFIABLE);
+  CHECK_EQ(parse_range("bytes=-0", 1000, &start, &end), RANGE_UNSATISFIABLE);
+  CHECK_EQ(parse_range("bytes=-5", 0, &start, &end), RANGE_UNSATISFIABLE);
+
+  // Anything else is served whole
+  CHECK_EQ(parse_range("bytes=0-1,5-6", 1000, &start, &end), RANGE_NONE);
+  CHECK_EQ(parse_range("items=0-1", 1000, &start, &end), RANGE_NONE);
+  CHECK_EQ(parse_range("bytes=5-2", 1000, &start, &end), RANGE_NONE);
+  CHECK_EQ(parse_range("bytes=abc", 1000, &start, &end), RANGE_NONE);
+  CHECK_EQ(parse_range("bytes=-", 1000, &start, &end), RANGE_NONE);
+  CHECK_EQ(parse_range("", 1000, &start, &end), RANGE_NONE);
+}
+
+static void test_accepts_encoding() {
+  CHECK(accepts_encoding("gzip, deflate, br", "br"));
+  CHECK(accepts_encoding("gzip, deflate, br", "gzip"));
+  CHECK(accepts_encoding("GZIP", "gzip"));
+  CHECK(accepts_encoding("gzip;q=0.5", "gzip"));
+  CHECK(accepts_encoding("deflate;q=0, gzip", "gzip"));
+  CHECK(!accepts_encoding("gzip;q=0, br", "gzip"));
+  CHECK(!accepts_encoding("br ; q=0", "br"));
+  CHECK(!accepts_encoding("gzip;q=0.000", "gzip"));
+  CHECK(!accepts_encoding("gzipx, x-gzip", "gzip"));
+  CHECK(!accepts_encoding("", "br"));
+}
+
+static void test_route_hash() {
+  // Values from route_hash() in __init__.py, which builds the table
+  CHECK_EQ(route_hash("", 0, 0), 0x811c9dc5u);
+  CHECK_EQ(route_hash("/hello", 6, 0), 0xf3b00e5eu);
+  CHECK_EQ(route_hash("/hello", 6, 7), 0x021f0aadu);
+  CHECK_EQ(route_hash("/api/pool/events", 16, 1234), 0xd9c9d36du);
+}
+
+static bool can_handle(CustomWebHandler &handler, const char *uri, int method = HTTP_GET) {
+  httpd_req_t *req = host::new_request(uri);
+  req->method = method;
+  AsyncWebServerRequest request(req);
+  return handler.canHandle(&request);
+}
+
+static void test_route_table() {
+  static const char *const PATHS[] = {"/hello", "/custom_page", "/api/status", "/styles.css", "/script.js"};
+  // build_route_table() in __init__.py for PATHS
+  static const uint8_t TABLE[16] = {0, 0, 0, 0, 2, 0, 3, 5, 0, 0, 4, 0, 0, 0, 0, 1};
+  static const uint32_t SEED = 1;
+
+  CustomWebHandler handler;
+  for (const char *path : PATHS)
+    handler.add_text_endpoint(path, "text/plain", "x", 1);
+  handler.set_route_table(TABLE, sizeof(TABLE), SEED);
+  // Added after the table, so found by the scan
+  handler.add_text_endpoint("/late", "text/plain", "x", 1);
+
+  for (const char *path : PATHS)
+    CHECK(can_handle(handler, path));
+  CHECK(can_handle(handler, "/api/status?verbose=1"));
+  CHECK(can_handle(handler, "/late"));
+  CHECK(!can_handle(handler, "/"));
+  CHECK(!can_handle(handler, "/hell"));
+  CHECK(!can_handle(handler, "/hello/"));
+  CHECK(!can_handle(handler, "/missing"));
+  CHECK(!can_handle(handler, "/hello", HTTP_POST));
+}
+
+int main() {
+  test_parse_range();
+  test_accepts_encoding();
+  test_route_hash();
+  test_route_table();
+  host::reset();
+  return test_result();
+}
@@ -0,0 +1,113 @@
+#include "esphome/components/custom_web_handler/metrics.h"
+#include "host.h"
+#include "test.h"
+#include <string>
+
+using namespace esphome::custom_web_handler;
+using namespace esphome::pentair_if_ic;
+
+#define CHECK_FIXED(value, scale, expected) \
+  do { \
+    char out[22]; \
+    CHECK_EQ(format_fixed(out, value, scale), strlen(expected)); \
+    CHECK_STR(out, expected); \
+  } while (0)
+
+static void test_format_fixed() {
+  CHECK_FIXED(0, 1, "0");
+  CHECK_FIXED(0, 1000, "0");
+  CHECK_FIXED(7, 1, "7");
+  CHECK_FIXED(25, 1000, "0.025");
+  CHECK_FIXED(1000, 1000, "1");
+  CHECK_FIXED(1500, 1000, "1.5");
+  CHECK_FIXED(123456, 1000, "123.456");
+  CHECK_FIXED(100, 1000000, "0.0001");
+  CHECK_FIXED(5, 10, "0.5");
+  CHECK_FIXED(18446744073709551615ull, 1, "18446744073709551615");
+  CHECK_FIXED(18446744073709551615ull, 1000000, "18446744073709.551615");
+}
+
+static void test_format_label() {
+  char out[64];
+  CHECK_EQ(format_label(out, sizeof(out), "path", "/api/pool"), 16);
+  CHECK_STR(out, "path=\"/api/pool\"");
+  format_label(out, sizeof(out), "path", "a\"b\\c\nd");
+  CHECK_STR(out, "path=\"a\\\"b\\\\c\\nd\"");
+
+  // Truncated to fit, never splitting an escape, always closed
+  char small[16];
+  CHECK_EQ(format_label(small, sizeof(small), "path", "/a\"b\\c/very/long"), 15);
+  CHECK_STR(small, "path=\"/a\\\"b\\\\c\"");
+  CHECK_EQ(format_label(small, 9, "path", "x\"y"), 8);
+  CHECK_STR(small, "path=\"x\"");
+  CHECK_EQ(format_label(small, 7, "path", "x"), 0);
+  CHECK_STR(small, "");
+}
+
+static void test_writer() {
+  host::reset();
+  httpd_req_t *req = host::new_request("/metrics");
+  MetricsWriter out(req);
+  out.family("test_bytes", "counter", "Bytes");
+  out.counter("test_bytes", nullptr, 1234);
+  out.family("test_seconds", "gauge", "Seconds");
+  out.gauge("test_seconds", "path=\"/a\"", 2500, 1000);
+  static const uint32_t BOUNDS[3] = {10, 100, 1000};
+  Histogram<3> histogram(BOUNDS);
+  histogram.record(5);
+  histogram.record(50);
+  histogram.record(5000);
+  out.family("test_rtt_seconds", "histogram", "RTT");
+  out.histogram("test_rtt_seconds", "device=\"pump\"", histogram, 1000);
+  // Longer than one chunk buffer
+  for (int i = 0; i < 20; i++)
+    out.gauge("test_padding_to_fill_more_than_one_chunk", nullptr, i);
+  out.finish();
+  CHECK(!out.failed());
+
+  host::Response response = host::response(req);
+  CHECK(response.finished);
+  CHECK(response.chunks > 1);
+  const std::string &body = response.body;
+  CHECK(body.find("# TYPE test_bytes counter\n# HELP test_bytes Bytes\ntest_bytes_total 1234\n") == 0);
+  CHECK(body.find("test_seconds{path=\"/a\"} 2.5\n") != std::string::npos);
+  CHECK(body.find("test_rtt_seconds_bucket{device=\"pump\",le=\"0.01\"} 1\n"
+                  "test_rtt_seconds_bucket{device=\"pump\",le=\"0.1\"} 2\n"
+                  "test_rtt_seconds_bucket{device=\"pump\",le=\"1\"} 2\n"
+                  "test_rtt_seconds_bucket{device=\"pump\",le=\"+Inf\"} 3\n"
+                  "test_rtt_seconds_count{device=\"pump\"} 3\n"
+                  "test_rtt_seconds_sum{device=\"pump\"} 5.055\n") != std::string::npos);
+  CHECK(body.size() >= 6 && body.compare(body.size() - 6, 6, "# EOF\n") == 0);
+}
+
+static void test_bus_metrics() {
+  host::reset();
+  httpd_req_t *req = host::new_request("/metrics");
+  PentairIfIcComponent pool;
+  MetricsWriter out(req);
+  write_bus_metrics(out, &pool);
+  out.finish();
+
+  host::Response response = host::response(req);
+  CHECK(response.finished);
+  CHECK(response.body.find("pentair_rx_bytes_total 0\n") != std::string::npos);
+  CHECK(response.body.find("pentair_command_rtt_seconds_bucket{device=\"pump\",le=\"+Inf\"} 0\n") !=
+        std::string::npos);
+  // Every line is a comment or a sample
+  size_t start = 0;
+  while (start < response.body.size()) {
+    size_t end = response.body.find('\n', start);
+    CHECK(end != std::string::npos);
+    std::string line = response.body.substr(start, end - start);
+    CHECK(line[0] == '#' || line.find(' ') != std::string::npos);
+    start = end + 1;
+  }
+}
+
+int main() {
+  test_format_fixed();
+  test_format_label();
+  test_writer();
+  test_bus_metrics();
+  return test_result();
+}
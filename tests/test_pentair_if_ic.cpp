@@ -0,0 +1,170 @@
+#include "esphome/components/pentair_if_ic/command_inbox.h"
+#include "esphome/components/pentair_if_ic/pool_state.h"
+#include "test.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace esphome::pentair_if_ic;
+
+static void test_ring_order() {
+  MpscRing<uint32_t, 4> ring;
+  uint32_t value = 0;
+  CHECK(!ring.pop(value));
+  for (uint32_t i = 1; i <= 4; i++)
+    CHECK(ring.push(i));
+  CHECK(!ring.push(5));
+  for (uint32_t i = 1; i <= 4; i++) {
+    CHECK(ring.pop(value));
+    CHECK_EQ(value, i);
+  }
+  CHECK(!ring.pop(value));
+}
+
+static void test_ring_batch() {
+  MpscRing<uint32_t, 8> ring;
+  uint32_t batch[9] = {10, 11, 12, 13, 14, 15, 16, 17, 18};
+  CHECK(ring.push_batch(batch, 0));
+  CHECK(!ring.push_batch(batch, 9));
+
+  // All or nothing: with 3 cells left a batch of 4 leaves the ring as it was
+  CHECK(ring.push_batch(batch, 5));
+  CHECK(!ring.push_batch(batch, 4));
+  CHECK(ring.push_batch(batch + 5, 3));
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < 8; i++) {
+    CHECK(ring.pop(value));
+    CHECK_EQ(value, batch[i]);
+  }
+  CHECK(!ring.pop(value));
+
+  // Wraps around the end of the cells
+  CHECK(ring.push_batch(batch, 6));
+  for (uint32_t i = 0; i < 6; i++)
+    CHECK(ring.pop(value));
+  CHECK(ring.push_batch(batch, 8));
+  for (uint32_t i = 0; i < 8; i++) {
+    CHECK(ring.pop(value));
+    CHECK_EQ(value, batch[i]);
+  }
+}
+
+// Producers race batches of 1-5 values into a small ring; the consumer must see
+// every batch whole and in order, never interleaved with another producer's.
+static void test_ring_concurrent_batches() {
+  static MpscRing<uint32_t, 16> ring;
+  const uint32_t producers = 4, batches = 5000;
+  std::atomic<uint32_t> done{0};
+  std::vector<std::thread> threads;
+  for (uint32_t p = 0; p < producers; p++) {
+    threads.emplace_back([p, &done] {
+      for (uint32_t b = 0; b < batches; b++) {
+        uint32_t count = 1 + b % 5;
+        uint32_t values[5];
+        // producer << 24 | batch << 8 | index << 4 | count
+        for (uint32_t i = 0; i < count; i++)
+          values[i] = p << 24 | b << 8 | i << 4 | count;
+        while (!ring.push_batch(values, count))
+          std::this_thread::yield();
+      }
+      done++;
+    });
+  }
+
+  uint64_t popped = 0, expected = 0;
+  uint32_t bad = 0, left = 0, batch = 0, count = 0;
+  uint32_t next_batch[producers] = {};
+  for (;;) {
+    bool finished = done == producers;
+    uint32_t value;
+    if (!ring.pop(value)) {
+      if (finished)
+        break;
+      std::this_thread::yield();
+      continue;
+    }
+    popped++;
+    uint32_t index = (value >> 4) & 0xF;
+    if (left == 0) {
+      // First value of a batch; each producer's batches arrive in order
+      batch = value >> 8;
+      count = value & 0xF;
+      uint32_t producer = value >> 24;
+      if (index != 0 || (batch & 0xFFFF) != next_batch[producer]++)
+        bad++;
+      left = count - 1;
+    } else {
+      if (value >> 8 != batch || index != count - left)
+        bad++;
+      left--;
+    }
+  }
+  for (auto &thread : threads)
+    thread.join();
+  for (uint32_t b = 0; b < batches; b++)
+    expected += producers * (1 + b % 5);
+  CHECK_EQ(popped, expected);
+  CHECK_EQ(bad, 0);
+  CHECK_EQ(left, 0);
+}
+
+static void test_seqlock() {
+  SeqLock<PoolState> lock;
+  PoolState state{};
+  CHECK_EQ(lock.read(state), 0);
+  CHECK_EQ(lock.generation(), 0);
+  state.rpm = 2400;
+  lock.write(state);
+  PoolState out{};
+  CHECK_EQ(lock.read(out), 1);
+  CHECK_EQ(out.rpm, 2400);
+  CHECK_EQ(lock.generation(), 1);
+}
+
+// A reader racing the writer must only ever copy a state written as a whole:
+// every field holds the same counter value.
+static void test_seqlock_concurrent() {
+  static SeqLock<PoolState> lock;
+  std::atomic<bool> stop{false};
+  uint32_t writes = 0;
+  std::thread writer([&stop, &writes] {
+    PoolState state{};
+    while (!stop) {
+      uint32_t i = ++writes;
+      state.pump_updated_ms = i;
+      state.flow_milli = i;
+      state.pressure_milli = i;
+      state.chlor_updated_ms = i;
+      state.rpm = (uint16_t) i;
+      state.salt_ppm = (uint16_t) i;
+      lock.write(state);
+    }
+  });
+
+  uint32_t torn = 0, backwards = 0, last = 0;
+  for (uint32_t reads = 0; reads < 200000; reads++) {
+    PoolState state;
+    uint32_t generation = lock.read(state);
+    uint32_t v = state.pump_updated_ms;
+    if (state.flow_milli != v || state.pressure_milli != v || state.chlor_updated_ms != v ||
+        state.rpm != (uint16_t) v || state.salt_ppm != (uint16_t) v || generation != v)
+      torn++;
+    if (generation < last)
+      backwards++;
+    last = generation;
+  }
+  stop = true;
+  writer.join();
+  CHECK_EQ(torn, 0);
+  CHECK_EQ(backwards, 0);
+  CHECK_EQ(lock.generation(), writes);
+}
+
+int main() {
+  test_ring_order();
+  test_ring_batch();
+  test_ring_concurrent_batches();
+  test_seqlock();
+  test_seqlock_concurrent();
+  return test_result();
+}
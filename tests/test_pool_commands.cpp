@@ -0,0 +1,111 @@
+#include "esphome/components/custom_web_handler/pool_commands.h"
+#include "test.h"
+
+using namespace esphome::custom_web_handler;
+using namespace esphome::pentair_if_ic;
+
+static const size_t MAX = 8;
+
+static const char *parse(const char *body, ParsedCommand *out, size_t *count, size_t max = MAX) {
+  return parse_pool_commands(body, strlen(body), out, max, count);
+}
+
+static void test_valid_batch() {
+  ParsedCommand out[MAX];
+  size_t count = 0;
+  CHECK(parse(R"([{"cmd":"rpm","value":2400},{"cmd":"run"},{"cmd":"swg","value":40}])", out, &count) == nullptr);
+  CHECK_EQ(count, 3);
+  CHECK_EQ(out[0].command.type, POOL_COMMAND_RPM);
+  CHECK_EQ(out[0].command.value, 2400);
+  CHECK(out[0].error == nullptr);
+  CHECK_EQ(out[1].command.type, POOL_COMMAND_RUN);
+  CHECK(out[1].error == nullptr);
+  CHECK_EQ(out[2].command.type, POOL_COMMAND_SWG_PERCENT);
+  CHECK_EQ(out[2].command.value, 40);
+  CHECK(out[2].error == nullptr);
+
+  // Whitespace, member order, and HTTP local programs 1-4 becoming 0-3
+  CHECK(parse(" [ {\"value\" : 3 ,\n\"cmd\":\"local_program\"} , {\"cmd\":\"external_program\",\"value\":0} ] ", out,
+              &count) == nullptr);
+  CHECK_EQ(count, 2);
+  CHECK_EQ(out[0].command.type, POOL_COMMAND_LOCAL_PROGRAM);
+  CHECK_EQ(out[0].command.value, 2);
+  CHECK(out[0].error == nullptr);
+  CHECK_EQ(out[1].command.type, POOL_COMMAND_EXTERNAL_PROGRAM);
+  CHECK(out[1].error == nullptr);
+}
+
+static void test_invalid_commands() {
+  // Each command is judged on its own; the body as a whole still parses
+  ParsedCommand out[MAX];
+  size_t count = 0;
+  CHECK(parse(R"([{"cmd":"rpm","value":12},{"cmd":"swg","value":101},{"cmd":"local_program","value":5},)"
+              R"({"cmd":"external_program","value":9},{"cmd":"nope"},{},{"cmd":"rpm"},{"cmd":"stop","value":1}])",
+              out, &count) == nullptr);
+  CHECK_EQ(count, 8);
+  CHECK_STR(out[0].error, "rpm must be 450-3450");
+  CHECK_STR(out[1].error, "swg percent must be 0-100");
+  CHECK_STR(out[2].error, "no such local program");
+  CHECK_STR(out[3].error, "no such external program");
+  CHECK_STR(out[4].error, "unknown command");
+  CHECK_EQ(out[4].command.type, POOL_COMMAND_TYPE_COUNT);
+  CHECK_STR(out[5].error, "missing cmd");
+  CHECK_STR(out[6].error, "missing value");
+  CHECK(out[7].error == nullptr);
+}
+
+static void test_conflicts() {
+  ParsedCommand out[MAX];
+  size_t count = 0;
+  CHECK(parse(R"([{"cmd":"run"},{"cmd":"rpm","value":2400},{"cmd":"stop"},{"cmd":"rpm","value":1000}])", out,
+              &count) == nullptr);
+  CHECK_EQ(count, 4);
+  CHECK(out[0].error == nullptr);
+  CHECK(out[1].error == nullptr);
+  CHECK_STR(out[2].error, "conflicts with an earlier command");
+  CHECK_STR(out[3].error, "conflicts with an earlier command");
+
+  CHECK(pool_commands_conflict(POOL_COMMAND_RUN, POOL_COMMAND_STOP));
+  CHECK(pool_commands_conflict(POOL_COMMAND_SWG_PERCENT, POOL_COMMAND_SWG_PERCENT));
+  CHECK(!pool_commands_conflict(POOL_COMMAND_LOCAL_PROGRAM, POOL_COMMAND_EXTERNAL_PROGRAM));
+}
+
+static void test_malformed_bodies() {
+  ParsedCommand out[MAX];
+  size_t count = 0;
+  CHECK_STR(parse("", out, &count), "expected an array of commands");
+  CHECK_STR(parse("{}", out, &count), "expected an array of commands");
+  CHECK_STR(parse("[]", out, &count), "no commands");
+  CHECK_STR(parse("[1]", out, &count), "expected a command object");
+  CHECK_STR(parse(R"([{"cmd":"run"},])", out, &count), "expected a command object");
+  CHECK_STR(parse(R"([{"cmd":"run"}] x)", out, &count), "expected , or ] after command");
+  CHECK_STR(parse(R"([{"cmd":"run"})", out, &count), "expected , or ] after command");
+  CHECK_STR(parse(R"([{"cmd":"run" "value":1}])", out, &count), "expected , or } in command");
+  CHECK_STR(parse(R"([{cmd:"run"}])", out, &count), "expected a member name");
+  CHECK_STR(parse(R"([{"cmd":"r\"un"}])", out, &count), "cmd must be a string");
+  CHECK_STR(parse(R"([{"cmd":1}])", out, &count), "cmd must be a string");
+  CHECK_STR(parse(R"([{"cmd":"rpm","value":"2400"}])", out, &count), "value must be an integer");
+  CHECK_STR(parse(R"([{"cmd":"rpm","value":1234567890}])", out, &count), "value must be an integer");
+  CHECK_STR(parse(R"([{"cmd":"rpm","value":-}])", out, &count), "value must be an integer");
+  CHECK_STR(parse(R"([{"cmd":"run","extra":1}])", out, &count), "unknown member, expected cmd or value");
+  CHECK_STR(parse(R"([{"cmd":"run"},{"cmd":"stop"},{"cmd":"rpm","value":450}])", out, &count, 2),
+            "too many commands");
+
+  // Negative values parse and fail validation instead
+  CHECK(parse(R"([{"cmd":"swg","value":-5}])", out, &count) == nullptr);
+  CHECK_EQ(out[0].command.value, -5);
+  CHECK_STR(out[0].error, "swg percent must be 0-100");
+
+  // Only len bytes are read
+  const char *body = R"([{"cmd":"run"}]garbage)";
+  CHECK(parse_pool_commands(body, 15, out, MAX, &count) == nullptr);
+  CHECK_EQ(count, 1);
+}
+
+int main() {
+  test_valid_batch();
+  test_invalid_commands();
+  test_conflicts();
+  test_malformed_bodies();
+  return test_result();
+}
@@ -0,0 +1,182 @@
+#include "esphome/components/custom_web_handler/pool_snapshot.h"
+#include "test.h"
+#include <string>
+
+using namespace esphome::custom_web_handler;
+using esphome::pentair_if_ic::PoolState;
+
+static std::string hex(const uint8_t *data, size_t len) {
+  std::string out;
+  char byte[3];
+  for (size_t i = 0; i < len; i++) {
+    snprintf(byte, sizeof(byte), "%02x", data[i]);
+    out += byte;
+  }
+  return out;
+}
+
+#define CHECK_HEX(data, len, expected) \
+  do { \
+    std::string actual_hex = hex(data, len); \
+    CHECK_STR(actual_hex.c_str(), expected); \
+  } while (0)
+
+// A running pump and a chlorinator with two alarms, as seen at 5 s uptime
+static PoolState typical_state() {
+  PoolState state{};
+  state.pump_updated_ms = 4000;
+  state.power_w = 612;
+  state.rpm = 2450;
+  state.flow_milli = 11350;
+  state.pressure_milli = 827;
+  state.time_remaining_min = 95;
+  state.clock_min = 754;
+  state.program = 2;
+  state.running = true;
+  state.chlor_updated_ms = 3000;
+  state.salt_ppm = 3250;
+  state.water_temp = 27;
+  state.set_percent = 40;
+  state.status = 0x80;
+  state.error_flags = 0x05;
+  return state;
+}
+
+// Every field at its widest
+static PoolState largest_state() {
+  PoolState state{};
+  state.pump_updated_ms = 1;
+  state.power_w = 0xFFFF;
+  state.rpm = 0xFFFF;
+  state.flow_milli = 0xFFFFFFFF;
+  state.pressure_milli = 0xFFFFFFFF;
+  state.time_remaining_min = 0xFFFF;
+  state.clock_min = 0xFFFF;
+  state.program = 0xFF;
+  state.running = true;
+  state.chlor_updated_ms = 1;
+  state.salt_ppm = 0xFFFF;
+  state.water_temp = 0xFF;
+  state.set_percent = 0xFF;
+  state.status = 0xFF;
+  state.error_flags = 0xFF;
+  return state;
+}
+
+static void test_json() {
+  char buf[POOL_STATE_JSON_SIZE];
+  PoolState empty{};
+  size_t len = write_pool_state_json(buf, sizeof(buf), empty, 0, 5000);
+  CHECK_STR(buf, R"({"generation":0,"uptime_ms":5000,"pump":null,"chlorinator":null,"alarms":null})");
+  CHECK_EQ(len, strlen(buf));
+
+  len = write_pool_state_json(buf, sizeof(buf), typical_state(), 412, 5000);
+  CHECK_STR(buf, R"({"generation":412,"uptime_ms":5000,)"
+                 R"("pump":{"age_ms":1000,"running":true,"rpm":2450,"power":612,"flow":11.350,"pressure":0.827,)"
+                 R"("time_remaining":95,"clock":754,"program":"Local 2","program_code":2},)"
+                 R"("chlorinator":{"age_ms":2000,"salt_ppm":3250,"water_temp":27,"set_percent":40,"status":128,)"
+                 R"("error":5},)"
+                 R"("alarms":{"no_flow":true,"low_salt":false,"high_salt":true,"clean":false,"high_current":false,)"
+                 R"("low_volts":false,"low_temp":false,"check_pcb":false}})");
+  CHECK_EQ(len, strlen(buf));
+
+  // The buffer size is enough for the largest document, and too little is refused
+  len = write_pool_state_json(buf, sizeof(buf), largest_state(), 0xFFFFFFFF, 0xFFFFFFFF);
+  CHECK(len > 0);
+  CHECK(len < sizeof(buf));
+  CHECK_EQ(write_pool_state_json(buf, 100, typical_state(), 412, 5000), 0);
+}
+
+static void test_cbor() {
+  uint8_t buf[POOL_STATE_CBOR_SIZE];
+  PoolState empty{};
+  size_t len = write_pool_state_cbor(buf, sizeof(buf), empty, 0, 5000);
+  // [1, 0, 5000, null, null]
+  CHECK_HEX(buf, len, "850100191388f6f6");
+
+  len = write_pool_state_cbor(buf, sizeof(buf), typical_state(), 412, 5000);
+  // [1, 412, 5000, [1000, true, 2450, 612, 11350, 827, 95, 754, 2], [2000, 3250, 27, 40, 128, 5]]
+  CHECK_HEX(buf, len,
+            "850119019c191388"
+            "891903e8f5190992190264192c5619033b185f1902f202"
+            "861907d0190cb2181b1828188005");
+
+  len = write_pool_state_cbor(buf, sizeof(buf), largest_state(), 0xFFFFFFFF, 0xFFFFFFFF);
+  CHECK_EQ(len, 60);
+  CHECK_EQ(write_pool_state_cbor(buf, len - 1, largest_state(), 0xFFFFFFFF, 0xFFFFFFFF), 0);
+}
+
+static void test_frames() {
+  uint8_t buf[POOL_STATE_FRAME_SIZE];
+  PoolState empty{};
+  PoolState state = typical_state();
+
+  // Type, generation, mask 0x1fff, then every field at its width, little-endian
+  size_t len = write_pool_state_frame(buf, sizeof(buf), POOL_FRAME_SNAPSHOT, empty, state, 412);
+  CHECK_EQ(len, 31);
+  CHECK_HEX(buf, len, "019c010000ff1f0192096402562c00003b0300005f00f20202b20c1b288005");
+
+  // Only what was received: the pump without the chlorinator is bits 0-7
+  PoolState pump_only = state;
+  pump_only.chlor_updated_ms = 0;
+  len = write_pool_state_frame(buf, sizeof(buf), POOL_FRAME_SNAPSHOT, empty, pump_only, 1);
+  CHECK_EQ(len, 7 + 1 + 2 + 2 + 4 + 4 + 2 + 2 + 1);
+  CHECK_EQ(buf[5], 0xFF);
+  CHECK_EQ(buf[6], 0x00);
+  CHECK_EQ(write_pool_state_frame(buf, sizeof(buf), POOL_FRAME_SNAPSHOT, empty, empty, 0), 7);
+
+  // A delta carries what changed; a new age alone is no change
+  PoolState next = state;
+  next.rpm = 2600;
+  next.pump_updated_ms = 4500;
+  len = write_pool_state_frame(buf, sizeof(buf), POOL_FRAME_DELTA, state, next, 413);
+  CHECK_HEX(buf, len, "029d0100000200280a");
+  next = state;
+  next.pump_updated_ms = 4500;
+  CHECK_EQ(write_pool_state_frame(buf, sizeof(buf), POOL_FRAME_DELTA, state, next, 413), 0);
+
+  PoolState largest = largest_state();
+  CHECK_EQ(write_pool_state_frame(buf, sizeof(buf), POOL_FRAME_SNAPSHOT, empty, largest, 1), 31);
+  CHECK_EQ(write_pool_state_frame(buf, 30, POOL_FRAME_SNAPSHOT, empty, largest, 1), 0);
+}
+
+static void test_json_delta() {
+  char buf[POOL_STATE_JSON_SIZE];
+  PoolState empty{};
+  PoolState state = typical_state();
+  PoolState next = state;
+  next.rpm = 2600;
+  next.pump_updated_ms = 4500;
+  BufferWriter out(buf, sizeof(buf));
+  CHECK(write_pool_state_delta(out, state, next, 413));
+  CHECK_STR(buf, R"({"generation":413,"pump":{"rpm":2600}})");
+
+  // A section seen for the first time is written whole, without ages
+  BufferWriter first(buf, sizeof(buf));
+  PoolState chlorinator_only{};
+  chlorinator_only.chlor_updated_ms = 3000;
+  chlorinator_only.salt_ppm = 3250;
+  CHECK(write_pool_state_delta(first, empty, chlorinator_only, 1));
+  CHECK_STR(buf, R"({"generation":1,"chlorinator":{"salt_ppm":3250,"water_temp":0,"set_percent":0,"status":0,)"
+                 R"("error":0},"alarms":{"no_flow":false,"low_salt":false,"high_salt":false,"clean":false,)"
+                 R"("high_current":false,"low_volts":false,"low_temp":false,"check_pcb":false}})");
+
+  // Only the alarm that changed
+  BufferWriter alarms(buf, sizeof(buf));
+  next = state;
+  next.error_flags = 0x04;
+  CHECK(write_pool_state_delta(alarms, state, next, 414));
+  CHECK_STR(buf, R"({"generation":414,"chlorinator":{"error":4},"alarms":{"no_flow":false}})");
+
+  BufferWriter none(buf, sizeof(buf));
+  CHECK(!write_pool_state_delta(none, state, state, 415));
+  CHECK_EQ(none.length(), 0);
+}
+
+int main() {
+  test_json();
+  test_cbor();
+  test_frames();
+  test_json_delta();
+  return test_result();
+}
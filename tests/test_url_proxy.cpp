@@ -0,0 +1,287 @@
+#include "esphome/components/custom_web_handler/custom_web_handler.h"
+#include "host.h"
+#include "test.h"
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace esphome::custom_web_handler;
+
+// The workers run for the rest of the test, so proxies are never destroyed
+static UrlProxy *new_proxy(uint8_t workers, uint32_t timeout_ms = 10000) {
+  auto *proxy = new UrlProxy();
+  proxy->set_max_concurrent(workers);
+  proxy->set_timeout(timeout_ms);
+  return proxy;
+}
+
+static Endpoint url_endpoint(const char *path, const char *url) {
+  Endpoint endpoint{};
+  endpoint.path = path;
+  endpoint.path_len = strlen(path);
+  endpoint.content_type = "application/json";
+  endpoint.content = url;
+  endpoint.type = ENDPOINT_URL;
+  return endpoint;
+}
+
+static std::string body_of(size_t size) {
+  std::string body;
+  for (size_t i = 0; i < size; i++)
+    body += static_cast<char>('a' + i % 26);
+  return body;
+}
+
+// Submits a fresh request; returns it, or nullptr if the proxy refused it
+static httpd_req_t *submit(UrlProxy *proxy, const Endpoint &endpoint) {
+  httpd_req_t *req = host::new_request(endpoint.path);
+  return proxy->submit(req, &endpoint) ? req : nullptr;
+}
+
+static bool wait_for_fetches(const char *url, int n) {
+  for (int i = 0; i < 200 && host::upstream_requests(url) < n; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  return host::upstream_requests(url) == n;
+}
+
+static void test_relay() {
+  host::reset();
+  const char *url = "http://upstream/relay";
+  std::string body = body_of(2500);
+  host::set_upstream(url, {200, body});
+  UrlProxy *proxy = new_proxy(1);
+  CHECK(proxy->start());
+  Endpoint endpoint = url_endpoint("/relay", url);
+
+  httpd_req_t *req = submit(proxy, endpoint);
+  CHECK(req != nullptr);
+  CHECK(host::wait_completed(req));
+  host::Response response = host::response(req);
+  CHECK_STR(response.status.c_str(), "200 OK");
+  CHECK_STR(response.type.c_str(), "application/json");
+  CHECK(response.body == body);
+  // Relayed as it arrived, one read buffer per chunk
+  CHECK_EQ(response.chunks, 3);
+  CHECK(response.finished);
+  CHECK(!response.closed);
+}
+
+static void test_upstream_errors() {
+  host::reset();
+  UrlProxy *proxy = new_proxy(1);
+  CHECK(proxy->start());
+
+  host::set_upstream("http://upstream/missing", {404, "not here"});
+  Endpoint missing = url_endpoint("/missing", "http://upstream/missing");
+  httpd_req_t *req = submit(proxy, missing);
+  CHECK(host::wait_completed(req));
+  CHECK_STR(host::response(req).status.c_str(), "502 Bad Gateway");
+  CHECK_STR(host::response(req).body.c_str(), "HTTP Error");
+
+  host::Upstream down;
+  down.open_fails = true;
+  host::set_upstream("http://upstream/down", down);
+  Endpoint unreachable = url_endpoint("/down", "http://upstream/down");
+  req = submit(proxy, unreachable);
+  CHECK(host::wait_completed(req));
+  CHECK_STR(host::response(req).status.c_str(), "502 Bad Gateway");
+  CHECK_STR(host::response(req).body.c_str(), "Failed to fetch URL");
+
+  // Failing on the first read still gets a clean error status
+  host::Upstream empty{200, body_of(100)};
+  empty.fail_after = 0;
+  host::set_upstream("http://upstream/empty", empty);
+  Endpoint failing = url_endpoint("/empty", "http://upstream/empty");
+  req = submit(proxy, failing);
+  CHECK(host::wait_completed(req));
+  CHECK_STR(host::response(req).status.c_str(), "502 Bad Gateway");
+
+  // Failing mid-body closes the connection instead of ending the body
+  host::Upstream cut{200, body_of(3000)};
+  cut.fail_after = 1500;
+  host::set_upstream("http://upstream/cut", cut);
+  Endpoint truncated = url_endpoint("/cut", "http://upstream/cut");
+  req = submit(proxy, truncated);
+  CHECK(host::wait_completed(req));
+  host::Response response = host::response(req);
+  CHECK_STR(response.status.c_str(), "200 OK");
+  CHECK_EQ(response.body.size(), 1500);
+  CHECK(!response.finished);
+  CHECK(response.closed);
+}
+
+static void test_saturation() {
+  host::reset();
+  const char *url = "http://upstream/slow";
+  host::set_upstream(url, {200, "{}"});
+  UrlProxy *proxy = new_proxy(1);
+  CHECK(proxy->start());
+  Endpoint endpoint = url_endpoint("/slow", url);
+
+  // One request on the worker, one waiting for it, and the next is refused
+  host::hold_upstream();
+  httpd_req_t *first = submit(proxy, endpoint);
+  CHECK(first != nullptr);
+  CHECK(host::wait_upstream_held(1));
+  httpd_req_t *second = submit(proxy, endpoint);
+  CHECK(second != nullptr);
+  httpd_req_t *refused = host::new_request("/slow");
+  CHECK(!proxy->submit(refused, &endpoint));
+  // Untouched, for the caller to answer
+  CHECK(host::response(refused).status.empty());
+  CHECK(!host::response(refused).finished);
+
+  host::release_upstream();
+  CHECK(host::wait_completed(first));
+  CHECK(host::wait_completed(second));
+  CHECK_STR(host::response(second).body.c_str(), "{}");
+  CHECK_EQ(host::upstream_requests(url), 2);
+}
+
+static void test_waiting_for_worker_times_out() {
+  host::reset();
+  const char *url = "http://upstream/queued";
+  host::set_upstream(url, {200, "{}"});
+  UrlProxy *proxy = new_proxy(1, 5000);
+  CHECK(proxy->start());
+  Endpoint endpoint = url_endpoint("/queued", url);
+
+  host::hold_upstream();
+  httpd_req_t *first = submit(proxy, endpoint);
+  CHECK(host::wait_upstream_held(1));
+  httpd_req_t *second = submit(proxy, endpoint);
+  CHECK(second != nullptr);
+  host::advance_millis(6000);
+  host::release_upstream();
+  CHECK(host::wait_completed(first));
+  CHECK(host::wait_completed(second));
+  CHECK_STR(host::response(first).status.c_str(), "200 OK");
+  CHECK_STR(host::response(second).status.c_str(), "504 Gateway Timeout");
+  CHECK_EQ(host::upstream_requests(url), 1);
+}
+
+static void test_cache() {
+  host::reset();
+  const char *url = "http://upstream/cached";
+  host::set_upstream(url, {200, "{\"temp\":21}"});
+  UrlProxy *proxy = new_proxy(1);
+  Endpoint endpoint = url_endpoint("/cached", url);
+  proxy->add_cache(&endpoint, 60000, 60000);
+  CHECK(proxy->start());
+
+  httpd_req_t *req = submit(proxy, endpoint);
+  CHECK(host::wait_completed(req));
+  CHECK_EQ(host::upstream_requests(url), 1);
+
+  // Fresh: answered at once on the caller's task, with its age
+  host::advance_millis(30000);
+  req = submit(proxy, endpoint);
+  host::Response response = host::response(req);
+  CHECK(response.finished);
+  CHECK(!response.completed);
+  CHECK_STR(response.body.c_str(), "{\"temp\":21}");
+  CHECK_STR(response.header("Age").c_str(), "30");
+  CHECK_EQ(host::upstream_requests(url), 1);
+
+  // Stale: still answered at once, while one fetch refreshes it
+  host::set_upstream(url, {200, "{\"temp\":22}"});
+  host::advance_millis(40000);
+  req = submit(proxy, endpoint);
+  CHECK_STR(host::response(req).body.c_str(), "{\"temp\":21}");
+  CHECK_STR(host::response(req).header("Age").c_str(), "70");
+  req = submit(proxy, endpoint);
+  CHECK(host::response(req).finished);
+  CHECK(wait_for_fetches(url, 2));
+  for (int i = 0; i < 200 && host::response(req = submit(proxy, endpoint)).body != "{\"temp\":22}"; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  CHECK_STR(host::response(req).body.c_str(), "{\"temp\":22}");
+  CHECK_STR(host::response(req).header("Age").c_str(), "0");
+
+  // Past the stale window: fetched again before answering
+  host::advance_millis(130000);
+  req = submit(proxy, endpoint);
+  CHECK(host::wait_completed(req));
+  CHECK_EQ(host::upstream_requests(url), 3);
+}
+
+static void test_collapsed_misses() {
+  host::reset();
+  const char *url = "http://upstream/popular";
+  host::set_upstream(url, {200, body_of(3000)});
+  UrlProxy *proxy = new_proxy(2);
+  Endpoint endpoint = url_endpoint("/popular", url);
+  proxy->add_cache(&endpoint, 60000, 0);
+  CHECK(proxy->start());
+
+  // Misses during a fetch wait for it instead of starting their own
+  host::hold_upstream();
+  httpd_req_t *first = submit(proxy, endpoint);
+  CHECK(host::wait_upstream_held(1));
+  httpd_req_t *waiters[3];
+  for (auto &waiter : waiters) {
+    waiter = submit(proxy, endpoint);
+    CHECK(waiter != nullptr);
+  }
+  host::release_upstream();
+  CHECK(host::wait_completed(first));
+  for (auto *waiter : waiters) {
+    CHECK(host::wait_completed(waiter));
+    CHECK(host::response(waiter).body == body_of(3000));
+  }
+  CHECK_EQ(host::upstream_requests(url), 1);
+}
+
+static void test_waiters_time_out() {
+  host::reset();
+  const char *url = "http://upstream/stuck";
+  host::set_upstream(url, {200, "{}"});
+  // A second worker is free to sweep expired waiters
+  UrlProxy *proxy = new_proxy(2, 5000);
+  Endpoint endpoint = url_endpoint("/stuck", url);
+  proxy->add_cache(&endpoint, 60000, 0);
+  CHECK(proxy->start());
+
+  host::hold_upstream();
+  httpd_req_t *first = submit(proxy, endpoint);
+  CHECK(host::wait_upstream_held(1));
+  httpd_req_t *waiter = submit(proxy, endpoint);
+  CHECK(waiter != nullptr);
+  host::advance_millis(6000);
+  CHECK(host::wait_completed(waiter));
+  CHECK_STR(host::response(waiter).status.c_str(), "504 Gateway Timeout");
+  CHECK_STR(host::response(waiter).body.c_str(), "Upstream too slow");
+
+  host::release_upstream();
+  CHECK(host::wait_completed(first));
+  CHECK_STR(host::response(first).status.c_str(), "200 OK");
+}
+
+static void test_too_large_to_cache() {
+  host::reset();
+  const char *url = "http://upstream/large";
+  host::set_upstream(url, {200, body_of(2500)});
+  UrlProxy *proxy = new_proxy(1);
+  proxy->set_cache_size(1000);
+  Endpoint endpoint = url_endpoint("/large", url);
+  proxy->add_cache(&endpoint, 60000, 0);
+  CHECK(proxy->start());
+
+  for (int i = 1; i <= 2; i++) {
+    httpd_req_t *req = submit(proxy, endpoint);
+    CHECK(host::wait_completed(req));
+    CHECK_EQ(host::response(req).body.size(), 2500);
+    CHECK_EQ(host::upstream_requests(url), i);
+  }
+}
+
+int main() {
+  test_relay();
+  test_upstream_errors();
+  test_saturation();
+  test_waiting_for_worker_times_out();
+  test_cache();
+  test_collapsed_misses();
+  test_waiters_time_out();
+  test_too_large_to_cache();
+  return test_result();
+}